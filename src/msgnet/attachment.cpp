@@ -0,0 +1,56 @@
+#include "attachment.hpp"
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#ifndef _WIN32
+#include <cerrno>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+using namespace MsgNet;
+
+static thread_local const Attachment* packing{nullptr};
+
+Attachment::Attachment(std::shared_ptr<const std::vector<char>> buffer) :
+    ptr{buffer ? buffer->data() : nullptr}, length{buffer ? buffer->size() : 0} {
+    owner = std::move(buffer);
+}
+
+Attachment::Attachment(std::shared_ptr<const void> owner, const char* data, const size_t size) :
+    owner{std::move(owner)}, ptr{data}, length{size} {
+}
+
+#ifndef _WIN32
+Attachment Attachment::map(const int fd, const uint64_t offset, const size_t size) {
+    if (size == 0) {
+        return Attachment{};
+    }
+
+    // The offset of the mapping must be aligned to the page
+    const auto page = static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+    const auto aligned = offset / page * page;
+    const auto skip = static_cast<size_t>(offset - aligned);
+
+    auto* addr = mmap(nullptr, size + skip, PROT_READ, MAP_SHARED, fd, static_cast<off_t>(aligned));
+    if (addr == MAP_FAILED) {
+        throw std::runtime_error(std::string("Failed to map the file: ") + std::strerror(errno));
+    }
+
+    std::shared_ptr<const void> owner{addr, [total = size + skip](const void* p) {
+                                          munmap(const_cast<void*>(p), total);
+                                      }};
+    return Attachment{std::move(owner), static_cast<const char*>(addr) + skip, size};
+}
+#endif
+
+const Attachment* Attachment::getPacking() {
+    return packing;
+}
+
+const Attachment* Attachment::setPacking(const Attachment* attachment) {
+    const auto* previous = packing;
+    packing = attachment;
+    return previous;
+}
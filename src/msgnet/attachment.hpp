@@ -0,0 +1,140 @@
+#pragma once
+
+#include "library.hpp"
+#include <cstdint>
+#include <memory>
+#include <msgpack.hpp>
+#include <vector>
+
+namespace MsgNet {
+/**
+ * A binary field of a message that refers to the bytes owned by someone else, instead of holding a copy.
+ * The attachment is packed as a Msgpack binary, so the other side can receive it as a std::vector<char> too.
+ *
+ * When sent to a peer, the bytes are not copied into the compression stream, they are handed to the socket
+ * as they are, if the attachment is not going to be compressed anyway. That is if the codec is
+ * Codec::Type::None, or the bytes look incompressible (see Options::compressMaxEntropy). The owner is held
+ * until the bytes have been written to the socket. Otherwise the bytes are compressed as usual.
+ *
+ * A received attachment is a view into the received message, it is valid only until the handler returns.
+ * Use toVector() to keep a copy.
+ *
+ * @code
+ * struct MessageImage {
+ *     std::string name;
+ *     MsgNet::Attachment pixels;
+ *
+ *     MESSAGE_DEFINE(MessageImage, name, pixels);
+ * };
+ *
+ * peer->send(MessageImage{"photo.jpg", MsgNet::Attachment{std::make_shared<std::vector<char>>(...)}});
+ * @endcode
+ */
+class MSGNET_API Attachment {
+public:
+    Attachment() = default;
+
+    /**
+     * @param buffer The buffer to attach, it is not copied.
+     */
+    explicit Attachment(std::shared_ptr<const std::vector<char>> buffer);
+
+    /**
+     * @param owner The object that keeps the bytes alive, held by the attachment and its copies.
+     * @param data Pointer to the bytes.
+     * @param size Number of bytes.
+     */
+    Attachment(std::shared_ptr<const void> owner, const char* data, size_t size);
+
+#ifndef _WIN32
+    /**
+     * Maps a range of the file into the memory and attaches it. The file is unmapped once the attachment,
+     * and all of its copies, are destroyed and the bytes have been sent.
+     *
+     * @param fd The file descriptor open for reading.
+     * @param offset Offset of the range in the file, does not need to be aligned.
+     * @param size Number of bytes of the range.
+     * @return The attachment of the mapped range.
+     */
+    static Attachment map(int fd, uint64_t offset, size_t size);
+#endif
+
+    /**
+     * Returns the bytes of the attachment.
+     *
+     * @return Pointer to the bytes.
+     */
+    const char* data() const {
+        return ptr;
+    }
+
+    /**
+     * Returns the number of the bytes.
+     *
+     * @return Number of bytes.
+     */
+    size_t size() const {
+        return length;
+    }
+
+    /**
+     * Returns true if there are no bytes.
+     *
+     * @return True if empty.
+     */
+    bool empty() const {
+        return length == 0;
+    }
+
+    /**
+     * Returns the object that keeps the bytes alive, nullptr if the attachment has been received.
+     *
+     * @return The owner of the bytes.
+     */
+    const std::shared_ptr<const void>& getOwner() const {
+        return owner;
+    }
+
+    /**
+     * Returns a copy of the bytes.
+     *
+     * @return The copied bytes.
+     */
+    std::vector<char> toVector() const {
+        return std::vector<char>(ptr, ptr + length);
+    }
+
+    /**
+     * Internal use only. Returns the attachment whose bytes are being packed by this thread.
+     *
+     * @return The attachment or nullptr.
+     */
+    static const Attachment* getPacking();
+
+    template <typename Packer> void msgpack_pack(Packer& packer) const {
+        packer.pack_bin(static_cast<uint32_t>(length));
+
+        // The compression stream of a peer recognizes the bytes and takes them by reference
+        const auto* previous = setPacking(this);
+        packer.pack_bin_body(ptr, static_cast<uint32_t>(length));
+        setPacking(previous);
+    }
+
+    void msgpack_unpack(const msgpack::object& object) {
+        if (object.type != msgpack::type::BIN) {
+            throw msgpack::type_error();
+        }
+
+        owner.reset();
+        ptr = object.via.bin.ptr;
+        length = object.via.bin.size;
+    }
+
+private:
+    static const Attachment* setPacking(const Attachment* attachment);
+
+    std::shared_ptr<const void> owner;
+    const char* ptr{nullptr};
+    size_t length{0};
+};
+} // namespace MsgNet
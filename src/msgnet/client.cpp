@@ -3,8 +3,10 @@
 
 using namespace MsgNet;
 
-Client::Client() :
+Client::Client(const Options& options) :
     Dispatcher{static_cast<ErrorHandler&>(*this)},
+    options{options},
+    timers{service},
     work{std::make_unique<asio::io_service::work>(service)},
     ssl{asio::ssl::context::tlsv13} {
 
@@ -19,8 +21,6 @@ Client::~Client() {
 }
 
 void Client::start(bool async) {
-    socket = std::make_shared<Socket>(service, ssl);
-
     if (async) {
         thread = std::thread([this]() { getIoService().run(); });
     }
@@ -46,19 +46,74 @@ void Client::connect(const std::string& address, unsigned int port, int timeout)
 
     const auto endpoints = endpointsFuture.get();
 
-    auto connect = asio::async_connect(socket->lowest_layer(), endpoints, asio::use_future);
-    if (connect.wait_until(tp) != std::future_status::ready) {
-        throw std::runtime_error("Timeout connecting to the address");
+    const auto connect = [&](auto& socket) {
+        auto future = asio::async_connect(socket, endpoints, asio::use_future);
+        if (future.wait_until(tp) != std::future_status::ready) {
+            throw std::runtime_error("Timeout connecting to the address");
+        }
+        future.get();
+    };
+
+    if (options.tls) {
+        auto tls = std::make_shared<TlsTransport>(service, ssl);
+        transport = tls;
+        connect(tls->getSocket());
+    } else {
+        auto tcp = std::make_shared<TcpTransport>(service);
+        transport = tcp;
+        connect(tcp->getSocket());
     }
-    connect.get();
 
-    auto handshake = socket->async_handshake(asio::ssl::stream_base::client, asio::use_future);
-    if (handshake.wait_until(tp) != std::future_status::ready) {
+    establish(tp);
+}
+
+#ifndef _WIN32
+void Client::connectLocal(const LocalEndpoint& endpoint, int timeout) {
+    const auto tp = std::chrono::system_clock::now() + std::chrono::milliseconds(timeout);
+
+    const auto connect = [&](auto& socket) {
+        auto future = socket.async_connect(endpoint, asio::use_future);
+        if (future.wait_until(tp) != std::future_status::ready) {
+            throw std::runtime_error("Timeout connecting to the address");
+        }
+        future.get();
+    };
+
+#ifdef __linux__
+    if (options.sharedMemory) {
+        auto shm = std::make_shared<ShmTransport>(service, options.sharedMemoryBytes, options.sharedMemorySpin);
+        transport = shm;
+        connect(shm->getSocket());
+        establish(tp);
+        return;
+    }
+#endif
+
+    auto local = std::make_shared<UnixTransport>(service);
+    transport = local;
+    connect(local->getSocket());
+
+    establish(tp);
+}
+#endif
+
+void Client::establish(const std::chrono::system_clock::time_point deadline) {
+    // The handler may complete after the timeout, it must not refer to this stack frame
+    auto promise = std::make_shared<std::promise<void>>();
+    auto handshake = promise->get_future();
+    transport->handshake(false, [promise](const asio::error_code& ec) {
+        if (ec) {
+            promise->set_exception(std::make_exception_ptr(asio::system_error{ec}));
+        } else {
+            promise->set_value();
+        }
+    });
+    if (handshake.wait_until(deadline) != std::future_status::ready) {
         throw std::runtime_error("Timeout TLS handshake");
     }
     handshake.get();
 
-    peer = std::make_shared<Peer>(*this, *this, service, socket);
+    peer = std::make_shared<Peer>(*this, *this, service, timers, transport, options);
     peer->start();
 }
 
@@ -75,6 +130,10 @@ void Client::stop() {
     if (thread.joinable()) {
         thread.join();
     }
+
+    // The error callbacks of the aborted requests may still be waiting in the queue
+    service.restart();
+    service.poll();
 }
 
 bool Client::isConnected() {
@@ -8,13 +8,14 @@
 namespace MsgNet {
 class MSGNET_API Client : public ErrorHandler, public Dispatcher {
 public:
-    using Socket = asio::ssl::stream<asio::ip::tcp::socket>;
-
     /**
      * Constructs a client.
      * To start the client you must call start() method.
+     * The client connects with TLS, unless Options::tls is set to false.
+     *
+     * @param options Tuning options applied to the connection.
      */
-    Client();
+    explicit Client(const Options& options = {});
     ~Client();
 
     /**
@@ -22,10 +23,22 @@ public:
      * @warnin You must call the start() method before trying to connect to the server.
      * @param address The address (an IP address or hostname) of the remote server.
      * @param port Port of the remote server.
-     * @param timeout Connection timeout, this includes timeout for the TLS handshake.
+     * @param timeout Connection timeout, this includes timeout for the TLS handshake, if any.
      */
     void connect(const std::string& address, unsigned int port, int timeout = 5000);
 
+#ifndef _WIN32
+    /**
+     * Connects to the server on a Unix domain socket of the same host, see Server(const LocalEndpoint&).
+     * The connection never uses TLS. With Options::sharedMemory the messages go through the shared memory
+     * rings instead, see ShmTransport.
+     * @warning You must call the start() method before trying to connect to the server.
+     * @param endpoint The path of the socket, or an abstract name starting with a null character.
+     * @param timeout Connection timeout.
+     */
+    void connectLocal(const LocalEndpoint& endpoint, int timeout = 5000);
+#endif
+
     /**
      * Starts the client either in async or sync mode. When set to true (default) the client will start
      * in its own thread and all handlers and request callbacks will be handled by this one thread.
@@ -109,6 +122,95 @@ public:
         }
     }
 
+    /**
+     * Send some message to the server as a request with a deadline. If the response does not arrive
+     * within the timeout, the error callback is executed with Error::RequestTimeout instead of the callback.
+     * See Peer::send for the details.
+     *
+     * @tparam Req The type of the message to send. This is auto deduced from the parameter.
+     * @param message The message to send to the server.
+     * @param fn The callback executed with the response.
+     * @param timeout How long to wait for the response. Use zero to wait forever.
+     * @param error The callback executed with the error code if the request fails.
+     */
+    template <typename Req, typename Fn, typename ErrorFn>
+    void send(const Req& message, Fn fn, const std::chrono::milliseconds timeout, ErrorFn error) {
+        if (peer) {
+            peer->send(message, std::move(fn), timeout, std::move(error));
+        }
+    }
+
+    /**
+     * Send multiple messages to the server as requests in a single write, with a single completion.
+     * See Peer::sendBatch for the details and the accepted callbacks.
+     *
+     * @tparam Req The type of the messages to send. This is auto deduced from the parameter.
+     * @param messages The messages to send to the server.
+     * @param args The callbacks, and optionally the timeout with the error callback.
+     */
+    template <typename Req, typename... Args> void sendBatch(const std::vector<Req>& messages, Args&&... args) {
+        if (peer) {
+            peer->sendBatch(messages, std::forward<Args>(args)...);
+        }
+    }
+
+    /**
+     * Opens a stream of bytes to the server. See Peer::openStream for the details.
+     *
+     * @tparam Header The type of the header message. This is auto deduced from the parameter.
+     * @param header The header of the stream.
+     * @return The writer of the stream.
+     */
+    template <typename Header> std::shared_ptr<StreamWriter> openStream(const Header& header) {
+        if (!peer) {
+            throw std::runtime_error("The client is not connected");
+        }
+        return peer->openStream(header);
+    }
+
+    /**
+     * Sends a stream of bytes pulled from the producer to the server. See Peer::sendStream for the details.
+     *
+     * @tparam Header The type of the header message. This is auto deduced from the parameter.
+     * @tparam Producer The type of the producer. This is auto deduced from the parameter.
+     * @param header The header of the stream.
+     * @param producer The function that accepts (char* buffer, size_t size) and returns size_t.
+     */
+    template <typename Header, typename Producer> void sendStream(const Header& header, Producer producer) {
+        if (peer) {
+            peer->sendStream(header, std::move(producer));
+        }
+    }
+
+    /**
+     * Send some message to the server as a request and await the response in a C++20 coroutine.
+     * See Peer::request for the details.
+     *
+     * @note Requires C++20, include <msgnet/coroutine.hpp> to use this.
+     *
+     * @tparam Res The type of the response message.
+     * @tparam Req The type of the message to send. This is auto deduced from the parameter.
+     * @param message The message to send to the server. It is packed before the coroutine suspends.
+     * @return The awaitable of the response.
+     */
+    template <typename Res, typename Req> RequestAwaitable<Req, Res> request(const Req& message) {
+        if (!peer) {
+            throw std::runtime_error("The client is not connected");
+        }
+        return peer->request<Res>(message);
+    }
+
+    /**
+     * Same as request(message) with the given timeout.
+     */
+    template <typename Res, typename Req>
+    RequestAwaitable<Req, Res> request(const Req& message, const std::chrono::milliseconds timeout) {
+        if (!peer) {
+            throw std::runtime_error("The client is not connected");
+        }
+        return peer->request<Res>(message, timeout);
+    }
+
 protected:
     /**
      * This function is executed every time there is some work to be done.
@@ -122,10 +224,14 @@ protected:
     void postDispatch(std::function<void()> fn) override;
 
 private:
+    void establish(std::chrono::system_clock::time_point deadline);
+
+    Options options;
     asio::io_service service;
+    TimerWheel timers;
     std::unique_ptr<asio::io_service::work> work;
     asio::ssl::context ssl;
-    std::shared_ptr<Socket> socket;
+    std::shared_ptr<Transport> transport;
     std::shared_ptr<Peer> peer;
     std::thread thread;
 };
@@ -0,0 +1,62 @@
+#pragma once
+
+#include "library.hpp"
+#include <cstddef>
+#include <cstdint>
+
+namespace MsgNet {
+/**
+ * Compression codec of the outgoing stream. Each side announces its codec at the start
+ * of the stream, so the receiving side does not need to be configured the same way.
+ */
+struct MSGNET_API Codec {
+    /**
+     * Blocks smaller than this are sent uncompressed by default, see Options::compressMinBytes.
+     */
+    static constexpr size_t defaultMinBytes = 64;
+
+    /**
+     * Blocks with the higher estimated entropy are sent uncompressed by default,
+     * see Options::compressMaxEntropy.
+     */
+    static constexpr float defaultMaxEntropy = 7.2f;
+
+    enum class Type : uint8_t {
+        /**
+         * No compression, all blocks are sent as they are.
+         */
+        None = 0,
+
+        /**
+         * LZ4 fast compression.
+         */
+        Lz4 = 1,
+
+        /**
+         * LZ4 high compression, slower but with a better ratio.
+         * The decompression is as fast as with Lz4.
+         */
+        Lz4Hc = 2,
+    };
+
+    /**
+     * The codec type.
+     */
+    Type type{Type::Lz4};
+
+    /**
+     * Acceleration of the Lz4 codec, from 1 to 65535. Higher is faster with a worse ratio, 1 is the default.
+     */
+    int acceleration{1};
+
+    /**
+     * Compression level of the Lz4Hc codec, from 3 to 12.
+     */
+    int level{9};
+
+    /**
+     * Maximum number of bytes per each block, between 1KB and 4MB.
+     */
+    size_t blockBytes{1024 * 8};
+};
+} // namespace MsgNet
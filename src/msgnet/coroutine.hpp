@@ -0,0 +1,260 @@
+#pragma once
+
+#include "dispatcher.hpp"
+#include "peer.hpp"
+
+#if !defined(__cpp_impl_coroutine) || !__has_include(<coroutine>)
+#error "The msgnet coroutine support requires C++20"
+#endif
+
+#include <atomic>
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <system_error>
+#include <utility>
+
+namespace MsgNet {
+template <typename T> class Task;
+
+namespace Detail {
+template <typename T> struct TaskPromiseValue {
+    template <typename V> void return_value(V&& v) {
+        value.emplace(std::forward<V>(v));
+    }
+
+    T getValue() {
+        return std::move(*value);
+    }
+
+    std::optional<T> value;
+};
+
+template <> struct TaskPromiseValue<void> {
+    void return_void() {
+    }
+
+    void getValue() {
+    }
+};
+
+// The request is packed before it can be answered, a message packed already is shared as it is
+template <typename T> struct PackedRequest {
+    using Type = PackedMessage<T>;
+};
+
+template <typename T> struct PackedRequest<PackedMessage<T>> {
+    using Type = PackedMessage<T>;
+};
+} // namespace Detail
+
+/**
+ * The coroutine type of msgnet. The coroutine starts immediately when called, and can be
+ * co_awaited by another coroutine. If the Task is destroyed before the coroutine completes,
+ * the coroutine keeps running and cleans up after itself (detached), its result is discarded,
+ * and so is its exception. The coroutine handlers are awaited by msgnet, their exceptions are passed
+ * to ErrorHandler::onUnhandledException. Use this as the return type of coroutine handlers, see Dispatcher::addHandler.
+ *
+ * @tparam T The type of the co_return value.
+ */
+template <typename T = void> class Task {
+public:
+    struct promise_type : Detail::TaskPromiseValue<T> {
+        Task get_return_object() {
+            return Task{std::coroutine_handle<promise_type>::from_promise(*this)};
+        }
+
+        std::suspend_never initial_suspend() noexcept {
+            return {};
+        }
+
+        auto final_suspend() noexcept {
+            struct Final {
+                bool await_ready() noexcept {
+                    return false;
+                }
+
+                std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> handle) noexcept {
+                    const auto previous = handle.promise().waiter.exchange(done);
+                    if (previous == detached) {
+                        handle.destroy();
+                    } else if (previous != empty) {
+                        return std::coroutine_handle<>::from_address(reinterpret_cast<void*>(previous));
+                    }
+                    return std::noop_coroutine();
+                }
+
+                void await_resume() noexcept {
+                }
+            };
+            return Final{};
+        }
+
+        void unhandled_exception() {
+            exception = std::current_exception();
+        }
+
+        // Empty, done, detached, or the address of the awaiting coroutine
+        std::atomic<uintptr_t> waiter{empty};
+        std::exception_ptr exception;
+    };
+
+    Task(Task&& other) noexcept : handle{std::exchange(other.handle, nullptr)} {
+    }
+
+    Task& operator=(Task&& other) noexcept {
+        if (this != &other) {
+            release();
+            handle = std::exchange(other.handle, nullptr);
+        }
+        return *this;
+    }
+
+    Task(const Task& other) = delete;
+    Task& operator=(const Task& other) = delete;
+
+    ~Task() {
+        release();
+    }
+
+    bool await_ready() const noexcept {
+        return handle.promise().waiter.load() == done;
+    }
+
+    bool await_suspend(std::coroutine_handle<> awaiting) noexcept {
+        auto expected = empty;
+        return handle.promise().waiter.compare_exchange_strong(expected,
+                                                               reinterpret_cast<uintptr_t>(awaiting.address()));
+    }
+
+    T await_resume() {
+        if (handle.promise().exception) {
+            std::rethrow_exception(handle.promise().exception);
+        }
+        return handle.promise().getValue();
+    }
+
+private:
+    static constexpr uintptr_t empty = 0;
+    static constexpr uintptr_t done = 1;
+    static constexpr uintptr_t detached = 2;
+
+    explicit Task(std::coroutine_handle<promise_type> handle) : handle{handle} {
+    }
+
+    void release() {
+        if (!handle) {
+            return;
+        }
+
+        // Still running, the coroutine destroys itself once completed
+        auto expected = empty;
+        if (!handle.promise().waiter.compare_exchange_strong(expected, detached)) {
+            handle.destroy();
+        }
+        handle = nullptr;
+    }
+
+    std::coroutine_handle<promise_type> handle;
+};
+
+/**
+ * The awaitable returned by Peer::request. The response callback resumes the coroutine directly.
+ *
+ * @tparam Req The type of the request message.
+ * @tparam Res The type of the response message.
+ */
+template <typename Req, typename Res> class RequestAwaitable {
+public:
+    RequestAwaitable(std::shared_ptr<Peer> peer, const Req& message, const std::chrono::milliseconds timeout) :
+        peer{std::move(peer)}, message{&message}, timeout{timeout} {
+    }
+
+    bool await_ready() const noexcept {
+        return false;
+    }
+
+    bool await_suspend(std::coroutine_handle<> handle) {
+        // The coroutine may be resumed by another thread before the send returns, and with it this
+        // awaitable and the message destroyed. Nothing borrowed is touched once the request is added.
+        auto self = peer;
+
+        if (!self->runFlag.load()) {
+            error = make_error_code(Error::RequestAborted);
+            return false;
+        }
+
+        const typename Detail::PackedRequest<Req>::Type packed{*message};
+
+        const auto reqId = self->addRequest(
+            [this, handle](const msgpack::object& object) {
+                try {
+                    object.convert(result.emplace());
+                } catch (...) {
+                    exception = std::current_exception();
+                }
+                handle.resume();
+            },
+            timeout,
+            [this, handle](const std::error_code ec) {
+                error = ec;
+                handle.resume();
+            });
+
+        self->send(packed, reqId, false);
+        return true;
+    }
+
+    Res await_resume() {
+        if (exception) {
+            std::rethrow_exception(exception);
+        }
+        if (error) {
+            throw std::system_error(error);
+        }
+        return std::move(*result);
+    }
+
+private:
+    std::shared_ptr<Peer> peer;
+    const Req* message;
+    std::chrono::milliseconds timeout;
+    std::optional<Res> result;
+    std::error_code error;
+    std::exception_ptr exception;
+};
+
+// Handlers that are coroutines, the response is sent once the coroutine completes
+template <typename Res, typename Req> struct Dispatcher::HandlerFactory<Task<Res>, Req> {
+    template <typename Fn> static void create(HandlerMap& handlers, Fn fn) {
+        // Sanity check
+        const auto check = handlers.find(Req::hash);
+        if (check != handlers.end()) {
+            throw std::runtime_error("The type of this message has already been registered");
+        }
+
+        handlers[Req::hash] = [fn = std::move(fn)](const PeerPtr& peer, const uint64_t reqId,
+                                                   const msgpack::object& object) {
+            Req req{};
+            object.convert(req);
+
+            respond(fn(peer, std::move(req)), peer, reqId);
+        };
+    }
+
+    static Task<void> respond(Task<Res> task, PeerPtr peer, const uint64_t reqId) {
+        // Nobody awaits this one, the exception goes to the error handler as of the regular handlers
+        try {
+            if constexpr (std::is_void_v<Res>) {
+                (void)reqId;
+                co_await std::move(task);
+            } else {
+                const Res res = co_await std::move(task);
+                peer->send<Res>(res, reqId, true);
+            }
+        } catch (...) {
+            peer->unhandledException(std::current_exception());
+        }
+    }
+};
+} // namespace MsgNet
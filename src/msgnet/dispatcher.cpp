@@ -1,5 +1,6 @@
 #include "dispatcher.hpp"
 #include "peer.hpp"
+#include <algorithm>
 #include <iostream>
 
 using namespace MsgNet;
@@ -8,10 +9,170 @@ Dispatcher::Dispatcher(ErrorHandler& errorHandler) : errorHandler{errorHandler}
 }
 
 void Dispatcher::dispatch(const PeerPtr& peer, const uint64_t id, const uint64_t reqId, const msgpack::object& object) {
-    const auto it = handlers.find(id);
-    if (it != handlers.end()) {
-        it->second(peer, reqId, object);
+    const auto* handler = find(id);
+    if (handler) {
+        (*handler)(peer, reqId, object);
     } else {
         errorHandler.onError(peer, ::make_error_code(Error::UnexpectedRequest));
     }
 }
+
+void Dispatcher::receiveChunk(const PeerPtr& peer, const msgpack::object& object) {
+    StreamChunk chunk{};
+    object.convert(chunk);
+
+    if (chunk.type == 0) {
+        peer->receiveChunk(chunk);
+        return;
+    }
+
+    // The first chunk carries the header of the stream
+    const auto it = streams.find(chunk.type);
+    if (it == streams.end()) {
+        errorHandler.onError(peer, ::make_error_code(Error::UnexpectedRequest));
+        return;
+    }
+
+    const auto header = msgpack::unpack(chunk.data, chunk.size);
+    auto handler = it->second(peer, header.get());
+    if (handler) {
+        peer->openIncoming(chunk.stream, std::move(handler));
+    }
+}
+
+void Dispatcher::schedule(const uint64_t key, std::function<void()> fn) {
+    if (executor) {
+        executor->post(key, std::move(fn));
+    } else {
+        postDispatch(std::move(fn));
+    }
+}
+
+uint64_t Dispatcher::getDispatchKey(const PeerPtr& peer, const msgpack::object& object) const {
+    if (keys.empty() || object.type != msgpack::type::ARRAY || object.via.array.size != 2) {
+        return getDispatchKey(peer);
+    }
+
+    try {
+        PacketInfo info;
+        object.via.array.ptr[0].convert(info);
+
+        // The responses are always ordered per peer
+        const auto it = info.isResponse ? keys.end() : keys.find(info.id);
+        if (it != keys.end()) {
+            return it->second(object.via.array.ptr[1]);
+        }
+    } catch (...) {
+        // The handler reports the error
+    }
+
+    return getDispatchKey(peer);
+}
+
+bool Dispatcher::isInline(const msgpack::object& object) const {
+    if (inlined.empty() || object.type != msgpack::type::ARRAY || object.via.array.size != 2) {
+        return false;
+    }
+
+    try {
+        PacketInfo info;
+        object.via.array.ptr[0].convert(info);
+        return !info.isResponse && inlined.count(info.id) > 0;
+    } catch (...) {
+        return false;
+    }
+}
+
+bool Dispatcher::isStreamChunk(const msgpack::object& object) const {
+    if (streams.empty() || object.type != msgpack::type::ARRAY || object.via.array.size != 2) {
+        return false;
+    }
+
+    try {
+        PacketInfo info;
+        object.via.array.ptr[0].convert(info);
+        return !info.isResponse && info.id == StreamChunk::hash;
+    } catch (...) {
+        return false;
+    }
+}
+
+const Dispatcher::Handler* Dispatcher::find(const uint64_t id) const {
+    if (!sealed.active) {
+        const auto it = handlers.find(id);
+        return it != handlers.end() ? &it->second : nullptr;
+    }
+
+    if (sealed.perfect) {
+        const auto& entry = sealed.table[(id * sealed.multiplier) >> sealed.shift];
+        return entry.id == id ? entry.handler : nullptr;
+    }
+
+    const auto it = std::lower_bound(sealed.table.begin(), sealed.table.end(), id,
+                                     [](const Entry& entry, const uint64_t value) { return entry.id < value; });
+    return it != sealed.table.end() && it->id == id ? it->handler : nullptr;
+}
+
+void Dispatcher::checkNotSealed() const {
+    if (sealed.active) {
+        throw std::runtime_error("The handlers have been sealed");
+    }
+}
+
+void Dispatcher::seal() {
+    if (sealed.active) {
+        return;
+    }
+
+    std::vector<Entry> entries;
+    entries.reserve(handlers.size());
+    for (const auto& pair : handlers) {
+        entries.push_back({pair.first, &pair.second});
+    }
+
+    sealed.active = true;
+
+    // Multiply-shift hashing with the smallest table where some multiplier maps all IDs
+    // to distinct slots. The table is at most 16 times the next power of two of the handler count.
+    unsigned int bits = 1;
+    while ((size_t{1} << bits) < entries.size()) {
+        bits++;
+    }
+
+    uint64_t seed = 0x9e3779b97f4a7c15ULL;
+    for (const auto maxBits = bits + 4; bits <= maxBits; bits++) {
+        std::vector<Entry> table;
+
+        for (auto attempt = 0; attempt < 4096; attempt++) {
+            // Odd multipliers from the SplitMix64 sequence
+            seed += 0x9e3779b97f4a7c15ULL;
+            auto multiplier = seed;
+            multiplier = (multiplier ^ (multiplier >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            multiplier = (multiplier ^ (multiplier >> 27)) * 0x94d049bb133111ebULL;
+            multiplier = (multiplier ^ (multiplier >> 31)) | 1ULL;
+
+            table.assign(size_t{1} << bits, Entry{});
+
+            auto collision = false;
+            for (const auto& entry : entries) {
+                auto& slot = table[(entry.id * multiplier) >> (64 - bits)];
+                if (slot.handler) {
+                    collision = true;
+                    break;
+                }
+                slot = entry;
+            }
+
+            if (!collision) {
+                sealed.perfect = true;
+                sealed.multiplier = multiplier;
+                sealed.shift = 64 - bits;
+                sealed.table = std::move(table);
+                return;
+            }
+        }
+    }
+
+    std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) { return a.id < b.id; });
+    sealed.table = std::move(entries);
+}
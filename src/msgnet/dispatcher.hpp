@@ -1,8 +1,10 @@
 #pragma once
 
+#include "executor.hpp"
 #include "message.hpp"
 #include "peer.hpp"
 #include <functional>
+#include <unordered_set>
 
 namespace MsgNet {
 class MSGNET_API Peer;
@@ -20,6 +22,8 @@ public:
 
     using Handler = std::function<void(const PeerPtr&, uint64_t, const msgpack::object&)>;
     using HandlerMap = std::unordered_map<uint64_t, Handler>;
+    using KeyFunction = std::function<uint64_t(const msgpack::object&)>;
+    using StreamFactory = std::function<Peer::ChunkHandler(const PeerPtr&, const msgpack::object&)>;
 
     explicit Dispatcher(ErrorHandler& errorHandler);
     virtual ~Dispatcher() = default;
@@ -38,7 +42,92 @@ public:
     template <typename Fn> void addHandler(Fn fn) {
         using Req = typename Traits<decltype(&Fn::operator())>::Arg;
         using Res = typename Traits<decltype(&Fn::operator())>::Ret;
-        HandlerFactory<Res, Req>::create(handlers, std::forward<Fn>(fn));
+        checkNotSealed();
+        HandlerFactory<Res, Req>::create(handlers, std::move(fn));
+    }
+
+    /**
+     * Same as addHandler(fn), with a function that returns the ordering key of the message for the executor
+     * (see setExecutor). The messages with the same key are handled in order, regardless of the peer
+     * they came from, and the messages with different keys are handled in parallel.
+     * Without the key function, the messages are ordered per peer.
+     *
+     * @note The message is unpacked once more for the key function, by the I/O thread.
+     *
+     * @code
+     * addHandler([](const PeerPtr& peer, MessageOrder msg) {}, [](const MessageOrder& msg) { return msg.account; });
+     * @endcode
+     *
+     * @tparam Fn The raw lambda function type. This will be auto deduced. No need to explicitly provide it.
+     * @tparam KeyFn The type of the key function. This will be auto deduced.
+     * @param fn The lambda function as the handler.
+     * @param key The function that accepts the message and returns uint64_t key.
+     */
+    template <typename Fn, typename KeyFn> void addHandler(Fn fn, KeyFn key) {
+        using Req = std::decay_t<typename Traits<decltype(&Fn::operator())>::Arg>;
+        addHandler(std::move(fn));
+        keys[Req::hash] = [key = std::move(key)](const msgpack::object& object) -> uint64_t {
+            Req req{};
+            object.convert(req);
+            return key(req);
+        };
+    }
+
+    /**
+     * Same as addHandler(fn), but the handler is executed directly by the I/O thread as soon as the message
+     * is received, without the postDispatch or the executor. Use this for short handlers that never block,
+     * a slow handler stalls the I/O of the peer. The messages keep their order: while the earlier messages
+     * of the peer still wait for their handlers, the message is queued behind them like any other.
+     * See also Options::inlineDispatch.
+     *
+     * @tparam Fn The raw lambda function type. This will be auto deduced. No need to explicitly provide it.
+     * @param fn The lambda function as the handler.
+     */
+    template <typename Fn> void addInlineHandler(Fn fn) {
+        using Req = std::decay_t<typename Traits<decltype(&Fn::operator())>::Arg>;
+        addHandler(std::move(fn));
+        inlined.insert(Req::hash);
+    }
+
+    /**
+     * Registers a new handler of the streams with some header type, see Peer::openStream.
+     * The handler function accepts `const std::shared_ptr<MsgNet::Peer>&` and the header, and returns the
+     * function that receives the data of the stream as `(const char* data, size_t size, bool last)`.
+     * The data is passed in chunks as they arrive, the last call has the last set to true.
+     * The chunks go through the postDispatch or the executor like any other message, in order per peer.
+     * Return an empty function to ignore the stream. An unfinished stream is dropped once the peer closes.
+     * If the function throws, the exception goes to ErrorHandler::onUnhandledException and the stream ends,
+     * the function is called once more without any data and with the last set, unless it was the last chunk.
+     *
+     * @code
+     * addStreamHandler([](const PeerPtr& peer, MessageUpload header) -> Peer::ChunkHandler {
+     *     auto file = std::make_shared<std::ofstream>(header.name, std::ios::binary);
+     *     return [file](const char* data, size_t size, bool last) { file->write(data, size); };
+     * });
+     * @endcode
+     *
+     * @tparam Fn The raw lambda function type. This will be auto deduced. No need to explicitly provide it.
+     * @param fn The lambda function as the handler.
+     */
+    template <typename Fn> void addStreamHandler(Fn fn) {
+        using Header = std::decay_t<typename Traits<decltype(&Fn::operator())>::Arg>;
+        checkNotSealed();
+
+        if (streams.find(Header::hash) != streams.end()) {
+            throw std::runtime_error("The type of this stream has already been registered");
+        }
+
+        streams[Header::hash] = [fn = std::move(fn)](const PeerPtr& peer,
+                                                     const msgpack::object& object) -> Peer::ChunkHandler {
+            Header header{};
+            object.convert(header);
+            return fn(peer, std::move(header));
+        };
+
+        if (handlers.find(StreamChunk::hash) == handlers.end()) {
+            handlers[StreamChunk::hash] = [this](const PeerPtr& peer, const uint64_t /*reqId*/,
+                                                 const msgpack::object& object) { receiveChunk(peer, object); };
+        }
     }
 
     /**
@@ -56,8 +145,27 @@ public:
      * @param fn Pointer to the function.
      */
     template <typename C, typename R, typename T> void addHandler(C* instance, R (C::*fn)(const PeerPtr&, T)) {
-        HandlerFactory<R, T>::create(handlers,
-                                     [instance, fn](const PeerPtr& peer, T m) { (instance->*fn)(peer, std::move(m)); });
+        checkNotSealed();
+        HandlerFactory<R, T>::create(
+            handlers, [instance, fn](const PeerPtr& peer, T m) -> R { return (instance->*fn)(peer, std::move(m)); });
+    }
+
+    /**
+     * Freezes the registered handlers into a flat lookup table. The table uses a perfect hash
+     * of the message IDs, so each dispatch is a single table lookup. If no perfect hash of a reasonable
+     * size is found, a sorted table with a binary search is used instead.
+     * Call this after all handlers have been added and before the server or the client is started.
+     * No handlers can be added once sealed. Calling this multiple times is allowed.
+     */
+    void seal();
+
+    /**
+     * Returns true if the handlers have been sealed.
+     *
+     * @return True if sealed.
+     */
+    bool isSealed() const {
+        return sealed.active;
     }
 
     /**
@@ -84,9 +192,84 @@ public:
      */
     virtual void postDispatch(std::function<void()> fn) = 0;
 
+    /**
+     * Executes the handlers and the request callbacks on the executor instead of the postDispatch.
+     * The work is ordered per peer, or by the key function of the handler, see addHandler(fn, key).
+     * Pass nullptr to use the postDispatch again.
+     *
+     * @warning The executor must be stopped before this server or client is destroyed.
+     *
+     * @param executor The executor to use, can be shared by multiple servers and clients.
+     */
+    void setExecutor(std::shared_ptr<Executor> executor) {
+        this->executor = std::move(executor);
+    }
+
+    /**
+     * Returns the executor set by setExecutor().
+     *
+     * @return The executor or nullptr.
+     */
+    const std::shared_ptr<Executor>& getExecutor() const {
+        return executor;
+    }
+
+    /**
+     * Schedules some work with the ordering key. The default implementation posts the work to the executor,
+     * or to the postDispatch if there is no executor.
+     *
+     * @warning Do not call this method. This is an internal method only to be used by the Peer class internally.
+     *
+     * @param key The ordering key of the work.
+     * @param fn The function that wraps the work.
+     */
+    virtual void schedule(uint64_t key, std::function<void()> fn);
+
+    /**
+     * Returns the ordering key of the received object, the key function of its handler, or the peer.
+     *
+     * @warning Do not call this method. This is an internal method only to be used by the Peer class internally.
+     *
+     * @param peer Shared pointer to the peer.
+     * @param object The received object, the packet info together with the message.
+     * @return The ordering key.
+     */
+    uint64_t getDispatchKey(const PeerPtr& peer, const msgpack::object& object) const;
+
+    /**
+     * Returns true if the handler of the received object was added by addInlineHandler.
+     *
+     * @warning Do not call this method. This is an internal method only to be used by the Peer class internally.
+     *
+     * @param object The received object, the packet info together with the message.
+     * @return True if the object should be handled by the I/O thread.
+     */
+    bool isInline(const msgpack::object& object) const;
+
+    /**
+     * Returns true if the received object is a chunk of a stream, see addStreamHandler.
+     *
+     * @warning Do not call this method. This is an internal method only to be used by the Peer class internally.
+     *
+     * @param object The received object, the packet info together with the message.
+     * @return True if the object is a StreamChunk.
+     */
+    bool isStreamChunk(const msgpack::object& object) const;
+
+    /**
+     * Returns the ordering key of the peer.
+     *
+     * @param peer Shared pointer to the peer.
+     * @return The ordering key.
+     */
+    static uint64_t getDispatchKey(const PeerPtr& peer) {
+        return static_cast<uint64_t>(reinterpret_cast<uintptr_t>(peer.get()));
+    }
+
 private:
+    // The handler is stored as it is, not wrapped into another std::function.
     template <typename Res, typename Req> struct HandlerFactory {
-        static void create(HandlerMap& handlers, std::function<Res(const PeerPtr&, Req)> fn) {
+        template <typename Fn> static void create(HandlerMap& handlers, Fn fn) {
             // Sanity check
             const auto check = handlers.find(Req::hash);
             if (check != handlers.end()) {
@@ -105,7 +288,7 @@ private:
     };
 
     template <typename Req> struct HandlerFactory<void, Req> {
-        static void create(HandlerMap& handlers, std::function<void(const PeerPtr&, Req)> fn) {
+        template <typename Fn> static void create(HandlerMap& handlers, Fn fn) {
             // Sanity check
             const auto check = handlers.find(Req::hash);
             if (check != handlers.end()) {
@@ -124,7 +307,29 @@ private:
         }
     };
 
+    void checkNotSealed() const;
+    const Handler* find(uint64_t id) const;
+    void receiveChunk(const PeerPtr& peer, const msgpack::object& object);
+
     ErrorHandler& errorHandler;
     HandlerMap handlers;
+    std::unordered_map<uint64_t, KeyFunction> keys;
+    std::unordered_set<uint64_t> inlined;
+    std::unordered_map<uint64_t, StreamFactory> streams;
+    std::shared_ptr<Executor> executor;
+
+    struct Entry {
+        uint64_t id{0};
+        const Handler* handler{nullptr};
+    };
+
+    // The table is indexed by (id * multiplier) >> shift if perfect, otherwise sorted by the id.
+    struct {
+        bool active{false};
+        bool perfect{false};
+        uint64_t multiplier{0};
+        unsigned int shift{0};
+        std::vector<Entry> table;
+    } sealed;
 };
 } // namespace MsgNet
@@ -28,6 +28,15 @@ std::string ErrorCategory::message(int ev) const {
     case Error::DecompressError: {
         return "Unable to decompress data";
     }
+    case Error::RequestTimeout: {
+        return "No response received for a request in time";
+    }
+    case Error::RequestAborted: {
+        return "Request aborted because the peer was closed";
+    }
+    case Error::SendQueueFull: {
+        return "The send queue of the peer is full";
+    }
     }
 }
 
@@ -59,7 +68,7 @@ void ErrorHandler::onUnhandledException(const std::shared_ptr<Peer>& peer, std::
         try {
             std::rethrow_exception(eptr);
         } catch (std::exception& e) {
-            std::cout << "Exception: " << e.what() << " from: " << peer->getAddress() << std::endl;
+            std::cout << "Exception: " << e.what() << " from: " << (peer ? peer->getAddress() : "-") << std::endl;
         }
     }
 }
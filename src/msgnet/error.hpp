@@ -15,6 +15,9 @@ enum Error {
     UnexpectedRequest,
     UnpackError,
     DecompressError,
+    RequestTimeout,
+    RequestAborted,
+    SendQueueFull,
 };
 
 class MSGNET_API ErrorCategory : public std::error_category {
@@ -0,0 +1,180 @@
+#include "executor.hpp"
+#include <algorithm>
+#include <iterator>
+
+using namespace MsgNet;
+
+// The executor and the index of the worker running on this thread, if any
+static thread_local const void* currentExecutor = nullptr;
+static thread_local size_t currentWorker = 0;
+
+static uint64_t mix(uint64_t key) {
+    // SplitMix64 finalizer, so that the sequential keys and the pointers spread across the lanes
+    key = (key ^ (key >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    key = (key ^ (key >> 27)) * 0x94d049bb133111ebULL;
+    return key ^ (key >> 31);
+}
+
+Executor::Executor(size_t threads, size_t lanes) {
+    threads = std::max<size_t>(threads, 1);
+
+    size_t count = 1;
+    while (count < lanes) {
+        count <<= 1;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        this->lanes.push_back(std::make_unique<Lane>());
+    }
+
+    for (size_t i = 0; i < threads; i++) {
+        workers.push_back(std::make_unique<Worker>());
+    }
+
+    for (size_t i = 0; i < threads; i++) {
+        workers[i]->thread = std::thread([this, i]() { run(i); });
+    }
+}
+
+Executor::~Executor() {
+    stop();
+}
+
+void Executor::post(const uint64_t key, Task task) {
+    auto& lane = *lanes[mix(key) & (lanes.size() - 1)];
+
+    {
+        // Nothing runs the tasks once stopped, stop() has dropped the rest of them under the same lock
+        std::lock_guard<std::mutex> lock{lane.mutex};
+        if (idle.stop.load()) {
+            return;
+        }
+        lane.tasks.push_back(std::move(task));
+
+        // The worker executing the lane will pick up this task
+        if (lane.scheduled) {
+            return;
+        }
+        lane.scheduled = true;
+    }
+
+    schedule(lane);
+}
+
+void Executor::schedule(Lane& lane) {
+    // Keep the work on the posting worker, the others steal it if they are idle
+    const auto index = currentExecutor == this ? currentWorker : nextWorker.fetch_add(1) % workers.size();
+    auto& worker = *workers[index];
+
+    {
+        std::lock_guard<std::mutex> lock{worker.mutex};
+        worker.lanes.push_back(&lane);
+    }
+
+    idle.queued.fetch_add(1);
+    if (idle.sleeping.load() > 0) {
+        std::lock_guard<std::mutex> lock{idle.mutex};
+        idle.cv.notify_one();
+    }
+}
+
+Executor::Lane* Executor::take(const size_t index) {
+    // Own lanes first, oldest first
+    {
+        auto& worker = *workers[index];
+        std::lock_guard<std::mutex> lock{worker.mutex};
+        if (!worker.lanes.empty()) {
+            auto* lane = worker.lanes.front();
+            worker.lanes.pop_front();
+            return lane;
+        }
+    }
+
+    // Steal the newest lane of some other worker
+    for (size_t i = 1; i < workers.size(); i++) {
+        auto& victim = *workers[(index + i) % workers.size()];
+        std::lock_guard<std::mutex> lock{victim.mutex};
+        if (!victim.lanes.empty()) {
+            auto* lane = victim.lanes.back();
+            victim.lanes.pop_back();
+            return lane;
+        }
+    }
+
+    return nullptr;
+}
+
+void Executor::run(const size_t index) {
+    currentExecutor = this;
+    currentWorker = index;
+
+    while (!idle.stop.load()) {
+        auto* lane = take(index);
+        if (lane) {
+            idle.queued.fetch_sub(1);
+            execute(*lane);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock{idle.mutex};
+        idle.sleeping.fetch_add(1);
+        idle.cv.wait(lock, [this]() { return idle.stop.load() || idle.queued.load() > 0; });
+        idle.sleeping.fetch_sub(1);
+    }
+}
+
+void Executor::execute(Lane& lane) {
+    std::vector<Task> tasks;
+
+    {
+        std::lock_guard<std::mutex> lock{lane.mutex};
+        std::swap(tasks, lane.tasks);
+    }
+
+    for (auto& task : tasks) {
+        try {
+            task();
+        } catch (...) {
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock{lane.mutex};
+        if (lane.tasks.empty()) {
+            lane.scheduled = false;
+            return;
+        }
+    }
+
+    // More tasks were posted meanwhile, give the other lanes a chance first
+    schedule(lane);
+}
+
+void Executor::stop() {
+    {
+        std::lock_guard<std::mutex> lock{idle.mutex};
+        idle.stop.store(true);
+        idle.cv.notify_all();
+    }
+
+    for (auto& worker : workers) {
+        if (worker->thread.joinable()) {
+            worker->thread.join();
+        }
+    }
+
+    // The tasks are destroyed outside of the locks, their captures may post again
+    std::vector<Task> dropped;
+    for (auto& lane : lanes) {
+        std::lock_guard<std::mutex> lock{lane->mutex};
+        std::move(lane->tasks.begin(), lane->tasks.end(), std::back_inserter(dropped));
+        lane->tasks.clear();
+        lane->scheduled = false;
+    }
+
+    for (auto& worker : workers) {
+        std::lock_guard<std::mutex> lock{worker->mutex};
+        worker->lanes.clear();
+    }
+    idle.queued.store(0);
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include "library.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace MsgNet {
+/**
+ * A pool of worker threads that executes the tasks in order per key. The tasks with the same key
+ * are executed one after another, in the order they were posted, the tasks with different keys
+ * run in parallel. Each key is mapped to a lane, a lane is a queue of tasks that is executed by one
+ * worker at the time. The lanes that have some work are queued at the workers, and an idle worker
+ * steals the lanes queued at the other workers.
+ * The keys that map to the same lane are ordered together, which only limits the parallelism.
+ *
+ * An executor can be plugged into the server or the client via Dispatcher::setExecutor().
+ */
+class MSGNET_API Executor {
+public:
+    using Task = std::function<void()>;
+
+    /**
+     * Starts the worker threads.
+     *
+     * @param threads Number of the worker threads, at least one.
+     * @param lanes Number of the lanes, rounded up to the power of two.
+     */
+    explicit Executor(size_t threads = std::thread::hardware_concurrency(), size_t lanes = 1024);
+    ~Executor();
+
+    Executor(const Executor& other) = delete;
+    Executor& operator=(const Executor& other) = delete;
+
+    /**
+     * Queues the task to be executed after all of the tasks with the same key that were posted before it.
+     * The exceptions thrown by the tasks are ignored.
+     *
+     * @param key The ordering key, for example the address of the peer.
+     * @param task The task to execute.
+     */
+    void post(uint64_t key, Task task);
+
+    /**
+     * Stops the workers and waits for them to finish the task they are executing.
+     * The tasks that have not started yet are dropped, and so are the tasks posted after this.
+     * This is also called from the destructor.
+     * Calling this multiple times is allowed.
+     */
+    void stop();
+
+    /**
+     * Returns the number of the worker threads.
+     *
+     * @return The number of threads.
+     */
+    size_t getThreadCount() const {
+        return workers.size();
+    }
+
+private:
+    struct alignas(64) Lane {
+        std::mutex mutex;
+        std::vector<Task> tasks;
+        bool scheduled{false};
+    };
+
+    struct alignas(64) Worker {
+        std::mutex mutex;
+        std::deque<Lane*> lanes;
+        std::thread thread;
+    };
+
+    void run(size_t index);
+    void schedule(Lane& lane);
+    void execute(Lane& lane);
+    Lane* take(size_t index);
+
+    std::vector<std::unique_ptr<Lane>> lanes;
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::atomic_size_t nextWorker{0};
+
+    struct {
+        std::mutex mutex;
+        std::condition_variable cv;
+        std::atomic_size_t queued{0};
+        std::atomic_size_t sleeping{0};
+        std::atomic_bool stop{false};
+    } idle;
+};
+} // namespace MsgNet
@@ -0,0 +1,126 @@
+#pragma once
+
+#include "library.hpp"
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace MsgNet {
+template <typename Signature, size_t Capacity = 48> class InlineFunction;
+
+/**
+ * A move only function wrapper with inline storage. Functors that fit into the Capacity
+ * are stored without any allocation, larger ones are moved to the heap.
+ *
+ * @tparam R The return type.
+ * @tparam Args The argument types.
+ * @tparam Capacity The size of the inline storage in bytes.
+ */
+template <typename R, typename... Args, size_t Capacity> class InlineFunction<R(Args...), Capacity> {
+public:
+    InlineFunction() = default;
+
+    template <typename Fn, typename = std::enable_if_t<!std::is_same_v<std::decay_t<Fn>, InlineFunction>>>
+    InlineFunction(Fn&& fn) {
+        using T = std::decay_t<Fn>;
+        if constexpr (isInline<T>()) {
+            new (&storage) T(std::forward<Fn>(fn));
+            ops = &InlineOps<T>::ops;
+        } else {
+            *reinterpret_cast<T**>(&storage) = new T(std::forward<Fn>(fn));
+            ops = &HeapOps<T>::ops;
+        }
+    }
+
+    InlineFunction(InlineFunction&& other) noexcept {
+        moveFrom(other);
+    }
+
+    InlineFunction& operator=(InlineFunction&& other) noexcept {
+        if (this != &other) {
+            reset();
+            moveFrom(other);
+        }
+        return *this;
+    }
+
+    InlineFunction(const InlineFunction& other) = delete;
+    InlineFunction& operator=(const InlineFunction& other) = delete;
+
+    ~InlineFunction() {
+        reset();
+    }
+
+    /**
+     * Destroys the stored functor, if any.
+     */
+    void reset() {
+        if (ops) {
+            ops->destroy(&storage);
+            ops = nullptr;
+        }
+    }
+
+    explicit operator bool() const {
+        return ops != nullptr;
+    }
+
+    R operator()(Args... args) {
+        return ops->invoke(&storage, std::forward<Args>(args)...);
+    }
+
+    /**
+     * Returns true if the functor of the given type is stored without an allocation.
+     */
+    template <typename T> static constexpr bool isInline() {
+        return sizeof(T) <= Capacity && alignof(T) <= alignof(std::max_align_t) &&
+               std::is_nothrow_move_constructible_v<T>;
+    }
+
+private:
+    struct Ops {
+        R (*invoke)(void*, Args&&...);
+        void (*move)(void*, void*) noexcept;
+        void (*destroy)(void*) noexcept;
+    };
+
+    template <typename T> struct InlineOps {
+        static R invoke(void* self, Args&&... args) {
+            return (*static_cast<T*>(self))(std::forward<Args>(args)...);
+        }
+        static void move(void* dst, void* src) noexcept {
+            new (dst) T(std::move(*static_cast<T*>(src)));
+            static_cast<T*>(src)->~T();
+        }
+        static void destroy(void* self) noexcept {
+            static_cast<T*>(self)->~T();
+        }
+        static constexpr Ops ops{&invoke, &move, &destroy};
+    };
+
+    template <typename T> struct HeapOps {
+        static R invoke(void* self, Args&&... args) {
+            return (**static_cast<T**>(self))(std::forward<Args>(args)...);
+        }
+        static void move(void* dst, void* src) noexcept {
+            *static_cast<T**>(dst) = *static_cast<T**>(src);
+        }
+        static void destroy(void* self) noexcept {
+            delete *static_cast<T**>(self);
+        }
+        static constexpr Ops ops{&invoke, &move, &destroy};
+    };
+
+    void moveFrom(InlineFunction& other) noexcept {
+        if (other.ops) {
+            other.ops->move(&storage, &other.storage);
+            ops = other.ops;
+            other.ops = nullptr;
+        }
+    }
+
+    alignas(std::max_align_t) unsigned char storage[Capacity];
+    const Ops* ops{nullptr};
+};
+} // namespace MsgNet
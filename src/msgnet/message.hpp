@@ -1,13 +1,134 @@
 #pragma once
 
 #include "packet.hpp"
+#include <string_view>
 #include <typeindex>
 #include <unordered_map>
 
 namespace MsgNet::Detail {
-MSGNET_API uint64_t getMessageHash(const std::string& name);
+inline constexpr uint32_t sha256Init[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+};
+
+inline constexpr uint32_t sha256Rounds[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+constexpr uint32_t rotateRight(const uint32_t value, const int bits) {
+    return (value >> bits) | (value << (32 - bits));
+}
+
+constexpr void sha256Compress(uint32_t (&state)[8], const uint8_t (&block)[64]) {
+    uint32_t w[64]{};
+    for (auto i = 0; i < 16; i++) {
+        w[i] = (uint32_t{block[i * 4]} << 24) | (uint32_t{block[i * 4 + 1]} << 16) |
+               (uint32_t{block[i * 4 + 2]} << 8) | uint32_t{block[i * 4 + 3]};
+    }
+    for (auto i = 16; i < 64; i++) {
+        const auto s0 = rotateRight(w[i - 15], 7) ^ rotateRight(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        const auto s1 = rotateRight(w[i - 2], 17) ^ rotateRight(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t v[8]{};
+    for (auto i = 0; i < 8; i++) {
+        v[i] = state[i];
+    }
+
+    for (auto i = 0; i < 64; i++) {
+        const auto s1 = rotateRight(v[4], 6) ^ rotateRight(v[4], 11) ^ rotateRight(v[4], 25);
+        const auto ch = (v[4] & v[5]) ^ (~v[4] & v[6]);
+        const auto t1 = v[7] + s1 + ch + sha256Rounds[i] + w[i];
+        const auto s0 = rotateRight(v[0], 2) ^ rotateRight(v[0], 13) ^ rotateRight(v[0], 22);
+        const auto maj = (v[0] & v[1]) ^ (v[0] & v[2]) ^ (v[1] & v[2]);
+        const auto t2 = s0 + maj;
+
+        v[7] = v[6];
+        v[6] = v[5];
+        v[5] = v[4];
+        v[4] = v[3] + t1;
+        v[3] = v[2];
+        v[2] = v[1];
+        v[1] = v[0];
+        v[0] = t1 + t2;
+    }
+
+    for (auto i = 0; i < 8; i++) {
+        state[i] += v[i];
+    }
+}
+
+/**
+ * Returns the ID of the message with the given name. This is the first 8 bytes of the SHA-256
+ * of the name, read as a little endian integer. Evaluated at compile time when used in MESSAGE_DEFINE.
+ *
+ * @param name The name of the message type.
+ * @return The message ID.
+ */
+constexpr uint64_t getMessageHash(const std::string_view name) {
+    uint32_t state[8]{};
+    for (auto i = 0; i < 8; i++) {
+        state[i] = sha256Init[i];
+    }
+
+    // The message, 0x80, zero padding, and the length in bits as big endian 64-bit integer
+    const uint64_t bits = uint64_t{name.size()} * 8;
+    const auto total = (name.size() + 9 + 63) / 64 * 64;
+
+    uint8_t block[64]{};
+    for (size_t i = 0; i < total; i++) {
+        if (i < name.size()) {
+            block[i % 64] = static_cast<uint8_t>(name[i]);
+        } else if (i == name.size()) {
+            block[i % 64] = 0x80;
+        } else if (i >= total - 8) {
+            block[i % 64] = static_cast<uint8_t>(bits >> ((total - 1 - i) * 8));
+        } else {
+            block[i % 64] = 0;
+        }
+
+        if (i % 64 == 63) {
+            sha256Compress(state, block);
+        }
+    }
+
+    // Only convert the first part
+    uint64_t hash{0};
+    for (auto i = 0; i < 8; i++) {
+        hash |= uint64_t{(state[i / 4] >> (24 - (i % 4) * 8)) & 0xff} << (i * 8);
+    }
+    return hash;
+}
 } // namespace MsgNet::Detail
 
+namespace MsgNet {
+/**
+ * Returns true if none of the message types share the same ID. Meant to be used in a static_assert
+ * to detect collisions at compile time.
+ *
+ * @tparam Messages The list of the message types.
+ * @return True if all IDs are unique.
+ */
+template <typename... Messages> constexpr bool hasUniqueMessageHashes() {
+    const uint64_t hashes[] = {0, Messages::hash...};
+    for (size_t i = 1; i < sizeof(hashes) / sizeof(uint64_t); i++) {
+        for (size_t j = i + 1; j < sizeof(hashes) / sizeof(uint64_t); j++) {
+            if (hashes[i] == hashes[j]) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+} // namespace MsgNet
+
 #define MESSAGE_DEFINE(Type, ...)                                                                                      \
-    static inline const uint64_t hash = MsgNet::Detail::getMessageHash(#Type);                                         \
+    static constexpr uint64_t hash = MsgNet::Detail::getMessageHash(#Type);                                            \
     MSGPACK_DEFINE_ARRAY(__VA_ARGS__);
@@ -0,0 +1,167 @@
+#pragma once
+
+#include "codec.hpp"
+#include "library.hpp"
+#include <chrono>
+#include <cstddef>
+
+namespace MsgNet {
+/**
+ * What happens to a message sent to a peer whose send queue is above the high watermark.
+ */
+enum class SendPolicy {
+    /**
+     * The sending thread waits until the queue drops to the low watermark. The I/O threads never wait,
+     * their messages are queued over the limit.
+     */
+    Block,
+    /**
+     * The message is dropped. A request fails with Error::SendQueueFull. The responses are never dropped,
+     * they are queued over the limit as the other side waits for them.
+     */
+    Drop,
+    /**
+     * The message is dropped and the peer is closed, the error handler receives Error::SendQueueFull.
+     */
+    Disconnect,
+};
+
+/**
+ * Tuning options of the server or the client. These are applied to every peer
+ * created by the server or the client.
+ */
+struct MSGNET_API Options {
+    /**
+     * Codec used to compress the outgoing messages.
+     */
+    Codec codec{};
+
+    /**
+     * Maximum number of compressed block buffers kept per peer for reuse.
+     * Buffers returned over this limit are freed. Use zero to disable the pooling.
+     */
+    size_t maxPooledBlocks{64};
+
+    /**
+     * Maximum number of received object handles, and their Msgpack zones, kept per peer for reuse.
+     * Use zero to disable the pooling.
+     */
+    size_t maxPooledObjects{64};
+
+    /**
+     * Blocks smaller than this are sent uncompressed. Small messages gain nothing from
+     * the compression, it would only cost CPU time.
+     */
+    size_t compressMinBytes{Codec::defaultMinBytes};
+
+    /**
+     * Blocks with the estimated entropy (in bits per byte, 0 to 8) above this are sent uncompressed,
+     * for example images or already compressed data. Use 8 to always try the compression.
+     */
+    float compressMaxEntropy{Codec::defaultMaxEntropy};
+
+    /**
+     * Default timeout of the requests sent with a callback, if the timeout is not given to the send().
+     * Once expired, the callback is dropped and the error handler receives Error::RequestTimeout.
+     * Use zero to wait forever.
+     */
+    std::chrono::milliseconds requestTimeout{0};
+
+    /**
+     * Number of reactors of the server, ignored by the client. Each reactor is an io_context with its own
+     * thread, timers, and acceptor. The acceptors share the port via SO_REUSEPORT and the kernel spreads
+     * the new connections across them. A peer stays on the reactor that accepted it for its whole life.
+     * Use 1 for the single io_context that can be run from any number of threads.
+     */
+    size_t reactors{1};
+
+    /**
+     * Execute all handlers and request callbacks directly by the I/O thread, as soon as the message
+     * is decompressed, instead of passing them through the postDispatch or the executor.
+     * This saves a queue hop per message, but a slow handler stalls the I/O of the peer.
+     * A message that arrives while the earlier ones are still queued is queued behind them, never reordered.
+     * See Dispatcher::addInlineHandler to do this only for some messages.
+     */
+    bool inlineDispatch{false};
+
+    /**
+     * Number of compressed bytes waiting to be written to the socket of a peer, above which the peer
+     * stops accepting new messages, see sendPolicy. Use zero for no limit.
+     */
+    size_t sendHighWatermark{0};
+
+    /**
+     * Number of compressed bytes waiting to be written, below which the peer accepts new messages again.
+     * Use zero for half of the high watermark.
+     */
+    size_t sendLowWatermark{0};
+
+    /**
+     * What happens to the messages sent above the high watermark. Can be changed per peer.
+     */
+    SendPolicy sendPolicy{SendPolicy::Block};
+
+    /**
+     * Number of received messages waiting for their handlers, above which the peer stops reading
+     * from the socket until the handlers catch up. The sender is then slowed down by the TCP flow control.
+     * The messages of a single read are always accepted, so the limit can be exceeded by one read.
+     * Use zero for no limit.
+     */
+    size_t maxUndispatchedMessages{0};
+
+    /**
+     * Same as maxUndispatchedMessages, but the packed size of the messages is counted instead.
+     * Use zero for no limit.
+     */
+    size_t maxUndispatchedBytes{0};
+
+    /**
+     * Smallest size of the receive buffer of a peer. The buffer grows while the reads fill it up,
+     * and shrinks back once the peer goes quiet.
+     */
+    size_t receiveBufferMin{1024 * 16};
+
+    /**
+     * Largest size of the receive buffer of a peer. This is also the most bytes read by a single
+     * completion of the receive loop, before it yields to the other peers.
+     */
+    size_t receiveBufferMax{1024 * 1024};
+
+    /**
+     * Size of the chunks the streams are split into, see Peer::openStream. At most 4 GiB.
+     */
+    size_t streamChunkBytes{1024 * 64};
+
+    /**
+     * Number of compressed bytes waiting to be written to the socket of a peer, above which the streams
+     * wait before sending the next chunk. The receiving side stops reading from the socket once this many
+     * packed bytes of the chunks wait for the handlers, even without the maxUndispatchedBytes.
+     * Use zero to never wait, the received chunks are then bounded only by the maxUndispatched limits.
+     */
+    size_t streamWindowBytes{1024 * 1024};
+
+    /**
+     * Encrypt the connections with TLS 1.3. Turn this off only on trusted networks, the plain TCP
+     * saves the encryption of every byte and the round trips of the handshake. Both sides must agree.
+     * The server constructed without the private key and the certificate always uses plain TCP.
+     */
+    bool tls{true};
+
+    /**
+     * Carry the connections over a Unix domain socket through a pair of shared memory rings instead,
+     * see ShmTransport. Applies only to the local endpoints, Linux only. Both sides must agree.
+     */
+    bool sharedMemory{false};
+
+    /**
+     * Size of each of the shared memory rings, rounded up to the power of two. The connecting side decides.
+     */
+    size_t sharedMemoryBytes{1024 * 1024};
+
+    /**
+     * How long a read of the shared memory ring polls for the data, before it waits for the wakeup.
+     * The polling saves the wakeup latency, but it keeps the I/O thread busy, use it only with a core to spare.
+     */
+    std::chrono::microseconds sharedMemorySpin{0};
+};
+} // namespace MsgNet
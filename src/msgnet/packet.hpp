@@ -2,6 +2,7 @@
 
 #include "library.hpp"
 #include <iostream>
+#include <memory>
 #include <msgpack.hpp>
 
 namespace MsgNet {
@@ -12,4 +13,51 @@ struct MSGNET_API PacketInfo {
 
     MSGPACK_DEFINE_ARRAY(id, reqId, isResponse);
 };
+
+/**
+ * A message that is packed once and can be sent any number of times, to any number of peers,
+ * either as a message or as a request. Sending it only writes the packet info and copies the
+ * packed bytes into the compression stream. The copies of this object share the same bytes.
+ *
+ * @code
+ * const PackedMessage<MessageConfig> packed{config};
+ * for (const auto& peer : peers) {
+ *     peer->send(packed);
+ * }
+ * @endcode
+ *
+ * @tparam Req The type of the packed message.
+ */
+template <typename Req> class PackedMessage {
+public:
+    static constexpr uint64_t hash = Req::hash;
+
+    /**
+     * @param message The message to pack, it is not needed after this.
+     */
+    explicit PackedMessage(const Req& message) : buffer{std::make_shared<msgpack::sbuffer>()} {
+        msgpack::pack(*buffer, message);
+    }
+
+    /**
+     * Returns the packed bytes of the message, without the packet info.
+     *
+     * @return Pointer to the bytes.
+     */
+    const char* data() const {
+        return buffer->data();
+    }
+
+    /**
+     * Returns the number of the packed bytes.
+     *
+     * @return Number of bytes.
+     */
+    size_t size() const {
+        return buffer->size();
+    }
+
+private:
+    std::shared_ptr<msgpack::sbuffer> buffer;
+};
 } // namespace MsgNet
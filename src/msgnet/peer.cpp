@@ -1,24 +1,43 @@
 #include "peer.hpp"
 #include "server.hpp"
+#include <limits>
 
 using namespace MsgNet;
 
-static const size_t blockBytes = 1024 * 8;
-
-Peer::Peer(ErrorHandler& errorHandler, Dispatcher& dispatcher, asio::io_service& service,
-           std::shared_ptr<Socket> socket) :
-    CompressionStream{blockBytes},
-    DecompressionStream{blockBytes},
+Peer::Peer(ErrorHandler& errorHandler, Dispatcher& dispatcher, asio::io_service& service, TimerWheel& timers,
+           std::shared_ptr<Transport> transport, const Options& options) :
+    CompressionStream{options.codec, options.maxPooledBlocks},
+    DecompressionStream{options.codec.blockBytes, options.maxPooledObjects},
     errorHandler{errorHandler},
     dispatcher{dispatcher},
+    timers{timers},
+    requestTimeout{options.requestTimeout},
+    inlineDispatch{options.inlineDispatch},
+    highWatermark{options.sendHighWatermark},
+    lowWatermark{options.sendLowWatermark ? options.sendLowWatermark : options.sendHighWatermark / 2},
+    sendPolicy{options.sendPolicy},
     runFlag{true},
     strand{service},
-    socket{std::move(socket)} {
+    transport{std::move(transport)} {
+
+    inbound.maxMessages = options.maxUndispatchedMessages;
+    inbound.maxBytes = options.maxUndispatchedBytes;
+    inbound.minBuffer = std::max<size_t>(options.receiveBufferMin, 1024);
+    inbound.maxBuffer = std::max(options.receiveBufferMax, inbound.minBuffer);
+
+    // The chunks are packed with a 32 bit length
+    if (options.streamChunkBytes > std::numeric_limits<uint32_t>::max()) {
+        throw std::runtime_error("Stream chunk size is out of range");
+    }
 
-    this->socket->lowest_layer().set_option(asio::ip::tcp::no_delay{true});
+    setStagingBytes(inbound.minBuffer);
+    streams.chunkBytes = options.streamChunkBytes;
+    streams.windowBytes = options.streamWindowBytes;
+    inbound.bufferBytes = getStagingBytes();
 
-    address = toString(this->socket->lowest_layer().remote_endpoint());
-    receiveBuffer.resize(1024);
+    setBypass(options.compressMinBytes, options.compressMaxEntropy);
+
+    address = this->transport->getAddress();
 }
 
 Peer::~Peer() {
@@ -26,121 +45,660 @@ Peer::~Peer() {
 }
 
 void Peer::start() {
+    transport->configure();
     receive();
 }
 
 void Peer::close() {
     runFlag.store(false);
-    socket.reset();
+
+    // Wake up the senders blocked by the send policy or the stream window
+    {
+        std::lock_guard<std::mutex> lock{outbound.mutex};
+        outbound.producers.clear();
+        outbound.writable.notify_all();
+    }
+
+    // The unfinished streams are dropped
+    {
+        std::lock_guard<std::mutex> lock{streams.mutex};
+        streams.incoming.clear();
+    }
+
+    // Closing the transport makes the operations in flight complete. The transport itself stays until
+    // the peer is gone, the strand may still be using it.
+    transport->close();
+
+    // The paused receive loop has no operation in flight, it must be resumed to end
+    if (inbound.paused.exchange(false)) {
+        if (auto self = weak_from_this().lock()) {
+            asio::post(strand, [self]() { self->receive(); });
+        }
+    }
+
+    // Nobody is going to respond to these anymore, the callbacks are scheduled the same way as on a timeout.
+    // Once the last reference is gone there is no peer to schedule with, they are called right here.
+    const auto self = weak_from_this().lock();
+    for (auto& error : requests.clear()) {
+        if (!error) {
+            continue;
+        }
+
+        if (self) {
+            fail(std::move(error), Error::RequestAborted);
+            continue;
+        }
+
+        try {
+            error(::make_error_code(Error::RequestAborted));
+        } catch (...) {
+            auto e = std::current_exception();
+            errorHandler.onUnhandledException(nullptr, e);
+        }
+    }
 }
 
 void Peer::receive() {
     if (!runFlag.load()) {
+        closed();
         return;
     }
 
-    const auto b = asio::buffer(receiveBuffer.data(), receiveBuffer.size());
+    // Read directly into the decompression staging buffer
+    size_t size = 0;
+    auto* data = prepare(size);
+
+    const auto b = asio::buffer(data, size);
     auto self = this->shared_from_this();
 
-    socket->async_read_some(b, [self](const asio::error_code ec, const size_t length) {
+    transport->asyncRead(strand, b, [self](const asio::error_code& ec, const size_t length) {
         if (ec) {
-            self->errorHandler.onError(self, ec);
+            // The read cancelled by close() is not an error of the connection
+            if (self->runFlag.load()) {
+                self->errorHandler.onError(self, ec);
+            }
+            self->closed();
         } else {
             try {
-                self->accept(self->receiveBuffer.data(), length);
-            } catch (std::exception_ptr& e) {
+                self->inbound.reads.fetch_add(1);
+                self->inbound.received.fetch_add(length);
+                self->commit(length);
+                self->adapt(length + self->drain());
+            } catch (msgpack::unpack_error& e) {
+                self->errorHandler.onError(self, ::make_error_code(Error::UnpackError));
+                self->close();
+                self->closed();
+                return;
+            } catch (...) {
+                // The bytes that can not be decompressed end this peer, the other peers of the reactor go on
+                auto e = std::current_exception();
                 self->errorHandler.onUnhandledException(self, e);
+                self->close();
+                self->closed();
+                return;
             }
 
-            if (self->runFlag.load()) {
-                self->receive();
+            // Either this or the last handler sees the other one and re-arms the read
+            if (self->exhausted()) {
+                self->inbound.pauses.fetch_add(1);
+                self->inbound.paused.store(true);
+                if (self->exhausted() || !self->inbound.paused.exchange(false)) {
+                    return;
+                }
             }
+
+            self->receive();
         }
     });
 }
 
+size_t Peer::drain() {
+    // Whatever the TLS layer or the kernel already holds is read without another trip through the reactor
+    size_t total = 0;
+
+    // The writes start only on the strand, none can start while this runs. A TLS read next to
+    // the write in flight would share the state of the stream with it.
+    if (!transport->isFullDuplex()) {
+        std::lock_guard<std::mutex> lock{outbound.mutex};
+        if (outbound.active) {
+            return total;
+        }
+    }
+
+    while (runFlag.load() && total < inbound.maxBuffer && !exhausted()) {
+        size_t size = 0;
+        auto* data = prepare(size);
+
+        asio::error_code ec;
+        const auto length = transport->read(asio::buffer(data, size), ec);
+
+        // Would block, or an error the next asynchronous read reports
+        if (ec || length == 0) {
+            break;
+        }
+
+        inbound.reads.fetch_add(1);
+        inbound.received.fetch_add(length);
+        commit(length);
+        total += length;
+    }
+    return total;
+}
+
+void Peer::adapt(const size_t bytes) {
+    const auto current = getStagingBytes();
+
+    // The read used up the whole buffer, there is likely more to come
+    if (bytes >= current && current < inbound.maxBuffer) {
+        inbound.quiet = 0;
+        setStagingBytes(std::min(current * 2, inbound.maxBuffer));
+    } else if (bytes < current / 8 && current > inbound.minBuffer) {
+        if (++inbound.quiet >= 16) {
+            inbound.quiet = 0;
+            setStagingBytes(std::max(current / 2, inbound.minBuffer));
+        }
+    } else {
+        inbound.quiet = 0;
+    }
+
+    inbound.bufferBytes = getStagingBytes();
+}
+
+bool Peer::exhausted() const {
+    // The chunks of the streams are held to the window of the sender even without the limits
+    return (inbound.maxMessages > 0 && inbound.messages.load() >= inbound.maxMessages) ||
+           (inbound.maxBytes > 0 && inbound.bytes.load() >= inbound.maxBytes) ||
+           (streams.windowBytes > 0 && inbound.chunkBytes.load() >= streams.windowBytes);
+}
+
+void Peer::dispatched(const size_t bytes, const size_t chunkBytes) {
+    inbound.messages.fetch_sub(1);
+    inbound.bytes.fetch_sub(bytes);
+    inbound.chunkBytes.fetch_sub(chunkBytes);
+
+    if (inbound.paused.load() && !exhausted() && inbound.paused.exchange(false)) {
+        auto self = shared_from_this();
+        asio::post(strand, [self]() { self->receive(); });
+    }
+}
+
+void Peer::closed() {
+    // Only the receive loop calls this, so there is no need for a lock
+    if (closeCallback) {
+        auto fn = std::move(closeCallback);
+        closeCallback = nullptr;
+        fn(shared_from_this());
+    }
+}
+
 void Peer::receiveObject(std::shared_ptr<msgpack::object_handle> oh) {
+    // Straight from the decompression, no queue hop and no allocation. Behind the messages of this peer
+    // that are still queued, the message is queued as well, it must not overtake them.
+    if ((inlineDispatch || dispatcher.isInline(oh->get())) && inbound.messages.load() == 0) {
+        process(std::move(oh));
+        return;
+    }
+
     auto self = this->shared_from_this();
+    const auto key = dispatcher.getDispatchKey(self, oh->get());
+    const auto bytes = getObjectBytes();
+    const auto chunkBytes = dispatcher.isStreamChunk(oh->get()) ? bytes : 0;
 
-    dispatcher.postDispatch([self, oh = std::move(oh)]() {
-        try {
-            const auto& o = oh->get();
-            if (o.type != msgpack::type::ARRAY || o.via.array.size != 2) {
-                self->errorHandler.onError(self, ::make_error_code(Error::BadMessageFormat));
-                return;
-            }
+    inbound.messages.fetch_add(1);
+    inbound.bytes.fetch_add(bytes);
+    inbound.chunkBytes.fetch_add(chunkBytes);
+
+    dispatcher.schedule(key, [self, oh = std::move(oh), bytes, chunkBytes]() mutable {
+        self->process(std::move(oh));
+        self->dispatched(bytes, chunkBytes);
+    });
+}
 
+void Peer::process(std::shared_ptr<msgpack::object_handle> oh) {
+    auto self = this->shared_from_this();
+
+    try {
+        const auto& o = oh->get();
+        if (o.type != msgpack::type::ARRAY || o.via.array.size != 2) {
+            errorHandler.onError(self, ::make_error_code(Error::BadMessageFormat));
+        } else {
             PacketInfo info;
             o.via.array.ptr[0].convert(info);
 
             const auto& object = o.via.array.ptr[1];
 
             if (info.isResponse) {
-                self->handle(info.reqId, object);
+                handle(info.reqId, object);
             } else {
-                self->dispatcher.dispatch(self, info.id, info.reqId, object);
+                dispatcher.dispatch(self, info.id, info.reqId, object);
             };
-        } catch (msgpack::unpack_error& e) {
-            self->errorHandler.onError(self, ::make_error_code(Error::UnpackError));
+        }
+    } catch (msgpack::unpack_error& e) {
+        errorHandler.onError(self, ::make_error_code(Error::UnpackError));
+    } catch (std::exception_ptr& e) {
+        errorHandler.onUnhandledException(self, e);
+    }
+
+    // The handlers are done with the object, its zone can be reused
+    recycleObject(std::move(oh));
+}
+
+void MsgNet::Peer::handle(const uint64_t reqId, const msgpack::object& object) {
+    Callback callback;
+
+    if (!requests.take(reqId, callback)) {
+        errorHandler.onError(shared_from_this(), ::make_error_code(Error::UnexpectedResponse));
+    } else {
+        try {
+            callback(object);
         } catch (std::exception_ptr& e) {
+            errorHandler.onUnhandledException(shared_from_this(), e);
+        }
+    }
+}
+
+uint64_t MsgNet::Peer::addRequest(Callback callback, const std::chrono::milliseconds timeout, ErrorCallback error) {
+    const auto reqId = requests.add(std::move(callback), std::move(error));
+
+    if (timeout.count() > 0) {
+        timers.add(timeout, [weak = weak_from_this(), reqId]() {
+            if (auto self = weak.lock()) {
+                self->expire(reqId);
+            }
+        });
+    }
+
+    return reqId;
+}
+
+void MsgNet::Peer::expire(const uint64_t reqId) {
+    Callback callback;
+    ErrorCallback error;
+
+    // Already responded to
+    if (!requests.take(reqId, callback, error)) {
+        return;
+    }
+
+    fail(std::move(error), Error::RequestTimeout);
+}
+
+void MsgNet::Peer::fail(ErrorCallback error, const Error code) {
+    auto self = shared_from_this();
+
+    if (!error) {
+        errorHandler.onError(self, ::make_error_code(code));
+        return;
+    }
+
+    // The postDispatch needs a copyable function
+    auto shared = std::make_shared<ErrorCallback>(std::move(error));
+    schedule([shared, code]() { (*shared)(::make_error_code(code)); });
+}
+
+void MsgNet::Peer::schedule(std::function<void()> fn) {
+    auto self = shared_from_this();
+    dispatcher.schedule(Dispatcher::getDispatchKey(self), [self, fn = std::move(fn)]() {
+        try {
+            fn();
+        } catch (...) {
+            auto e = std::current_exception();
             self->errorHandler.onUnhandledException(self, e);
         }
     });
 }
 
-void MsgNet::Peer::handle(const uint64_t reqId, const msgpack::object& object) {
+bool MsgNet::Peer::admit(const bool isResponse) {
+    if (!outbound.congested.load()) {
+        return true;
+    }
+
+    switch (sendPolicy.load()) {
+    case SendPolicy::Block: {
+        // The I/O thread would wait for the writes that only it can complete
+        if (strand.context().get_executor().running_in_this_thread()) {
+            return true;
+        }
+
+        std::unique_lock<std::mutex> lock{outbound.mutex};
+        outbound.writable.wait(lock, [this]() { return !outbound.congested.load() || !runFlag.load(); });
+        return runFlag.load();
+    }
+    case SendPolicy::Drop: {
+        // The other side waits for the response, dropping it would only turn into a timeout over there
+        return isResponse;
+    }
+    case SendPolicy::Disconnect: {
+        auto self = shared_from_this();
+        close();
+        errorHandler.onError(self, ::make_error_code(Error::SendQueueFull));
+        return false;
+    }
+    }
+
+    return true;
+}
+
+void MsgNet::Peer::reject(const uint64_t reqId, const bool isResponse) {
+    // Only with the Disconnect policy, the error handler knows already
+    if (reqId == 0 || isResponse) {
+        return;
+    }
+
     Callback callback;
+    ErrorCallback error;
+    if (requests.take(reqId, callback, error)) {
+        fail(std::move(error), Error::SendQueueFull);
+    }
+}
+
+void MsgNet::Peer::drained(const size_t bytes) {
+    std::vector<std::function<void()>> resume;
+    auto writable = false;
 
     {
-        std::lock_guard<std::mutex> lock{requests.mutex};
-        auto it = requests.map.find(reqId);
-        if (it != requests.map.end()) {
-            std::swap(it->second.callback, callback);
-            requests.map.erase(it);
-        } else {
-            errorHandler.onError(shared_from_this(), ::make_error_code(Error::UnexpectedResponse));
+        std::lock_guard<std::mutex> lock{outbound.mutex};
+        outbound.queued -= bytes;
+
+        // The streams waiting for the window
+        if (outbound.queued.load() < streams.windowBytes) {
+            std::swap(resume, outbound.producers);
+            if (outbound.waiters > 0) {
+                outbound.writable.notify_all();
+            }
+        }
+
+        if (outbound.congested.load() && outbound.queued.load() <= lowWatermark) {
+            outbound.congested.store(false);
+            outbound.writable.notify_all();
+            writable = true;
         }
     }
 
-    if (callback) {
+    for (auto& fn : resume) {
+        asio::post(strand, std::move(fn));
+    }
+
+    if (writable && writableCallback) {
+        writableCallback(shared_from_this());
+    }
+}
+
+void MsgNet::Peer::sendChunk(const uint64_t stream, const uint64_t type, const char* data, const size_t size,
+                             const bool last) {
+    // The I/O thread does the writing, it must not wait for itself
+    if (streams.windowBytes > 0 && !strand.context().get_executor().running_in_this_thread()) {
+        std::unique_lock<std::mutex> lock{outbound.mutex};
+        outbound.waiters++;
+        outbound.writable.wait(
+            lock, [this]() { return outbound.queued.load() < streams.windowBytes || !runFlag.load(); });
+        outbound.waiters--;
+    }
+
+    StreamChunk chunk{};
+    chunk.stream = stream;
+    chunk.type = type;
+    chunk.last = last;
+    chunk.data = data;
+    chunk.size = size;
+
+    send(chunk);
+}
+
+void MsgNet::Peer::produce(std::shared_ptr<StreamWriter> writer, std::function<size_t(char*, size_t)> producer) {
+    struct Production {
+        std::shared_ptr<StreamWriter> writer;
+        std::function<size_t(char*, size_t)> producer;
+        std::vector<char> buffer;
+    };
+
+    auto production = std::make_shared<Production>();
+    production->writer = std::move(writer);
+    production->producer = std::move(producer);
+    production->buffer.resize(std::max<size_t>(streams.chunkBytes, 1));
+
+    // One chunk at the time, then the other work of the strand gets its turn
+    auto step = std::make_shared<std::function<void()>>();
+    std::weak_ptr<std::function<void()>> weakStep = step;
+    *step = [weak = weak_from_this(), production, weakStep]() {
+        auto self = weak.lock();
+        auto next = weakStep.lock();
+        if (!self || !next || !self->runFlag.load()) {
+            return;
+        }
+
         try {
-            callback(object);
-        } catch (std::exception_ptr& e) {
-            errorHandler.onUnhandledException(shared_from_this(), e);
+            auto& buffer = production->buffer;
+            const auto length = production->producer(buffer.data(), buffer.size());
+            if (length == 0) {
+                production->writer->close();
+                return;
+            }
+            production->writer->write(buffer.data(), std::min(length, buffer.size()));
+        } catch (...) {
+            auto e = std::current_exception();
+            self->errorHandler.onUnhandledException(self, e);
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock{self->outbound.mutex};
+        if (self->streams.windowBytes > 0 && self->outbound.queued.load() >= self->streams.windowBytes) {
+            self->outbound.producers.emplace_back([next]() { (*next)(); });
+        } else {
+            asio::post(self->strand, [next]() { (*next)(); });
+        }
+    };
+
+    asio::post(strand, [step]() { (*step)(); });
+}
+
+void MsgNet::Peer::openIncoming(const uint64_t stream, ChunkHandler handler) {
+    std::lock_guard<std::mutex> lock{streams.mutex};
+    streams.incoming[stream] = std::move(handler);
+}
+
+void MsgNet::Peer::receiveChunk(const StreamChunk& chunk) {
+    ChunkHandler handler;
+
+    // The chunks of a stream are handled one after another, the handler is not needed by anyone else meanwhile
+    {
+        std::lock_guard<std::mutex> lock{streams.mutex};
+        const auto it = streams.incoming.find(chunk.stream);
+        if (it == streams.incoming.end()) {
+            return;
+        }
+        handler = std::move(it->second);
+        streams.incoming.erase(it);
+    }
+
+    // A handler that throws ends its stream, it still gets the last call to clean up
+    try {
+        handler(chunk.data, chunk.size, chunk.last);
+    } catch (...) {
+        auto e = std::current_exception();
+        errorHandler.onUnhandledException(shared_from_this(), e);
+
+        if (!chunk.last) {
+            try {
+                handler(nullptr, 0, true);
+            } catch (...) {
+                e = std::current_exception();
+                errorHandler.onUnhandledException(shared_from_this(), e);
+            }
         }
+        return;
+    }
+
+    if (!chunk.last) {
+        std::lock_guard<std::mutex> lock{streams.mutex};
+        streams.incoming.emplace(chunk.stream, std::move(handler));
+    }
+}
+
+void MsgNet::Peer::unhandledException(std::exception_ptr eptr) {
+    errorHandler.onUnhandledException(shared_from_this(), eptr);
+}
+
+void MsgNet::Peer::sendPacked(const char* data, const size_t size) {
+    if (!runFlag.load() || !admit()) {
+        return;
     }
+
+    std::lock_guard<std::mutex> lock{mutex};
+
+    CompressionStream::write(data, size);
+    flush();
 }
 
 void MsgNet::Peer::sendBuffer(std::shared_ptr<std::vector<char>> buffer) {
+    Outgoing item{};
+    item.bytes = asio::buffer(*buffer);
+    item.buffer = std::move(buffer);
+
+    enqueue(&item, 1);
+}
+
+void MsgNet::Peer::sendReference(std::shared_ptr<std::vector<char>> header, std::shared_ptr<const void> owner,
+                                 const char* data, const size_t size) {
+    // The header and the bytes are written together, as a single block
+    Outgoing items[2]{};
+    items[0].bytes = asio::buffer(*header);
+    items[0].buffer = std::move(header);
+    items[1].bytes = asio::buffer(data, size);
+    items[1].owner = std::move(owner);
+
+    enqueue(items, 2);
+}
+
+void MsgNet::Peer::enqueue(Outgoing* items, const size_t count) {
     if (!runFlag.load()) {
         return;
     }
 
-    auto self = shared_from_this();
-    const auto b = asio::buffer(buffer->data(), buffer->size());
+    outbound.blocks.fetch_add(1);
 
-    self->socket->async_write_some(b, [self, buffer](const asio::error_code ec, const size_t length) {
-        (void)self;
-        (void)buffer;
+    auto start = false;
+    auto pressure = false;
 
-        if (ec) {
-            self->errorHandler.onError(self, ec);
+    {
+        std::lock_guard<std::mutex> lock{outbound.mutex};
+        for (size_t i = 0; i < count; i++) {
+            outbound.queued += items[i].bytes.size();
+            outbound.pending.push_back(std::move(items[i]));
         }
-    });
-}
 
-bool Peer::isConnected() {
-    return runFlag.load() && socket && socket->lowest_layer().is_open();
+        if (highWatermark > 0 && !outbound.congested.load() && outbound.queued.load() > highWatermark) {
+            outbound.congested.store(true);
+            pressure = true;
+        }
+
+        // The write in flight will pick up this buffer once it completes.
+        if (!outbound.active) {
+            outbound.active = true;
+            start = true;
+        }
+    }
+
+    if (!start && !pressure) {
+        return;
+    }
+
+    // The caller may hold the lock of the compression stream, the callback must be able to send
+    auto self = shared_from_this();
+    if (pressure && backpressureCallback) {
+        asio::post(strand, [self]() { self->backpressureCallback(self); });
+    }
+
+    // All socket operations run on the strand. Any blocks queued before the strand
+    // gets to run the write are gathered into the same write.
+    if (start) {
+        asio::post(strand, [self]() { self->write(); });
+    }
 }
 
-std::string MsgNet::toString(const asio::ip::tcp::endpoint& endpoint) {
-    std::stringstream ss;
+void MsgNet::Peer::write() {
+    size_t dropped = 0;
 
-    if (endpoint.address().is_v6()) {
-        ss << "[" << endpoint.address().to_string() << "]:" << endpoint.port();
-    } else {
-        ss << "" << endpoint.address().to_string() << ":" << endpoint.port();
+    {
+        std::lock_guard<std::mutex> lock{outbound.mutex};
+        if (outbound.pending.empty() || !runFlag.load()) {
+            for (const auto& item : outbound.pending) {
+                dropped += item.bytes.size();
+            }
+            outbound.pending.clear();
+            outbound.active = false;
+        } else {
+            std::swap(outbound.pending, outbound.inflight);
+        }
+    }
+
+    if (outbound.inflight.empty()) {
+        drained(dropped);
+        return;
+    }
+
+    std::vector<asio::const_buffer> buffers;
+    buffers.reserve(outbound.inflight.size());
+    for (const auto& item : outbound.inflight) {
+        buffers.push_back(item.bytes);
     }
 
-    return ss.str();
+    outbound.writes.fetch_add(1);
+
+    auto self = shared_from_this();
+    auto handler = [self](const asio::error_code& ec, const size_t length) {
+        size_t done = 0;
+        for (auto& item : self->outbound.inflight) {
+            done += item.bytes.size();
+            if (item.buffer) {
+                self->recycleBuffer(std::move(item.buffer));
+            }
+        }
+        self->outbound.inflight.clear();
+
+        if (ec) {
+            {
+                std::lock_guard<std::mutex> lock{self->outbound.mutex};
+                for (const auto& item : self->outbound.pending) {
+                    done += item.bytes.size();
+                }
+                self->outbound.pending.clear();
+                self->outbound.active = false;
+            }
+            self->drained(done);
+            if (self->runFlag.load()) {
+                self->errorHandler.onError(self, ec);
+            }
+            return;
+        }
+
+        self->outbound.bytes.fetch_add(length);
+        self->drained(done);
+        self->write();
+    };
+
+    transport->asyncWrite(strand, buffers, std::move(handler));
+}
+
+Peer::Stats Peer::getStats() const {
+    Stats stats{};
+    stats.blocksQueued = outbound.blocks.load();
+    stats.writes = outbound.writes.load();
+    stats.bytesWritten = outbound.bytes.load();
+    stats.blocksStored = getStoredBlocks();
+    stats.poolHits = getBufferPool().getHits();
+    stats.poolMisses = getBufferPool().getMisses();
+    stats.bytesPending = outbound.queued.load();
+    stats.messagesUndispatched = inbound.messages.load();
+    stats.bytesUndispatched = inbound.bytes.load();
+    stats.readPauses = inbound.pauses.load();
+    stats.reads = inbound.reads.load();
+    stats.bytesRead = inbound.received.load();
+    stats.receiveBufferBytes = inbound.bufferBytes.load();
+    stats.bytesReferenced = getReferencedBytes();
+    return stats;
+}
+
+bool Peer::isConnected() {
+    return runFlag.load() && transport->isOpen();
 }
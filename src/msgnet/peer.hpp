@@ -4,33 +4,119 @@
 
 #include "error.hpp"
 #include "message.hpp"
+#include "options.hpp"
+#include "requests.hpp"
+#include "shm.hpp"
 #include "stream.hpp"
+#include "timer.hpp"
+#include "transfer.hpp"
+#include "transport.hpp"
 #include <asio.hpp>
-#include <asio/ssl.hpp>
 #include <atomic>
+#include <condition_variable>
 #include <functional>
 #include <mutex>
 #include <unordered_map>
 
 namespace MsgNet {
 class MSGNET_API Dispatcher;
+template <typename Req, typename Res> class RequestAwaitable;
 
 class MSGNET_API Peer : public CompressionStream,
                         public DecompressionStream,
                         public std::enable_shared_from_this<Peer> {
 public:
-    using Socket = asio::ssl::stream<asio::ip::tcp::socket>;
-
     template <typename F> struct Traits;
 
     template <typename C, typename T> struct Traits<void (C::*)(T) const> {
         using Arg = T;
     };
 
-    using Callback = std::function<void(const msgpack::object& object)>;
+    template <typename C, typename I, typename T> struct Traits<void (C::*)(I, T) const> {
+        using Arg = T;
+    };
+
+    using Callback = RequestTable::Callback;
+    using ErrorCallback = RequestTable::ErrorCallback;
+    using ChunkHandler = std::function<void(const char* data, size_t size, bool last)>;
+
+    /**
+     * Outbound statistics of the peer.
+     */
+    struct Stats {
+        /**
+         * Number of compressed blocks handed to the write queue.
+         */
+        uint64_t blocksQueued{0};
+
+        /**
+         * Number of gathered writes issued to the socket. Each write carries one or more blocks.
+         */
+        uint64_t writes{0};
+
+        /**
+         * Total number of bytes written to the socket.
+         */
+        uint64_t bytesWritten{0};
+
+        /**
+         * Number of blocks sent uncompressed, because they were too small or not compressible.
+         */
+        uint64_t blocksStored{0};
+
+        /**
+         * Number of compressed blocks that reused a pooled buffer.
+         */
+        uint64_t poolHits{0};
+
+        /**
+         * Number of compressed blocks that had to allocate a new buffer.
+         */
+        uint64_t poolMisses{0};
 
-    explicit Peer(ErrorHandler& errorHandler, Dispatcher& dispatcher, asio::io_service& service,
-                  std::shared_ptr<Socket> socket);
+        /**
+         * Number of compressed bytes waiting to be written to the socket.
+         */
+        uint64_t bytesPending{0};
+
+        /**
+         * Number of received messages waiting for their handlers.
+         */
+        uint64_t messagesUndispatched{0};
+
+        /**
+         * Packed size of the received messages waiting for their handlers.
+         */
+        uint64_t bytesUndispatched{0};
+
+        /**
+         * Number of times the reads were paused, see Options::maxUndispatchedMessages.
+         */
+        uint64_t readPauses{0};
+
+        /**
+         * Number of reads from the socket.
+         */
+        uint64_t reads{0};
+
+        /**
+         * Total number of bytes read from the socket.
+         */
+        uint64_t bytesRead{0};
+
+        /**
+         * Current size of the receive buffer, see Options::receiveBufferMin.
+         */
+        uint64_t receiveBufferBytes{0};
+
+        /**
+         * Number of bytes of the attachments handed to the socket without a copy, see Attachment.
+         */
+        uint64_t bytesReferenced{0};
+    };
+
+    explicit Peer(ErrorHandler& errorHandler, Dispatcher& dispatcher, asio::io_service& service, TimerWheel& timers,
+                  std::shared_ptr<Transport> transport, const Options& options = {});
 
     ~Peer();
 
@@ -42,9 +128,11 @@ public:
     void start();
 
     /**
-     * Closes the peer. This will shutdown the TLS and the socket. This shutdown will be executed
+     * Closes the peer. This will shutdown the connection. This shutdown will be executed
      * asynchronously. The peer may stay connected to the remote client/server until the async
      * shutdown is completed by the I/O thread.
+     * All pending requests are dropped, their error callbacks are executed with Error::RequestAborted
+     * through the postDispatch or the executor, the same as on a timeout.
      */
     void close();
 
@@ -64,6 +152,52 @@ public:
         return address;
     }
 
+    /**
+     * Returns a snapshot of the outbound statistics of this peer.
+     *
+     * @return The statistics.
+     */
+    Stats getStats() const;
+
+    /**
+     * Returns false if the send queue of this peer is above the high watermark (see Options::sendHighWatermark),
+     * and stays false until the queue drops to the low watermark. Always false once the peer is closed.
+     *
+     * @return True if the peer accepts new messages without applying the send policy.
+     */
+    bool isWritable() const {
+        return runFlag.load() && !outbound.congested.load();
+    }
+
+    /**
+     * Changes what happens to the messages sent above the high watermark, see Options::sendPolicy.
+     *
+     * @param policy The new policy.
+     */
+    void setSendPolicy(SendPolicy policy) {
+        sendPolicy.store(policy);
+    }
+
+    /**
+     * Sets the function executed once the send queue rises above the high watermark.
+     * The function is executed by the I/O thread. Set this before sending any messages.
+     *
+     * @param fn The function that accepts the peer.
+     */
+    void setBackpressureCallback(std::function<void(const std::shared_ptr<Peer>&)> fn) {
+        backpressureCallback = std::move(fn);
+    }
+
+    /**
+     * Sets the function executed once the send queue drops back to the low watermark.
+     * The function is executed by the I/O thread. Set this before sending any messages.
+     *
+     * @param fn The function that accepts the peer.
+     */
+    void setWritableCallback(std::function<void(const std::shared_ptr<Peer>&)> fn) {
+        writableCallback = std::move(fn);
+    }
+
     /**
      * Internal use only, do not call.
      */
@@ -72,24 +206,75 @@ public:
             return;
         }
 
+        if (!admit(isResponse)) {
+            reject(reqId, isResponse);
+            return;
+        }
+
         // Only one thread can write to the compression stream at the time.
         std::lock_guard<std::mutex> lock{mutex};
 
+        pack(message, reqId, isResponse);
+        flush();
+    }
+
+    /**
+     * Internal use only, do not call. Sends the bytes produced by pack() as they are.
+     */
+    void sendPacked(const char* data, size_t size);
+
+    /**
+     * Internal use only, do not call. Executed once the receive loop of the peer ends.
+     */
+    void setCloseCallback(std::function<void(const std::shared_ptr<Peer>&)> fn) {
+        closeCallback = std::move(fn);
+    }
+
+    /**
+     * Packs the message together with its packet info into any msgpack compatible stream.
+     * The bytes can be sent later by sendPacked(), for example to multiple peers.
+     *
+     * @tparam Stream The type of the stream, must have a write(const char*, size_t) method.
+     * @tparam Req The type of the message to pack. This is auto deduced from the parameter.
+     * @param stream Where to write the bytes.
+     * @param message The message to pack.
+     * @param reqId The request ID, zero if the message is not a request nor a response.
+     * @param isResponse True if the message is a response to the request ID.
+     */
+    template <typename Stream, typename Req>
+    static void pack(Stream& stream, const Req& message, const uint64_t reqId, const bool isResponse) {
         PacketInfo info;
 
         info.id = Req::hash;
         info.reqId = reqId;
         info.isResponse = isResponse;
 
-        msgpack::packer<CompressionStream> packer{*this};
+        msgpack::packer<Stream> packer{stream};
         packer.pack_array(2);
         packer.pack(info);
         packer.pack(message);
-        flush();
+    }
+
+    /**
+     * Same as pack(stream, message, reqId, isResponse), the bytes of the message are copied as they are.
+     */
+    template <typename Stream, typename Req>
+    static void pack(Stream& stream, const PackedMessage<Req>& message, const uint64_t reqId, const bool isResponse) {
+        PacketInfo info;
+
+        info.id = Req::hash;
+        info.reqId = reqId;
+        info.isResponse = isResponse;
+
+        msgpack::packer<Stream> packer{stream};
+        packer.pack_array(2);
+        packer.pack(info);
+        stream.write(message.data(), message.size());
     }
 
     /**
      * Send some message to the server/client.
+     * The message can also be a PackedMessage, which is not packed again. This applies to all of the send methods.
      *
      * @tparam Req The type of the message to send. This is auto deduced from the parameter.
      * @param message The message to send to the server.
@@ -98,6 +283,39 @@ public:
         send<Req>(message, 0, false);
     }
 
+    /**
+     * Same as send(message), but only if the peer is writable, see isWritable().
+     * The send policy is never applied.
+     *
+     * @tparam Req The type of the message to send. This is auto deduced from the parameter.
+     * @param message The message to send to the server/client.
+     * @return False if the message would block, it has not been sent.
+     */
+    template <typename Req> bool trySend(const Req& message) {
+        if (!isWritable()) {
+            return false;
+        }
+        send<Req>(message, 0, false);
+        return true;
+    }
+
+    /**
+     * Same as send(message, fn), but only if the peer is writable, see isWritable().
+     * The send policy is never applied.
+     *
+     * @tparam Req The type of the message to send. This is auto deduced from the parameter.
+     * @param message The message to send to the server/client.
+     * @param fn The callback executed with the response.
+     * @return False if the request would block, it has not been sent.
+     */
+    template <typename Req, typename Fn> bool trySend(const Req& message, Fn fn) {
+        if (!isWritable()) {
+            return false;
+        }
+        send(message, std::move(fn));
+        return true;
+    }
+
     /**
      * Send some message to the server/client, with a callback method. This send the message as a request.
      * The server/client responds back a response message to the request. Once the response is received the
@@ -116,53 +334,398 @@ public:
      */
     template <typename Req, typename Fn> void send(const Req& message, Fn fn) {
         using Res = typename Traits<decltype(&Fn::operator())>::Arg;
-        sendInternal<Req, Res, Fn>(message, std::forward<Fn>(fn));
+        sendInternal<Req, Res, Fn>(message, std::forward<Fn>(fn), requestTimeout, {});
+    }
+
+    /**
+     * Send some message to the server/client as a request with a deadline. Same as send(message, fn),
+     * but if the response does not arrive within the timeout, the callback is dropped and the error
+     * callback is executed with Error::RequestTimeout instead. If the peer is closed before the response
+     * arrives, the error callback is executed with Error::RequestAborted.
+     * Only one of the callbacks is ever executed.
+     *
+     * @note The error callback of the timeout is executed through the postDispatch, same as the callback.
+     *
+     * @tparam Req The type of the message to send. This is auto deduced from the parameter.
+     * @param message The message to send to the server/client.
+     * @param fn The callback executed with the response.
+     * @param timeout How long to wait for the response. Use zero to wait forever.
+     * @param error The callback executed with the error code if the request fails.
+     */
+    template <typename Req, typename Fn, typename ErrorFn>
+    void send(const Req& message, Fn fn, const std::chrono::milliseconds timeout, ErrorFn error) {
+        using Res = typename Traits<decltype(&Fn::operator())>::Arg;
+        sendInternal<Req, Res, Fn>(message, std::forward<Fn>(fn), timeout, std::move(error));
+    }
+
+    /**
+     * Opens a stream of bytes of any length to the server/client. The header message describes the stream,
+     * the stream handler of its type on the other side receives it first, followed by the data in chunks,
+     * see Dispatcher::addStreamHandler. The chunks are sent as they are written, they interleave with
+     * the other messages sent to this peer.
+     *
+     * @code
+     * auto writer = peer->openStream(MessageUpload{"file.bin"});
+     * while (file.read(buffer, sizeof(buffer))) {
+     *     writer->write(buffer, file.gcount());
+     * }
+     * writer->close();
+     * @endcode
+     *
+     * @tparam Header The type of the header message. This is auto deduced from the parameter.
+     * @param header The header of the stream.
+     * @return The writer of the stream.
+     */
+    template <typename Header> std::shared_ptr<StreamWriter> openStream(const Header& header) {
+        msgpack::sbuffer buffer;
+        msgpack::pack(buffer, header);
+
+        const auto id = streams.next.fetch_add(1);
+        sendChunk(id, Header::hash, buffer.data(), buffer.size(), false);
+        return std::make_shared<StreamWriter>(shared_from_this(), id, streams.chunkBytes);
+    }
+
+    /**
+     * Same as openStream(header), but the data is pulled from the producer by the I/O thread.
+     * The producer is called with a buffer of Options::streamChunkBytes, and returns the number of bytes
+     * written into it, zero ends the stream. The producer is called again only once the socket keeps up,
+     * and each chunk yields to the other work of the I/O thread.
+     *
+     * @tparam Header The type of the header message. This is auto deduced from the parameter.
+     * @tparam Producer The type of the producer. This is auto deduced from the parameter.
+     * @param header The header of the stream.
+     * @param producer The function that accepts (char* buffer, size_t size) and returns size_t.
+     */
+    template <typename Header, typename Producer> void sendStream(const Header& header, Producer producer) {
+        produce(openStream(header), std::function<size_t(char*, size_t)>{std::move(producer)});
+    }
+
+    /**
+     * Internal use only, do not call. Sends a single chunk of a stream.
+     */
+    void sendChunk(uint64_t stream, uint64_t type, const char* data, size_t size, bool last);
+
+    /**
+     * Internal use only, do not call. Starts receiving the stream with the handler.
+     */
+    void openIncoming(uint64_t stream, ChunkHandler handler);
+
+    /**
+     * Internal use only, do not call. Passes the chunk to the handler of its stream.
+     */
+    void receiveChunk(const StreamChunk& chunk);
+
+    /**
+     * Internal use only, do not call. Reports the exception of a handler that completed asynchronously.
+     */
+    void unhandledException(std::exception_ptr eptr);
+
+    /**
+     * Send multiple messages to the server/client as requests, and execute the callback once all of the
+     * responses have arrived. The messages are packed under a single lock into a single compression flush,
+     * and are written to the socket at once.
+     * The responses are passed to the callback as a vector, in the same order as the messages.
+     * If any of the requests fails, for example with Options::requestTimeout, the error handler receives
+     * the error once, and the callback is never executed. An empty batch completes through the postDispatch.
+     *
+     * @code
+     * peer->sendBatch(requests, [](std::vector<MessageFooResponse> responses) {});
+     * @endcode
+     *
+     * @tparam Req The type of the messages to send. This is auto deduced from the parameter.
+     * @param messages The messages to send to the server/client.
+     * @param fn The callback executed with all of the responses.
+     */
+    template <typename Req, typename Fn> void sendBatch(const std::vector<Req>& messages, Fn fn) {
+        sendBatch(messages, std::move(fn), requestTimeout, ErrorCallback{});
+    }
+
+    /**
+     * Same as sendBatch(messages, fn) with a deadline for the whole batch. If any of the requests fails,
+     * the error callback is executed once, and the callback is never executed.
+     *
+     * @tparam Req The type of the messages to send. This is auto deduced from the parameter.
+     * @param messages The messages to send to the server/client.
+     * @param fn The callback executed with all of the responses.
+     * @param timeout How long to wait for all of the responses. Use zero to wait forever.
+     * @param error The callback executed with the error code if the batch fails.
+     */
+    template <typename Req, typename Fn, typename ErrorFn>
+    void sendBatch(const std::vector<Req>& messages, Fn fn, const std::chrono::milliseconds timeout, ErrorFn error) {
+        using Res = typename std::decay_t<typename Traits<decltype(&Fn::operator())>::Arg>::value_type;
+
+        auto responses = std::make_shared<std::vector<Res>>(messages.size());
+        sendBatchInternal<Req, Res>(
+            messages, [responses](const size_t index, Res res) { (*responses)[index] = std::move(res); },
+            [responses, fn = std::move(fn)]() { fn(std::move(*responses)); }, timeout, std::move(error));
+    }
+
+    /**
+     * Same as sendBatch(messages, fn), but each response is passed to the item callback together with
+     * the index of its message, as soon as it arrives. The done callback is executed once all of the item
+     * callbacks have been executed.
+     *
+     * @code
+     * peer->sendBatch(requests, [](size_t index, MessageFooResponse res) {}, []() {});
+     * @endcode
+     *
+     * @tparam Req The type of the messages to send. This is auto deduced from the parameter.
+     * @param messages The messages to send to the server/client.
+     * @param item The callback executed with each of the responses.
+     * @param done The callback executed after the last response.
+     */
+    template <typename Req, typename ItemFn, typename DoneFn>
+    void sendBatch(const std::vector<Req>& messages, ItemFn item, DoneFn done) {
+        sendBatch(messages, std::move(item), std::move(done), requestTimeout, ErrorCallback{});
+    }
+
+    /**
+     * Same as sendBatch(messages, item, done) with a deadline for the whole batch.
+     */
+    template <typename Req, typename ItemFn, typename DoneFn, typename ErrorFn>
+    void sendBatch(const std::vector<Req>& messages, ItemFn item, DoneFn done, const std::chrono::milliseconds timeout,
+                   ErrorFn error) {
+        using Res = std::decay_t<typename Traits<decltype(&ItemFn::operator())>::Arg>;
+        sendBatchInternal<Req, Res>(messages, std::move(item), std::move(done), timeout, std::move(error));
+    }
+
+    /**
+     * Send some message to the server/client as a request and await the response in a C++20 coroutine.
+     * The coroutine is resumed directly by the thread that executes the response (see postDispatch),
+     * or by the thread that closes the peer. If the request fails, the co_await throws std::system_error
+     * with Error::RequestTimeout or Error::RequestAborted.
+     *
+     * @note Requires C++20, include <msgnet/coroutine.hpp> to use this.
+     *
+     * @code
+     * MessageFooResponse res = co_await peer->request<MessageFooResponse>(req);
+     * @endcode
+     *
+     * @tparam Res The type of the response message.
+     * @tparam Req The type of the message to send. This is auto deduced from the parameter.
+     * @param message The message to send to the server/client. It is packed before the coroutine suspends.
+     * @param timeout How long to wait for the response. Use zero to wait forever.
+     * @return The awaitable of the response.
+     */
+    template <typename Res, typename Req>
+    RequestAwaitable<Req, Res> request(const Req& message, const std::chrono::milliseconds timeout) {
+        return RequestAwaitable<Req, Res>{shared_from_this(), message, timeout};
+    }
+
+    /**
+     * Same as request(message, timeout) with the default timeout from the Options.
+     */
+    template <typename Res, typename Req> RequestAwaitable<Req, Res> request(const Req& message) {
+        return request<Res, Req>(message, requestTimeout);
     }
 
 private:
-    struct Handler {
-        Callback callback;
+    template <typename Req, typename Res> friend class RequestAwaitable;
+
+    // A block waiting for the socket, either a buffer of the compression stream or the bytes of an attachment
+    struct Outgoing {
+        std::shared_ptr<std::vector<char>> buffer;
+        std::shared_ptr<const void> owner;
+        asio::const_buffer bytes;
     };
 
     void sendBuffer(std::shared_ptr<std::vector<char>> buffer) override;
+    void sendReference(std::shared_ptr<std::vector<char>> header, std::shared_ptr<const void> owner, const char* data,
+                       size_t size) override;
+    void enqueue(Outgoing* items, size_t count);
+    void write();
     void handle(uint64_t reqId, const msgpack::object& object);
     void receive();
     void receiveObject(std::shared_ptr<msgpack::object_handle> oh) override;
+    void process(std::shared_ptr<msgpack::object_handle> oh);
+    void expire(uint64_t reqId);
+    void fail(ErrorCallback error, Error code);
+    void schedule(std::function<void()> fn);
+    bool admit(bool isResponse = false);
+    void reject(uint64_t reqId, bool isResponse);
+    void drained(size_t bytes);
+    void closed();
+    bool exhausted() const;
+    void dispatched(size_t bytes, size_t chunkBytes);
+    size_t drain();
+    void adapt(size_t bytes);
+    void produce(std::shared_ptr<StreamWriter> writer, std::function<size_t(char*, size_t)> producer);
+
+    template <typename Req> void pack(const Req& message, const uint64_t reqId, const bool isResponse) {
+        pack(static_cast<CompressionStream&>(*this), message, reqId, isResponse);
+    }
+
+    template <typename Res, typename ItemFn, typename DoneFn> struct Batch {
+        Batch(ItemFn item, DoneFn done, ErrorCallback error, const size_t count) :
+            item{std::move(item)}, done{std::move(done)}, error{std::move(error)}, remaining{count} {
+        }
+
+        // The first error of any of the requests fails the whole batch, it is reported once, either to
+        // the error callback or to the error handler, and the done callback is never executed
+        void fail(const std::error_code ec) {
+            if (finished.exchange(true)) {
+                return;
+            }
+
+            if (error) {
+                error(ec);
+            } else if (auto self = peer.lock()) {
+                self->errorHandler.onError(self, ec);
+            }
+        }
+
+        ItemFn item;
+        DoneFn done;
+        ErrorCallback error;
+        std::atomic_size_t remaining;
+        std::atomic_bool finished{false};
+        std::vector<uint64_t> reqIds;
+        std::weak_ptr<Peer> peer;
+    };
 
-    template <typename Req, typename Res, typename Fn> void sendInternal(const Req& message, Fn fn) {
-        const auto reqId = requests.nextId.fetch_add(1ULL);
+    template <typename Req, typename Res, typename ItemFn, typename DoneFn>
+    void sendBatchInternal(const std::vector<Req>& messages, ItemFn item, DoneFn done,
+                           const std::chrono::milliseconds timeout, ErrorCallback error) {
+        if (!runFlag.load()) {
+            return;
+        }
+
+        // Never from within this call, the same as with the responses
+        if (messages.empty()) {
+            auto shared = std::make_shared<DoneFn>(std::move(done));
+            schedule([shared]() { (*shared)(); });
+            return;
+        }
+
+        if (!admit()) {
+            fail(std::move(error), Error::SendQueueFull);
+            return;
+        }
+
+        auto batch = std::make_shared<Batch<Res, ItemFn, DoneFn>>(std::move(item), std::move(done), std::move(error),
+                                                                   messages.size());
+        batch->peer = weak_from_this();
+
+        std::vector<Callback> callbacks;
+        std::vector<ErrorCallback> errors;
+        callbacks.reserve(messages.size());
+        errors.reserve(messages.size());
+        for (size_t i = 0; i < messages.size(); i++) {
+            callbacks.emplace_back([batch, i](const msgpack::object& object) {
+                if (batch->finished.load()) {
+                    return;
+                }
+
+                Res res{};
+                try {
+                    object.convert(res);
+                } catch (...) {
+                    batch->fail(make_error_code(Error::UnpackError));
+                    return;
+                }
+                batch->item(i, std::move(res));
 
-        Handler handler{};
-        handler.callback = [fn](const msgpack::object& object) {
-            Res res{};
-            object.convert(res);
+                if (batch->remaining.fetch_sub(1) == 1 && !batch->finished.exchange(true)) {
+                    batch->done();
+                }
+            });
+            errors.emplace_back([batch](const std::error_code ec) { batch->fail(ec); });
+        }
 
-            fn(std::move(res));
-        };
+        // All of the requests are registered at once, and share a single deadline
+        batch->reqIds = requests.add(callbacks, errors);
+        if (timeout.count() > 0) {
+            timers.add(timeout, [weak = weak_from_this(), batch]() {
+                if (auto self = weak.lock()) {
+                    for (const auto reqId : batch->reqIds) {
+                        self->expire(reqId);
+                    }
+                }
+            });
+        }
 
         {
-            std::lock_guard<std::mutex> lock{requests.mutex};
-            requests.map[reqId] = std::move(handler);
+            std::lock_guard<std::mutex> lock{mutex};
+            for (size_t i = 0; i < messages.size(); i++) {
+                pack(messages[i], batch->reqIds[i], false);
+            }
+            flush();
         }
+    }
+    uint64_t addRequest(Callback callback, std::chrono::milliseconds timeout, ErrorCallback error);
+
+    template <typename Req, typename Res, typename Fn>
+    void sendInternal(const Req& message, Fn fn, const std::chrono::milliseconds timeout, ErrorCallback error) {
+        const auto reqId = addRequest(
+            [fn = std::move(fn)](const msgpack::object& object) {
+                Res res{};
+                object.convert(res);
+
+                fn(std::move(res));
+            },
+            timeout, std::move(error));
 
         send(message, reqId, false);
     }
 
     ErrorHandler& errorHandler;
     Dispatcher& dispatcher;
+    TimerWheel& timers;
+    std::chrono::milliseconds requestTimeout;
+    bool inlineDispatch;
+    size_t highWatermark;
+    size_t lowWatermark;
+    std::atomic<SendPolicy> sendPolicy;
+    std::function<void(const std::shared_ptr<Peer>&)> backpressureCallback;
+    std::function<void(const std::shared_ptr<Peer>&)> writableCallback;
     std::atomic_bool runFlag;
     asio::io_context::strand strand;
-    std::shared_ptr<Socket> socket;
+    const std::shared_ptr<Transport> transport;
     std::string address;
-    std::vector<char> receiveBuffer;
     std::mutex mutex;
+    std::function<void(const std::shared_ptr<Peer>&)> closeCallback;
+
+    // The receive loop is not re-armed while the handlers are behind, the last handler re-arms it.
+    struct {
+        size_t maxMessages;
+        size_t maxBytes;
+        std::atomic_size_t messages{0};
+        std::atomic_size_t bytes{0};
+        std::atomic_size_t chunkBytes{0};
+        std::atomic_bool paused{false};
+        std::atomic_uint64_t pauses{0};
+        size_t minBuffer;
+        size_t maxBuffer;
+        size_t quiet{0};
+        std::atomic_uint64_t reads{0};
+        std::atomic_uint64_t received{0};
+        std::atomic_uint64_t bufferBytes{0};
+    } inbound;
 
     struct {
-        std::atomic_uint64_t nextId{0};
+        size_t chunkBytes;
+        size_t windowBytes;
+        std::atomic_uint64_t next{1};
         std::mutex mutex;
-        std::unordered_map<uint64_t, Handler> map;
-    } requests;
-};
+        std::unordered_map<uint64_t, ChunkHandler> incoming;
+    } streams;
+
+    // Only one gathered write is in flight at the time, everything else waits in the pending queue.
+    struct {
+        std::mutex mutex;
+        std::vector<Outgoing> pending;
+        std::vector<Outgoing> inflight;
+        bool active{false};
+        std::condition_variable writable;
+        size_t waiters{0};
+        std::vector<std::function<void()>> producers;
+        std::atomic_size_t queued{0};
+        std::atomic_bool congested{false};
+        std::atomic_uint64_t blocks{0};
+        std::atomic_uint64_t writes{0};
+        std::atomic_uint64_t bytes{0};
+    } outbound;
 
-MSGNET_API std::string toString(const asio::ip::tcp::endpoint& endpoint);
+    RequestTable requests;
+};
 } // namespace MsgNet
@@ -0,0 +1,82 @@
+#pragma once
+
+#include "library.hpp"
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace MsgNet {
+/**
+ * A thread safe pool of reusable objects. The objects are not reset when returned,
+ * the caller is responsible for bringing the object into the state it needs.
+ *
+ * @tparam T The type of the pooled object, must be default constructible.
+ */
+template <typename T> class Pool {
+public:
+    /**
+     * @param maxPooled Maximum number of objects kept for reuse.
+     */
+    explicit Pool(const size_t maxPooled) : maxPooled{maxPooled} {
+    }
+
+    /**
+     * Returns a pooled object, or creates a new one if the pool is empty.
+     *
+     * @return The object, never null.
+     */
+    std::shared_ptr<T> acquire() {
+        {
+            std::lock_guard<std::mutex> lock{mutex};
+            if (!items.empty()) {
+                auto item = std::move(items.back());
+                items.pop_back();
+                hits.fetch_add(1, std::memory_order_relaxed);
+                return item;
+            }
+        }
+
+        misses.fetch_add(1, std::memory_order_relaxed);
+        return std::make_shared<T>();
+    }
+
+    /**
+     * Gives the object back to the pool. The object is only kept if nothing else
+     * holds a reference to it and the pool is not full, otherwise it is simply dropped.
+     *
+     * @param item The object to return.
+     */
+    void release(std::shared_ptr<T> item) {
+        if (!item || item.use_count() != 1) {
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock{mutex};
+        if (items.size() < maxPooled) {
+            items.push_back(std::move(item));
+        }
+    }
+
+    /**
+     * Returns the number of acquire() calls served from the pool.
+     */
+    uint64_t getHits() const {
+        return hits.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Returns the number of acquire() calls that had to create a new object.
+     */
+    uint64_t getMisses() const {
+        return misses.load(std::memory_order_relaxed);
+    }
+
+private:
+    const size_t maxPooled;
+    std::mutex mutex;
+    std::vector<std::shared_ptr<T>> items;
+    std::atomic_uint64_t hits{0};
+    std::atomic_uint64_t misses{0};
+};
+} // namespace MsgNet
@@ -0,0 +1,129 @@
+#include "requests.hpp"
+#include <atomic>
+
+using namespace MsgNet;
+
+static size_t getThreadShard() {
+    // Each thread gets the next shard in a round robin fashion
+    static std::atomic_size_t counter{0};
+    static thread_local const size_t shard = counter.fetch_add(1, std::memory_order_relaxed);
+    return shard;
+}
+
+uint64_t RequestTable::add(Callback callback, ErrorCallback error) {
+    const auto index = getThreadShard() % shardCount;
+    auto& shard = shards[index];
+
+    std::lock_guard<std::mutex> lock{shard.mutex};
+    return insert(shard, index, std::move(callback), std::move(error));
+}
+
+std::vector<uint64_t> RequestTable::add(std::vector<Callback>& callbacks, std::vector<ErrorCallback>& errors) {
+    if (!errors.empty() && errors.size() != callbacks.size()) {
+        throw std::runtime_error("Number of error callbacks does not match the callbacks");
+    }
+
+    const auto index = getThreadShard() % shardCount;
+    auto& shard = shards[index];
+
+    std::vector<uint64_t> reqIds;
+    reqIds.reserve(callbacks.size());
+
+    std::lock_guard<std::mutex> lock{shard.mutex};
+    for (size_t i = 0; i < callbacks.size(); i++) {
+        reqIds.push_back(
+            insert(shard, index, std::move(callbacks[i]), errors.empty() ? ErrorCallback{} : std::move(errors[i])));
+    }
+
+    return reqIds;
+}
+
+uint64_t RequestTable::insert(Shard& shard, const size_t index, Callback callback, ErrorCallback error) {
+    uint32_t position;
+    if (!shard.free.empty()) {
+        position = shard.free.back();
+        shard.free.pop_back();
+    } else {
+        if (shard.slots.size() >= maxSlots) {
+            throw std::runtime_error("Too many pending requests");
+        }
+        position = static_cast<uint32_t>(shard.slots.size());
+        shard.slots.emplace_back();
+    }
+
+    auto& slot = shard.slots[position];
+    slot.callback = std::move(callback);
+    slot.error = std::move(error);
+
+    return (uint64_t{slot.generation} << 32) | (uint64_t{position} << shardBits) | index;
+}
+
+bool RequestTable::take(const uint64_t reqId, Callback& callback) {
+    ErrorCallback error;
+    return take(reqId, callback, error);
+}
+
+bool RequestTable::take(const uint64_t reqId, Callback& callback, ErrorCallback& error) {
+    auto& shard = shards[reqId & (shardCount - 1)];
+    const auto position = static_cast<uint32_t>(reqId & 0xffffffffULL) >> shardBits;
+    const auto generation = static_cast<uint32_t>(reqId >> 32);
+
+    std::lock_guard<std::mutex> lock{shard.mutex};
+
+    if (position >= shard.slots.size()) {
+        return false;
+    }
+
+    auto& slot = shard.slots[position];
+    if (!slot.callback || slot.generation != generation) {
+        return false;
+    }
+
+    callback = std::move(slot.callback);
+    error = std::move(slot.error);
+    release(shard, position);
+
+    return true;
+}
+
+std::vector<RequestTable::ErrorCallback> RequestTable::clear() {
+    std::vector<ErrorCallback> errors;
+
+    for (auto& shard : shards) {
+        std::lock_guard<std::mutex> lock{shard.mutex};
+        for (size_t position = 0; position < shard.slots.size(); position++) {
+            auto& slot = shard.slots[position];
+            if (!slot.callback) {
+                continue;
+            }
+
+            slot.callback.reset();
+            if (slot.error) {
+                errors.push_back(std::move(slot.error));
+            }
+            release(shard, static_cast<uint32_t>(position));
+        }
+    }
+
+    return errors;
+}
+
+void RequestTable::release(Shard& shard, const uint32_t position) {
+    auto& slot = shard.slots[position];
+    slot.error.reset();
+
+    // Zero is never used, so the request ID is never zero
+    if (++slot.generation == 0) {
+        slot.generation = 1;
+    }
+    shard.free.push_back(position);
+}
+
+size_t RequestTable::size() const {
+    size_t total = 0;
+    for (const auto& shard : shards) {
+        std::lock_guard<std::mutex> lock{shard.mutex};
+        total += shard.slots.size() - shard.free.size();
+    }
+    return total;
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include "function.hpp"
+#include "packet.hpp"
+#include <array>
+#include <mutex>
+#include <system_error>
+#include <vector>
+
+namespace MsgNet {
+/**
+ * A thread safe table of the pending requests of a peer. The table is split into shards,
+ * each thread adds its requests into its own shard, so the requesting threads do not contend
+ * on a single lock. The slots are reused, the request ID carries the slot position and
+ * a generation counter of the slot, so a stale or duplicate response is never matched
+ * with a newer request.
+ */
+class MSGNET_API RequestTable {
+public:
+    using Callback = InlineFunction<void(const msgpack::object& object)>;
+    using ErrorCallback = InlineFunction<void(std::error_code ec)>;
+
+    RequestTable() = default;
+    RequestTable(const RequestTable& other) = delete;
+    RequestTable& operator=(const RequestTable& other) = delete;
+
+    /**
+     * Stores the callback in a free slot.
+     *
+     * @param callback The callback to execute once the response arrives.
+     * @param error The optional callback to execute if the request fails.
+     * @return The request ID, never zero.
+     */
+    uint64_t add(Callback callback, ErrorCallback error = {});
+
+    /**
+     * Stores multiple callbacks at once, under a single lock.
+     *
+     * @param callbacks The callbacks to execute once the responses arrive.
+     * @param errors The error callbacks, either empty or one for each callback.
+     * @return The request IDs, in the same order as the callbacks.
+     */
+    std::vector<uint64_t> add(std::vector<Callback>& callbacks, std::vector<ErrorCallback>& errors);
+
+    /**
+     * Removes the callback of the request from the table.
+     *
+     * @param reqId The request ID returned by add().
+     * @param callback Where to move the callback.
+     * @return False if there is no such pending request.
+     */
+    bool take(uint64_t reqId, Callback& callback);
+
+    /**
+     * Removes the callbacks of the request from the table.
+     *
+     * @param reqId The request ID returned by add().
+     * @param callback Where to move the callback.
+     * @param error Where to move the error callback.
+     * @return False if there is no such pending request.
+     */
+    bool take(uint64_t reqId, Callback& callback, ErrorCallback& error);
+
+    /**
+     * Removes all pending requests. The responses that arrive later are not matched.
+     *
+     * @return The error callbacks of the removed requests, only those that have one.
+     */
+    std::vector<ErrorCallback> clear();
+
+    /**
+     * Returns the number of pending requests.
+     *
+     * @return The number of requests.
+     */
+    size_t size() const;
+
+private:
+    static constexpr size_t shardBits = 4;
+    static constexpr size_t shardCount = 1 << shardBits;
+    static constexpr uint64_t maxSlots = 1ULL << (32 - shardBits);
+
+    struct Slot {
+        uint32_t generation{1};
+        Callback callback;
+        ErrorCallback error;
+    };
+
+    struct alignas(64) Shard {
+        mutable std::mutex mutex;
+        std::vector<Slot> slots;
+        std::vector<uint32_t> free;
+    };
+
+    static uint64_t insert(Shard& shard, size_t index, Callback callback, ErrorCallback error);
+    static void release(Shard& shard, uint32_t position);
+
+    std::array<Shard, shardCount> shards;
+};
+} // namespace MsgNet
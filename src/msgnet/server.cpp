@@ -1,71 +1,287 @@
 #include "server.hpp"
 #include <iostream>
 
+#ifndef _WIN32
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 using namespace MsgNet;
 
-Server::Server(unsigned int port, const Pkey& pkey, const Dh& ec, const Cert& cert) :
-    Dispatcher{static_cast<ErrorHandler&>(*this)},
-    ssl{asio::ssl::context::tlsv13},
-    acceptor{service, getEndpoint(port)} {
+#if defined(SO_REUSEPORT)
+using ReusePort = asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>;
+#endif
+
+// The reactor that is being run by this thread, if any
+static thread_local const void* currentReactor = nullptr;
+
+Server::Server(unsigned int port, const Pkey& pkey, const Dh& ec, const Cert& cert, const Options& options) :
+    Dispatcher{static_cast<ErrorHandler&>(*this)}, options{options} {
+
+    if (options.tls) {
+        ssl = std::make_unique<asio::ssl::context>(asio::ssl::context::tlsv13);
+        ssl->set_options(asio::ssl::context::default_workarounds | asio::ssl::context::no_sslv2 |
+                         asio::ssl::context::no_sslv3 | asio::ssl::context::no_tlsv1_1 |
+                         asio::ssl::context::no_tlsv1_2 | asio::ssl::context::single_dh_use);
+        ssl->use_certificate_chain(asio::buffer(cert.pem()));
+        ssl->use_private_key(asio::buffer(pkey.pem()), asio::ssl::context::pem);
+        ssl->use_tmp_dh(asio::buffer(ec.pem()));
+    }
+
+    createReactors();
+    listen(port);
+}
+
+Server::Server(unsigned int port, const Options& options) :
+    Dispatcher{static_cast<ErrorHandler&>(*this)}, options{options} {
+
+    createReactors();
+    listen(port);
+}
+
+#ifndef _WIN32
+Server::Server(const LocalEndpoint& endpoint, const Options& options) :
+    Dispatcher{static_cast<ErrorHandler&>(*this)}, options{options} {
 
-    ssl.set_options(asio::ssl::context::default_workarounds | asio::ssl::context::no_sslv2 |
-                    asio::ssl::context::no_sslv3 | asio::ssl::context::no_tlsv1_1 | asio::ssl::context::no_tlsv1_2 |
-                    asio::ssl::context::single_dh_use);
-    ssl.use_certificate_chain(asio::buffer(cert.pem()));
-    ssl.use_private_key(asio::buffer(pkey.pem()), asio::ssl::context::pem);
-    ssl.use_tmp_dh(asio::buffer(ec.pem()));
+    createReactors();
+    listen(endpoint);
 }
+#endif
 
 Server::~Server() {
     stop();
 }
 
+void Server::createReactors() {
+    const auto count = std::max<size_t>(options.reactors, 1);
+    for (size_t i = 0; i < count; i++) {
+        reactors.push_back(std::make_unique<Reactor>());
+    }
+
+    // The reactors may have no sockets to work with for a while
+    if (count > 1) {
+        for (auto& reactor : reactors) {
+            reactor->work = std::make_unique<asio::io_service::work>(reactor->service);
+        }
+    }
+}
+
+void Server::listen(const unsigned int port) {
+    const auto endpoint = getEndpoint(port);
+    auto& first = *reactors.front();
+
+    if (reactors.size() == 1) {
+        first.acceptor = asio::ip::tcp::acceptor{first.service, endpoint};
+        return;
+    }
+
+#if defined(SO_REUSEPORT)
+    // Each reactor listens on the same port, the kernel balances the connections
+    reusePort = true;
+    for (auto& reactor : reactors) {
+        reactor->acceptor.open(endpoint.protocol());
+        reactor->acceptor.set_option(asio::ip::tcp::acceptor::reuse_address{true});
+        reactor->acceptor.set_option(ReusePort{true});
+        reactor->acceptor.bind(endpoint);
+        reactor->acceptor.listen();
+    }
+#else
+    // The first reactor accepts the connections and hands them out to the reactors in turns
+    first.acceptor = asio::ip::tcp::acceptor{first.service, endpoint};
+#endif
+}
+
+#ifndef _WIN32
+void Server::listen(const LocalEndpoint& endpoint) {
+    auto& first = *reactors.front();
+
+    // A socket file left behind by a previous run would fail the bind, the abstract names have no file.
+    // Only a socket that nobody listens on anymore is removed, never a live socket or another kind of file.
+    const auto path = endpoint.path();
+    const auto isFile = !path.empty() && path.front() != '\0';
+    struct stat st {};
+    if (isFile && ::lstat(path.c_str(), &st) == 0) {
+        if (!S_ISSOCK(st.st_mode)) {
+            throw std::runtime_error("The path of the socket is taken by another file");
+        }
+
+        asio::error_code ec;
+        asio::local::stream_protocol::socket probe{first.service};
+        probe.connect(endpoint, ec);
+        if (ec != asio::error::connection_refused) {
+            throw std::runtime_error("The socket is in use by another process");
+        }
+        ::unlink(path.c_str());
+    }
+
+    // The first reactor accepts the connections and hands them out to the reactors in turns
+    first.local = asio::local::stream_protocol::acceptor{first.service, endpoint};
+    if (isFile) {
+        localPath = path;
+    }
+}
+#endif
+
 void Server::start(bool async) {
-    accept();
+    for (auto& reactor : reactors) {
+        if (reactor->isListening()) {
+            accept(*reactor);
+        }
+    }
 
-    if (async) {
-        thread = std::thread([this]() { getIoService().run(); });
+    for (size_t i = 0; i < reactors.size(); i++) {
+        if (i > 0 || async) {
+            auto& reactor = *reactors[i];
+            reactor.thread = std::thread([&reactor]() { run(reactor); });
+        }
     }
 }
 
 void Server::stop() {
-    acceptor.close();
-    service.stop();
-    if (thread.joinable()) {
-        thread.join();
+    for (auto& reactor : reactors) {
+        reactor->work.reset();
+        reactor->service.stop();
     }
+
+    // The acceptors are re-armed by the reactors, close them once the reactors are done
+    for (auto& reactor : reactors) {
+        if (reactor->thread.joinable()) {
+            reactor->thread.join();
+        }
+        reactor->acceptor.close();
+#ifndef _WIN32
+        reactor->local.close();
+#endif
+    }
+
+#ifndef _WIN32
+    if (!localPath.empty()) {
+        ::unlink(localPath.c_str());
+        localPath.clear();
+    }
+#endif
+
+    // Closing the peers schedules the error callbacks of their pending requests, run them before leaving
+    for (const auto& peer : getConnectedPeers()) {
+        peer->close();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock{registry.mutex};
+        registry.peers.clear();
+    }
+
+    for (auto& reactor : reactors) {
+        reactor->service.restart();
+        reactor->service.poll();
+    }
+}
+
+void Server::run(Reactor& reactor) {
+    currentReactor = &reactor;
+    reactor.service.run();
+    currentReactor = nullptr;
 }
 
-void Server::accept() {
-    auto socket = std::make_shared<Socket>(service, ssl);
+void Server::accept(Reactor& reactor) {
+    auto& target =
+        reusePort || reactors.size() == 1 ? reactor : *reactors[nextReactor.fetch_add(1) % reactors.size()];
+
+#ifdef __linux__
+    if (reactor.local.is_open() && options.sharedMemory) {
+        accept(reactor, reactor.local, target,
+               std::make_shared<ShmTransport>(target.service, options.sharedMemoryBytes, options.sharedMemorySpin));
+        return;
+    }
+#endif
+
+#ifndef _WIN32
+    if (reactor.local.is_open()) {
+        accept(reactor, reactor.local, target, std::make_shared<UnixTransport>(target.service));
+        return;
+    }
+#endif
+
+    if (ssl) {
+        accept(reactor, reactor.acceptor, target, std::make_shared<TlsTransport>(target.service, *ssl));
+    } else {
+        accept(reactor, reactor.acceptor, target, std::make_shared<TcpTransport>(target.service));
+    }
+}
 
-    acceptor.async_accept(socket->lowest_layer(), [this, socket](const std::error_code ec) {
+template <typename Acceptor, typename T>
+void Server::accept(Reactor& reactor, Acceptor& acceptor, Reactor& target, const std::shared_ptr<T>& transport) {
+    auto& socket = transport->getSocket();
+    acceptor.async_accept(socket, [this, &reactor, &acceptor, &target, transport](const std::error_code ec) {
         if (ec) {
-            onError(ec);
+            // The accept cancelled by stop() is not an error of the server
+            if (ec != std::errc::operation_canceled) {
+                onError(ec);
+            }
         } else if (acceptor.is_open()) {
-            handshake(socket, std::make_shared<Peer>(*this, *this, service, socket));
+            auto peer = std::make_shared<Peer>(*this, *this, target.service, target.timers, transport, options);
+            handshake(transport, peer);
+        }
+
+        if (acceptor.is_open()) {
+            accept(reactor);
         }
     });
 }
 
-void Server::handshake(const std::shared_ptr<Socket>& socket, const std::shared_ptr<Peer>& peer) {
-    socket->async_handshake(asio::ssl::stream_base::server, [this, socket, peer](const std::error_code ec) {
+void Server::handshake(const std::shared_ptr<Transport>& transport, const std::shared_ptr<Peer>& peer) {
+    transport->handshake(true, [this, transport, peer](const asio::error_code& ec) {
         if (ec) {
             onError(peer, ec);
-            socket->lowest_layer().close();
+            transport->close();
         } else {
+            {
+                std::lock_guard<std::mutex> lock{registry.mutex};
+                registry.peers.emplace(peer.get(), peer);
+            }
+
+            peer->setCloseCallback([this](const std::shared_ptr<Peer>& closed) {
+                std::lock_guard<std::mutex> lock{registry.mutex};
+                registry.peers.erase(closed.get());
+            });
             peer->start();
             onAcceptSuccess(peer);
         }
     });
 }
 
+std::vector<std::shared_ptr<Peer>> Server::getConnectedPeers() const {
+    std::vector<std::shared_ptr<Peer>> peers;
+
+    std::lock_guard<std::mutex> lock{registry.mutex};
+    peers.reserve(registry.peers.size());
+    for (const auto& pair : registry.peers) {
+        peers.push_back(pair.second);
+    }
+
+    return peers;
+}
+
+size_t Server::getPeerCount() const {
+    std::lock_guard<std::mutex> lock{registry.mutex};
+    return registry.peers.size();
+}
+
 asio::ip::tcp::endpoint Server::getEndpoint(const unsigned int port) {
     return {asio::ip::tcp::v6(), static_cast<asio::ip::port_type>(port)};
 }
 
+Server::Reactor& Server::getCurrentReactor() {
+    for (auto& reactor : reactors) {
+        if (reactor.get() == currentReactor) {
+            return *reactor;
+        }
+    }
+    return *reactors.front();
+}
+
 void Server::postDispatch(std::function<void()> fn) {
-    service.post(std::forward<decltype(fn)>(fn));
+    getCurrentReactor().service.post(std::forward<decltype(fn)>(fn));
 }
 
 void Server::onAcceptSuccess(std::shared_ptr<Peer> peer) {
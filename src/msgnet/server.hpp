@@ -6,21 +6,47 @@
 #include "peer.hpp"
 #include "pkey.hpp"
 #include <thread>
+#include <unordered_map>
 
 namespace MsgNet {
 class MSGNET_API Server : public ErrorHandler, public Dispatcher {
 public:
-    using Socket = asio::ssl::stream<asio::ip::tcp::socket>;
-
     /**
-     * Construct a TCP server. The server won't start on its own. You must call start() method.
+     * Construct a TLS server. The server won't start on its own. You must call start() method.
+     * With Options::tls set to false the keys are not used and the server accepts plain TCP connections.
      *
      * @param port The port to start the server at.
      * @param pkey Private key;
      * @param ec Diffie-Hellman parameters.
      * @param cert Certificate for the private key.
+     * @param options Tuning options applied to every accepted peer.
+     */
+    Server(unsigned int port, const Pkey& pkey, const Dh& ec, const Cert& cert, const Options& options = {});
+
+    /**
+     * Construct a plain TCP server without TLS, for trusted networks only. The clients must connect
+     * with Options::tls set to false. The server won't start on its own. You must call start() method.
+     *
+     * @param port The port to start the server at.
+     * @param options Tuning options applied to every accepted peer.
+     */
+    explicit Server(unsigned int port, const Options& options = {});
+
+#ifndef _WIN32
+    /**
+     * Construct a server on a Unix domain socket, for the clients on the same host. The connections
+     * never use TLS, the access is controlled by the permissions of the socket file. A socket file
+     * left at the path is removed before the bind, and once the server stops.
+     * With more than one reactor, the first reactor accepts the connections and hands them out in turns.
+     * With Options::sharedMemory the messages go through the shared memory rings, see ShmTransport.
+     * The server won't start on its own. You must call start() method.
+     * A stale socket file at the path is removed, a live socket or any other file throws std::runtime_error.
+     *
+     * @param endpoint The path of the socket, or an abstract name starting with a null character.
+     * @param options Tuning options applied to every accepted peer.
      */
-    Server(unsigned int port, const Pkey& pkey, const Dh& ec, const Cert& cert);
+    explicit Server(const LocalEndpoint& endpoint, const Options& options = {});
+#endif
     ~Server();
 
     /**
@@ -28,6 +54,8 @@ public:
      * in its own thread and all handlers and request callbacks will be handled by this one thread.
      * If you wish to run the server in a thread pool, pass false into this function, and use getIoService()
      * to call asio::io_service::run method on it from each thread.
+     * With more than one reactor (see Options::reactors), the reactors other than the first one always
+     * run in their own threads, the async flag applies to the first reactor only.
      *
      * @note This function is non blocking! This has the exact same behavior as the Client::start() method.
      *
@@ -37,11 +65,21 @@ public:
 
     /**
      * Returns a asio io service that is used to run all reads and writes on the sockets.
+     * With more than one reactor, this is the io service of the first reactor.
      *
      * @return A reference to the underlying asio::io_service context.
      */
     asio::io_service& getIoService() {
-        return service;
+        return reactors.front()->service;
+    }
+
+    /**
+     * Returns the number of reactors of this server.
+     *
+     * @return The number of reactors, at least one.
+     */
+    size_t getReactorCount() const {
+        return reactors.size();
     }
 
     /**
@@ -50,6 +88,62 @@ public:
      */
     void stop();
 
+    /**
+     * Returns a snapshot of the connected peers. The peers are added once the handshake
+     * completes, and removed once they disconnect.
+     *
+     * @return The connected peers, in no particular order.
+     */
+    std::vector<std::shared_ptr<Peer>> getConnectedPeers() const;
+
+    /**
+     * Returns the number of the connected peers.
+     *
+     * @return The number of peers.
+     */
+    size_t getPeerCount() const;
+
+    /**
+     * Send some message to all connected peers. The message is packed only once,
+     * the same bytes are then compressed by each peer.
+     *
+     * @tparam Req The type of the message to send. This is auto deduced from the parameter.
+     * @param message The message to send to the peers.
+     * @return The number of peers the message was sent to.
+     */
+    template <typename Req> size_t broadcast(const Req& message) {
+        return broadcast(message, [](const std::shared_ptr<Peer>& /*peer*/) { return true; });
+    }
+
+    /**
+     * Send some message to the connected peers accepted by the filter. The message is packed only once,
+     * the same bytes are then compressed by each peer.
+     *
+     * @code
+     * server.broadcast(msg, [&](const std::shared_ptr<Peer>& peer) { return peer != sender; });
+     * @endcode
+     *
+     * @tparam Req The type of the message to send. This is auto deduced from the parameter.
+     * @tparam Filter The type of the filter function. This is auto deduced from the parameter.
+     * @param message The message to send to the peers.
+     * @param filter Returns true for the peers that should receive the message.
+     * @return The number of peers the message was sent to.
+     */
+    template <typename Req, typename Filter> size_t broadcast(const Req& message, Filter filter) {
+        msgpack::sbuffer buffer;
+        Peer::pack(buffer, message, 0, false);
+
+        size_t count = 0;
+        for (const auto& peer : getConnectedPeers()) {
+            if (filter(peer)) {
+                peer->sendPacked(buffer.data(), buffer.size());
+                count++;
+            }
+        }
+
+        return count;
+    }
+
 protected:
     /**
      * This function is executed every time there is some work to be done.
@@ -58,6 +152,8 @@ protected:
      * If you wish to use multiple threads, one for network I/O and one (or more) for handling the messages,
      * you can override this function and forward the function fn to any thread you wish to use.
      * This could also be used to synchronize with the main thread (rendering thread in a game, for example).
+     * The default implementation posts the work to the reactor of the calling thread, so the work of a peer
+     * stays on the reactor of the peer.
      *
      * @param fn The function that wraps the work needed to execute some handler or some callback request function.
      */
@@ -65,21 +161,60 @@ protected:
 
     /**
      * Called every time a new peer is connected to the server.
-     * This is called after the TLS handshake has been completed.
+     * This is called after the handshake has been completed.
      *
      * @param peer Shared pointer to the peer.
      */
     virtual void onAcceptSuccess(std::shared_ptr<Peer> peer);
 
 private:
+    struct Reactor {
+        Reactor() : timers{service}, acceptor{service} {
+        }
+
+        asio::io_service service;
+        std::unique_ptr<asio::io_service::work> work;
+        TimerWheel timers;
+        asio::ip::tcp::acceptor acceptor;
+#ifndef _WIN32
+        asio::local::stream_protocol::acceptor local{service};
+#endif
+        std::thread thread;
+
+        bool isListening() const {
+#ifndef _WIN32
+            if (local.is_open()) {
+                return true;
+            }
+#endif
+            return acceptor.is_open();
+        }
+    };
+
     static asio::ip::tcp::endpoint getEndpoint(unsigned int port);
+    static void run(Reactor& reactor);
+
+    void createReactors();
+    void listen(unsigned int port);
+#ifndef _WIN32
+    void listen(const LocalEndpoint& endpoint);
+#endif
+    void accept(Reactor& reactor);
+    template <typename Acceptor, typename T>
+    void accept(Reactor& reactor, Acceptor& acceptor, Reactor& target, const std::shared_ptr<T>& transport);
+    void handshake(const std::shared_ptr<Transport>& transport, const std::shared_ptr<Peer>& peer);
+    Reactor& getCurrentReactor();
 
-    void accept();
-    void handshake(const std::shared_ptr<Socket>& socket, const std::shared_ptr<Peer>& peer);
+    Options options;
+    std::vector<std::unique_ptr<Reactor>> reactors;
+    bool reusePort{false};
+    std::atomic_size_t nextReactor{0};
+    std::unique_ptr<asio::ssl::context> ssl;
+    std::string localPath;
 
-    asio::io_service service;
-    asio::ssl::context ssl;
-    asio::ip::tcp::acceptor acceptor;
-    std::thread thread;
+    struct {
+        mutable std::mutex mutex;
+        std::unordered_map<const Peer*, std::shared_ptr<Peer>> peers;
+    } registry;
 };
 } // namespace MsgNet
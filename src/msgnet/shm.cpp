@@ -0,0 +1,525 @@
+#include "shm.hpp"
+
+#ifdef __linux__
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace MsgNet;
+
+static constexpr uint64_t regionMagic = 0x6d73676e65747368ULL;
+static constexpr size_t cacheLine = 64;
+static constexpr size_t descriptorCount = 5;
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "The rings require lock free atomics");
+
+// The positions only ever grow, the offset in the ring is the position modulo the capacity.
+// A side that runs out of the data (or the space) raises its flag and waits for the eventfd.
+struct ShmTransport::Ring {
+    alignas(cacheLine) std::atomic<uint64_t> head;
+    alignas(cacheLine) std::atomic<uint64_t> tail;
+    alignas(cacheLine) std::atomic<uint32_t> readerWaiting;
+    std::atomic<uint32_t> writerWaiting;
+};
+
+// The first ring carries the bytes from the connecting side to the accepting side
+struct ShmTransport::Region {
+    uint64_t magic;
+    uint64_t capacity;
+    Ring rings[2];
+};
+
+size_t ShmTransport::getDataOffset() {
+    return (sizeof(ShmTransport::Region) + cacheLine - 1) / cacheLine * cacheLine;
+}
+
+ShmTransport::ShmTransport(asio::io_service& service, const size_t capacity, const std::chrono::microseconds spin) :
+    socket{service}, capacity{0}, spinTime{spin}, incoming{service}, outgoing{service} {
+
+    // Power of two, the offsets in the ring are then only masked
+    this->capacity = 4096;
+    while (this->capacity < capacity) {
+        this->capacity *= 2;
+    }
+}
+
+ShmTransport::~ShmTransport() {
+    if (region) {
+        munmap(region, regionBytes);
+    }
+}
+
+void ShmTransport::handshake(const bool server, HandshakeHandler handler) {
+    if (!server) {
+        asio::error_code ec;
+        create(ec);
+        asio::post(socket.get_executor(), [handler = std::move(handler), ec]() { handler(ec); });
+        return;
+    }
+
+    // The region and the eventfds arrive as the first message of the socket
+    auto self = shared_from_this();
+    socket.async_wait(Socket::wait_read, [self, handler = std::move(handler)](asio::error_code ec) {
+        if (!ec) {
+            self->receive(ec);
+        }
+        handler(ec);
+    });
+}
+
+void ShmTransport::create(asio::error_code& ec) {
+    regionBytes = getDataOffset() + capacity * 2;
+
+    int fds[descriptorCount] = {-1, -1, -1, -1, -1};
+    const auto cleanup = [&]() {
+        for (const auto fd : fds) {
+            if (fd >= 0) {
+                ::close(fd);
+            }
+        }
+    };
+
+    // The size is sealed, the accepting side must not be able to find the region cut under its mapping
+    fds[0] = memfd_create("msgnet", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fds[0] < 0 || ftruncate(fds[0], static_cast<off_t>(regionBytes)) != 0 ||
+        fcntl(fds[0], F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) != 0) {
+        ec = asio::error_code{errno, asio::error::get_system_category()};
+        cleanup();
+        return;
+    }
+
+    for (size_t i = 1; i < descriptorCount; i++) {
+        fds[i] = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if (fds[i] < 0) {
+            ec = asio::error_code{errno, asio::error::get_system_category()};
+            cleanup();
+            return;
+        }
+    }
+
+    auto* address = mmap(nullptr, regionBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fds[0], 0);
+    if (address == MAP_FAILED) {
+        ec = asio::error_code{errno, asio::error::get_system_category()};
+        cleanup();
+        return;
+    }
+
+    auto* header = new (address) Region{};
+    header->magic = regionMagic;
+    header->capacity = capacity;
+
+    // Hand everything over to the accepting side, the descriptors are duplicated by the kernel
+    char byte = 0;
+    iovec iov{&byte, 1};
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(fds))];
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    auto* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    std::memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    if (sendmsg(socket.native_handle(), &msg, MSG_NOSIGNAL) != 1) {
+        ec = asio::error_code{errno, asio::error::get_system_category()};
+        munmap(address, regionBytes);
+        cleanup();
+        return;
+    }
+
+    ::close(fds[0]);
+    incoming.ready.assign(fds[3]);
+    incoming.space.assign(fds[4]);
+    outgoing.ready.assign(fds[1]);
+    outgoing.space.assign(fds[2]);
+    attach(address, regionBytes, false);
+}
+
+// Closes the descriptors of a rejected handshake, however many the other side has sent
+static void discard(msghdr& msg) {
+    for (auto* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+            continue;
+        }
+
+        const auto count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (size_t i = 0; i < count; i++) {
+            int fd;
+            std::memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(fd));
+            ::close(fd);
+        }
+    }
+}
+
+void ShmTransport::receive(asio::error_code& ec) {
+    int fds[descriptorCount] = {-1, -1, -1, -1, -1};
+    const auto cleanup = [&]() {
+        for (const auto fd : fds) {
+            if (fd >= 0) {
+                ::close(fd);
+            }
+        }
+    };
+
+    char byte = 0;
+    iovec iov{&byte, 1};
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(fds))];
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    const auto length = recvmsg(socket.native_handle(), &msg, MSG_CMSG_CLOEXEC);
+    if (length < 0) {
+        ec = asio::error_code{errno, asio::error::get_system_category()};
+        return;
+    }
+
+    const auto* cmsg = CMSG_FIRSTHDR(&msg);
+    if (length == 0 || !cmsg || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS ||
+        cmsg->cmsg_len != CMSG_LEN(sizeof(fds)) || (msg.msg_flags & MSG_CTRUNC) != 0) {
+        ec = asio::error::invalid_argument;
+        discard(msg);
+        return;
+    }
+    std::memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+
+    // The other side decides the size of the rings, it must match the size of the region. A region that
+    // can still shrink would fault on the next access of the ring.
+    struct stat st {};
+    const auto seals = fcntl(fds[0], F_GET_SEALS);
+    if (seals < 0 || (seals & F_SEAL_SHRINK) == 0 || fstat(fds[0], &st) != 0 ||
+        static_cast<size_t>(st.st_size) <= getDataOffset()) {
+        ec = asio::error::invalid_argument;
+        cleanup();
+        return;
+    }
+
+    const auto size = static_cast<size_t>(st.st_size);
+    auto* address = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fds[0], 0);
+    if (address == MAP_FAILED) {
+        ec = asio::error_code{errno, asio::error::get_system_category()};
+        cleanup();
+        return;
+    }
+
+    const auto* header = static_cast<const Region*>(address);
+    const auto ringBytes = header->capacity;
+    if (header->magic != regionMagic || ringBytes == 0 || (ringBytes & (ringBytes - 1)) != 0 ||
+        getDataOffset() + ringBytes * 2 != size) {
+        ec = asio::error::invalid_argument;
+        munmap(address, size);
+        cleanup();
+        return;
+    }
+
+    ::close(fds[0]);
+    capacity = ringBytes;
+    incoming.ready.assign(fds[1]);
+    incoming.space.assign(fds[2]);
+    outgoing.ready.assign(fds[3]);
+    outgoing.space.assign(fds[4]);
+    attach(address, size, true);
+}
+
+void ShmTransport::attach(void* address, const size_t size, const bool server) {
+    region = address;
+    regionBytes = size;
+
+    auto* header = static_cast<Region*>(address);
+    auto* data = static_cast<char*>(address) + getDataOffset();
+
+    incoming.ring = &header->rings[server ? 0 : 1];
+    incoming.data = data + (server ? 0 : capacity);
+    outgoing.ring = &header->rings[server ? 1 : 0];
+    outgoing.data = data + (server ? capacity : 0);
+}
+
+void ShmTransport::configure() {
+    // Nothing is sent over the socket anymore, it only becomes readable once the other side goes away
+    auto self = shared_from_this();
+    socket.async_wait(Socket::wait_read, [self](const asio::error_code ec) {
+        // Closed by this side, close() has already cancelled the waiting operations
+        if (ec == asio::error::operation_aborted) {
+            return;
+        }
+
+        self->remoteClosed.store(true);
+
+        // Wake up this side, the waiting operations find out on their own
+        signal(self->incoming.ready);
+        signal(self->outgoing.space);
+    });
+}
+
+size_t ShmTransport::read(const asio::mutable_buffer buffer, asio::error_code& ec) {
+    ec = {};
+    if (closed.load()) {
+        ec = asio::error::operation_aborted;
+        return 0;
+    }
+
+    auto& ring = *incoming.ring;
+    const auto tail = readPosition;
+    const auto head = ring.head.load(std::memory_order_acquire);
+
+    // The other side must never get ahead of this one by more than the ring, nor fall behind it
+    if (head - tail > capacity) {
+        corrupted(ec);
+        return 0;
+    }
+
+    const auto available = static_cast<size_t>(head - tail);
+    if (available == 0) {
+        // The bytes written before the other side went away are still read
+        if (remoteClosed.load()) {
+            ec = asio::error::eof;
+        } else {
+            ec = asio::error::would_block;
+        }
+        return 0;
+    }
+
+    const auto length = std::min(available, buffer.size());
+    const auto offset = static_cast<size_t>(tail & (capacity - 1));
+    const auto first = std::min(length, capacity - offset);
+
+    auto* dst = static_cast<char*>(buffer.data());
+    std::memcpy(dst, incoming.data + offset, first);
+    std::memcpy(dst + first, incoming.data, length - first);
+
+    readPosition = tail + length;
+    ring.tail.store(readPosition, std::memory_order_seq_cst);
+    if (ring.writerWaiting.load(std::memory_order_seq_cst) && ring.writerWaiting.exchange(0)) {
+        signal(incoming.space);
+    }
+
+    return length;
+}
+
+void ShmTransport::asyncRead(Strand& strand, const asio::mutable_buffer buffer, Handler handler) {
+    read(strand, buffer, std::move(handler), false);
+}
+
+void ShmTransport::read(Strand& strand, const asio::mutable_buffer buffer, Handler handler, const bool posted) {
+    auto& ring = *incoming.ring;
+
+    for (;;) {
+        asio::error_code ec;
+        const auto length = read(buffer, ec);
+
+        if (ec != asio::error::would_block) {
+            if (posted) {
+                handler(ec, length);
+            } else {
+                asio::post(strand, [handler = std::move(handler), ec, length]() mutable { handler(ec, length); });
+            }
+            return;
+        }
+
+        if (spin(ring)) {
+            continue;
+        }
+
+        // Either the writer sees the flag, or this sees the bytes written meanwhile
+        ring.readerWaiting.store(1, std::memory_order_seq_cst);
+        if (ring.head.load(std::memory_order_seq_cst) != readPosition || remoteClosed.load()) {
+            ring.readerWaiting.store(0);
+            continue;
+        }
+        break;
+    }
+
+    auto self = shared_from_this();
+    incoming.ready.async_wait(
+        asio::posix::stream_descriptor::wait_read,
+        asio::bind_executor(strand, [self, &strand, buffer, handler = std::move(handler)](
+                                        const asio::error_code ec) mutable {
+            if (ec) {
+                handler(ec, 0);
+                return;
+            }
+            reset(self->incoming.ready);
+            self->read(strand, buffer, std::move(handler), true);
+        }));
+}
+
+bool ShmTransport::spin(const Ring& ring) const {
+    if (spinTime.count() == 0) {
+        return false;
+    }
+
+    const auto deadline = std::chrono::steady_clock::now() + spinTime;
+    do {
+        if (ring.head.load(std::memory_order_acquire) != readPosition || remoteClosed.load()) {
+            return true;
+        }
+    } while (std::chrono::steady_clock::now() < deadline);
+
+    return false;
+}
+
+void ShmTransport::asyncWrite(Strand& strand, const std::vector<asio::const_buffer>& buffers, Handler handler) {
+    pending.buffers.assign(buffers.begin(), buffers.end());
+    pending.index = 0;
+    pending.offset = 0;
+    pending.total = 0;
+    pending.handler = std::move(handler);
+
+    write(strand, false);
+}
+
+size_t ShmTransport::write(asio::error_code& ec) {
+    ec = {};
+    if (closed.load()) {
+        ec = asio::error::operation_aborted;
+        return 0;
+    }
+    if (remoteClosed.load()) {
+        ec = asio::error::broken_pipe;
+        return 0;
+    }
+
+    auto& ring = *outgoing.ring;
+    auto head = writePosition;
+    const auto used = head - ring.tail.load(std::memory_order_acquire);
+    if (used > capacity) {
+        corrupted(ec);
+        return 0;
+    }
+
+    auto space = capacity - static_cast<size_t>(used);
+    size_t written = 0;
+
+    // As many of the gathered buffers as fit, published at once
+    while (space > 0 && pending.index < pending.buffers.size()) {
+        const auto& b = pending.buffers[pending.index];
+        const auto length = std::min(b.size() - pending.offset, space);
+        const auto offset = static_cast<size_t>(head & (capacity - 1));
+        const auto first = std::min(length, capacity - offset);
+
+        const auto* src = static_cast<const char*>(b.data()) + pending.offset;
+        std::memcpy(outgoing.data + offset, src, first);
+        std::memcpy(outgoing.data, src + first, length - first);
+
+        head += length;
+        space -= length;
+        written += length;
+        pending.offset += length;
+        if (pending.offset == b.size()) {
+            pending.index++;
+            pending.offset = 0;
+        }
+    }
+
+    if (written > 0) {
+        writePosition = head;
+        ring.head.store(head, std::memory_order_seq_cst);
+        if (ring.readerWaiting.load(std::memory_order_seq_cst) && ring.readerWaiting.exchange(0)) {
+            signal(outgoing.ready);
+        }
+    }
+
+    return written;
+}
+
+void ShmTransport::write(Strand& strand, const bool posted) {
+    auto& ring = *outgoing.ring;
+
+    for (;;) {
+        asio::error_code ec;
+        pending.total += write(ec);
+
+        if (ec || pending.index == pending.buffers.size()) {
+            auto handler = std::move(pending.handler);
+            const auto total = pending.total;
+            if (posted) {
+                handler(ec, total);
+            } else {
+                asio::post(strand, [handler = std::move(handler), ec, total]() mutable { handler(ec, total); });
+            }
+            return;
+        }
+
+        // Either the reader sees the flag, or this sees the space freed meanwhile
+        ring.writerWaiting.store(1, std::memory_order_seq_cst);
+        // Anything but a full ring goes back to the write, which also rejects a corrupted position
+        const auto used = writePosition - ring.tail.load(std::memory_order_seq_cst);
+        if (used != capacity || remoteClosed.load()) {
+            ring.writerWaiting.store(0);
+            continue;
+        }
+        break;
+    }
+
+    auto self = shared_from_this();
+    outgoing.space.async_wait(asio::posix::stream_descriptor::wait_read,
+                              asio::bind_executor(strand, [self, &strand](const asio::error_code ec) {
+                                  if (ec) {
+                                      auto handler = std::move(self->pending.handler);
+                                      handler(ec, self->pending.total);
+                                      return;
+                                  }
+                                  reset(self->outgoing.space);
+                                  self->write(strand, true);
+                              }));
+}
+
+bool ShmTransport::isFullDuplex() const {
+    // Each direction has its own ring
+    return true;
+}
+
+void ShmTransport::close() {
+    closed.store(true);
+
+    // The pending operations complete with an error, the other side sees the socket closed
+    asio::error_code ec;
+    socket.close(ec);
+    incoming.ready.cancel(ec);
+    incoming.space.cancel(ec);
+    outgoing.ready.cancel(ec);
+    outgoing.space.cancel(ec);
+}
+
+void ShmTransport::corrupted(asio::error_code& ec) {
+    // Nothing in the ring can be trusted anymore, the connection is over
+    ec = asio::error_code{EPROTO, asio::error::get_system_category()};
+    close();
+}
+
+bool ShmTransport::isOpen() const {
+    return !closed.load() && !remoteClosed.load() && socket.is_open();
+}
+
+std::string ShmTransport::getAddress() const {
+    asio::error_code ec;
+    auto endpoint = socket.remote_endpoint(ec);
+    if (!ec && endpoint.path().empty()) {
+        endpoint = socket.local_endpoint(ec);
+    }
+    return ec ? std::string{} : "shm:" + toString(endpoint);
+}
+
+void ShmTransport::signal(asio::posix::stream_descriptor& event) {
+    if (event.is_open()) {
+        const uint64_t one = 1;
+        (void)::write(event.native_handle(), &one, sizeof(one));
+    }
+}
+
+void ShmTransport::reset(asio::posix::stream_descriptor& event) {
+    uint64_t value = 0;
+    (void)::read(event.native_handle(), &value, sizeof(value));
+}
+#endif
@@ -0,0 +1,117 @@
+#pragma once
+
+#include "transport.hpp"
+
+#ifdef __linux__
+#include <atomic>
+#include <chrono>
+
+namespace MsgNet {
+/**
+ * A transport between two processes of the same host over a shared memory region with a pair of
+ * single producer, single consumer byte rings, one for each direction. The bytes written by the peer
+ * are copied into the ring and read by the other process straight out of it, there are no syscalls
+ * while both sides keep up with each other. An eventfd is signaled only when the other side is waiting
+ * for the data, or for a free space in the ring.
+ *
+ * The connection starts as a Unix domain socket. The connecting side creates the region (a memfd sealed
+ * against resizing) and the eventfds and passes them over the socket. The socket is then kept open only
+ * to find out when the other process goes away. See Options::sharedMemory.
+ *
+ * The positions in the region are written by the other process and are checked on every access,
+ * a ring that does not add up fails the operation with EPROTO and closes the transport.
+ */
+class MSGNET_API ShmTransport : public Transport, public std::enable_shared_from_this<ShmTransport> {
+public:
+    using Socket = asio::local::stream_protocol::socket;
+
+    /**
+     * @param service The io service of the peer.
+     * @param capacity Size of each of the rings in bytes, rounded up to the power of two.
+     * Used only by the connecting side, the accepting side gets the size from the region.
+     * @param spin How long the reads poll the ring before waiting for the eventfd.
+     */
+    ShmTransport(asio::io_service& service, size_t capacity, std::chrono::microseconds spin);
+    ~ShmTransport();
+
+    /**
+     * Returns the Unix domain socket, the socket to connect or to accept into.
+     *
+     * @return The socket.
+     */
+    Socket& getSocket() {
+        return socket;
+    }
+
+    /**
+     * Returns the size of each of the rings, once the handshake is done.
+     *
+     * @return The size of the ring in bytes.
+     */
+    size_t getCapacity() const {
+        return capacity;
+    }
+
+    void handshake(bool server, HandshakeHandler handler) override;
+    void configure() override;
+    void asyncRead(Strand& strand, asio::mutable_buffer buffer, Handler handler) override;
+    size_t read(asio::mutable_buffer buffer, asio::error_code& ec) override;
+    void asyncWrite(Strand& strand, const std::vector<asio::const_buffer>& buffers, Handler handler) override;
+    bool isFullDuplex() const override;
+    void close() override;
+    bool isOpen() const override;
+    std::string getAddress() const override;
+
+private:
+    struct Ring;
+    struct Region;
+
+    // One direction of the connection, as seen by this process
+    struct Channel {
+        explicit Channel(asio::io_service& service) : ready{service}, space{service} {
+        }
+
+        Ring* ring{nullptr};
+        char* data{nullptr};
+        asio::posix::stream_descriptor ready;
+        asio::posix::stream_descriptor space;
+    };
+
+    static size_t getDataOffset();
+
+    void create(asio::error_code& ec);
+    void receive(asio::error_code& ec);
+    void attach(void* address, size_t size, bool server);
+    size_t write(asio::error_code& ec);
+    void read(Strand& strand, asio::mutable_buffer buffer, Handler handler, bool posted);
+    void write(Strand& strand, bool posted);
+    bool spin(const Ring& ring) const;
+    void corrupted(asio::error_code& ec);
+    static void signal(asio::posix::stream_descriptor& event);
+    static void reset(asio::posix::stream_descriptor& event);
+
+    Socket socket;
+    size_t capacity;
+    std::chrono::microseconds spinTime;
+    void* region{nullptr};
+    size_t regionBytes{0};
+    Channel incoming;
+    Channel outgoing;
+    std::atomic_bool closed{false};
+    std::atomic_bool remoteClosed{false};
+
+    // The own positions in the rings, the copies in the region can be overwritten by the other side
+    uint64_t readPosition{0};
+    uint64_t writePosition{0};
+
+    // The peer has only one write in flight at the time
+    struct {
+        std::vector<asio::const_buffer> buffers;
+        size_t index{0};
+        size_t offset{0};
+        size_t total{0};
+        Handler handler;
+    } pending;
+};
+} // namespace MsgNet
+#endif
@@ -1,28 +1,103 @@
 #include "stream.hpp"
+#include <array>
+#include <cmath>
 #include <cstring>
 #include <lz4.h>
+#include <lz4hc.h>
 
 using namespace MsgNet;
 
+// The LZ4 window size, how much of the previously decompressed data a block may refer to
+static const size_t historyBytes = 64 * 1024;
+
+// How many compressed blocks fit into the receive staging buffer
+static const size_t stagingBlocks = 4;
+
+// Set in the block header when the block is stored uncompressed, the rest is the block length
+static const uint32_t storedFlag = 0x80000000U;
+
+// How many bytes of a block are sampled to estimate its entropy, smaller blocks are not
+// worth the estimate, LZ4 gives up on them quickly on its own
+static const size_t entropySamples = 512;
+static const size_t entropyMinBytes = 1024;
+
+// The stream preamble: magic, version, codec type, codec acceleration or level, block size
+static const size_t preambleBytes = 12;
+static const uint32_t preambleMagic = 0x54454e4dU; // "MNET"
+static const uint8_t preambleVersion = 1;
+
+// The range of the supported block sizes
+static const size_t minCodecBlockBytes = 1024;
+static const size_t maxCodecBlockBytes = 1024 * 1024 * 4;
+
+// The acceleration and the level are sent in the preamble as 16 bits
+static const int minCodecAcceleration = 1;
+static const int maxCodecAcceleration = 0xffff;
+static const int minCodecLevel = 3;
+static const int maxCodecLevel = 12;
+
 struct CompressionStream::LZ4 {
-    LZ4() {
-        LZ4_initStream(lz4Stream, sizeof(*lz4Stream));
+    explicit LZ4(const Codec& codec) {
+        if (codec.type == Codec::Type::Lz4Hc) {
+            lz4StreamHC = std::make_unique<LZ4_streamHC_t>();
+            LZ4_initStreamHC(lz4StreamHC.get(), sizeof(*lz4StreamHC));
+            LZ4_resetStreamHC_fast(lz4StreamHC.get(), codec.level);
+        } else {
+            LZ4_initStream(lz4Stream, sizeof(*lz4Stream));
+        }
     }
 
     LZ4_stream_t lz4StreamBody{};
     LZ4_stream_t* lz4Stream = &lz4StreamBody;
+    std::unique_ptr<LZ4_streamHC_t> lz4StreamHC;
 };
 
-CompressionStream::CompressionStream(const size_t blockBytes) :
-    lz4{std::make_unique<LZ4>()}, idx{0}, offset{0}, buffers{nullptr, nullptr} {
-    raw.resize(blockBytes * 2);
+CompressionStream::CompressionStream(const size_t blockBytes, const size_t maxPooledBlocks) :
+    CompressionStream{Codec{Codec::Type::Lz4, 1, 9, blockBytes}, maxPooledBlocks} {
+}
+
+CompressionStream::CompressionStream(const Codec& codec, const size_t maxPooledBlocks) :
+    codec{codec},
+    lz4{std::make_unique<LZ4>(codec)},
+    pool{maxPooledBlocks},
+    idx{0},
+    offset{0},
+    buffers{nullptr, nullptr},
+    preambleSent{false},
+    minBytes{Codec::defaultMinBytes},
+    maxEntropy{Codec::defaultMaxEntropy},
+    stored{0},
+    referenced{0} {
+
+    if (codec.blockBytes < minCodecBlockBytes || codec.blockBytes > maxCodecBlockBytes) {
+        throw std::runtime_error("Codec block size is out of range");
+    }
+    if (codec.type == Codec::Type::Lz4 &&
+        (codec.acceleration < minCodecAcceleration || codec.acceleration > maxCodecAcceleration)) {
+        throw std::runtime_error("Codec acceleration is out of range");
+    }
+    if (codec.type == Codec::Type::Lz4Hc && (codec.level < minCodecLevel || codec.level > maxCodecLevel)) {
+        throw std::runtime_error("Codec level is out of range");
+    }
+
+    raw.resize(codec.blockBytes * 2);
     buffers[0] = raw.data();
-    buffers[1] = raw.data() + blockBytes;
+    buffers[1] = raw.data() + codec.blockBytes;
 }
 
 CompressionStream::~CompressionStream() = default;
 
 void MsgNet::CompressionStream::write(const char* src, size_t length) {
+    // Large attachments that would be stored anyway skip the copy
+    if (length >= codec.blockBytes) {
+        const auto* attachment = Attachment::getPacking();
+        if (attachment && attachment->data() == src && attachment->size() == length && attachment->getOwner() &&
+            isBypassed(src, length)) {
+            writeReference(*attachment);
+            return;
+        }
+    }
+
     while (length > 0) {
         if (offset + length > raw.size() / 2) {
             flush();
@@ -41,36 +116,188 @@ void MsgNet::CompressionStream::write(const char* src, size_t length) {
     }
 }
 
+/**
+ * Estimates the Shannon entropy of the data from evenly spread samples.
+ *
+ * @param src The data.
+ * @param length Length of the data.
+ * @return The entropy in bits per byte.
+ */
+static float estimateEntropy(const char* src, const size_t length) {
+    // The entropy is log2(n) - sum(c * log2(c)) / n, the c * log2(c) terms are precomputed
+    static const auto table = []() {
+        std::array<float, entropySamples + 1> result{};
+        for (size_t c = 1; c < result.size(); c++) {
+            result[c] = static_cast<float>(c) * std::log2(static_cast<float>(c));
+        }
+        return result;
+    }();
+
+    uint16_t counts[256] = {};
+
+    const auto step = std::max<size_t>(1, length / entropySamples);
+    size_t total = 0;
+    for (size_t i = 0; i < length && total < entropySamples; i += step, total++) {
+        counts[static_cast<uint8_t>(src[i])]++;
+    }
+
+    float sum = 0.0f;
+    for (const auto count : counts) {
+        sum += table[count];
+    }
+
+    return table[total] / static_cast<float>(total) - sum / static_cast<float>(total);
+}
+
+bool MsgNet::CompressionStream::isBypassed(const char* src, const size_t length) const {
+    return codec.type == Codec::Type::None || (maxEntropy < 8.0f && estimateEntropy(src, length) > maxEntropy);
+}
+
+void MsgNet::CompressionStream::writeReference(const Attachment& attachment) {
+    // The bytes packed before the attachment go first
+    flush();
+
+    // LZ4 does not see these blocks, same as the blocks bypassed by the entropy estimate
+    if (codec.type != Codec::Type::None) {
+        resetStream();
+    }
+
+    auto* src = attachment.data();
+    auto length = attachment.size();
+
+    while (length > 0) {
+        const auto size = std::min(length, codec.blockBytes);
+        auto header = acquireBlock(static_cast<uint32_t>(size) | storedFlag, 0);
+
+        stored.fetch_add(1, std::memory_order_relaxed);
+        referenced.fetch_add(size, std::memory_order_relaxed);
+
+        sendReference(std::move(header), attachment.getOwner(), src, size);
+
+        src += size;
+        length -= size;
+    }
+}
+
+void MsgNet::CompressionStream::sendReference(std::shared_ptr<std::vector<char>> header,
+                                              std::shared_ptr<const void> owner, const char* data,
+                                              const size_t size) {
+    (void)owner;
+    header->insert(header->end(), data, data + size);
+    sendBuffer(std::move(header));
+}
+
+std::shared_ptr<std::vector<char>> MsgNet::CompressionStream::acquireBlock(const uint32_t header,
+                                                                            const size_t length) {
+    const auto extra = preambleSent ? 0 : preambleBytes;
+
+    // Take a buffer from the pool, recycled buffers keep the capacity of the largest block they have carried
+    auto buffer = pool.acquire();
+    buffer->resize(extra + sizeof(uint32_t) + length);
+
+    // The very first buffer starts with the preamble
+    if (!preambleSent) {
+        const auto level = static_cast<uint16_t>(codec.type == Codec::Type::Lz4Hc ? codec.level : codec.acceleration);
+        const auto blockBytes = static_cast<uint32_t>(codec.blockBytes);
+        auto* dst = buffer->data();
+        std::memcpy(dst, &preambleMagic, sizeof(preambleMagic));
+        dst[4] = static_cast<char>(preambleVersion);
+        dst[5] = static_cast<char>(codec.type);
+        std::memcpy(dst + 6, &level, sizeof(level));
+        std::memcpy(dst + 8, &blockBytes, sizeof(blockBytes));
+        preambleSent = true;
+    }
+
+    // The header (length needed for decompression), the data follows
+    std::memcpy(buffer->data() + extra, &header, sizeof(header));
+    return buffer;
+}
+
+void MsgNet::CompressionStream::setBypass(const size_t minBytes, const float maxEntropy) {
+    this->minBytes = minBytes;
+    this->maxEntropy = maxEntropy;
+}
+
 void MsgNet::CompressionStream::flush() {
-    auto compressed = std::make_shared<std::vector<char>>();
-    const auto compressBound = LZ4_COMPRESSBOUND(raw.size() / 2);
+    if (offset == 0) {
+        return;
+    }
+
+    std::shared_ptr<std::vector<char>> buffer;
+    auto header = static_cast<uint32_t>(offset) | storedFlag;
+
+    if (codec.type == Codec::Type::None) {
+        // Always stored
+    } else if (offset >= minBytes && (maxEntropy >= 8.0f || offset < entropyMinBytes ||
+                                      estimateEntropy(buffers[idx], offset) <= maxEntropy)) {
+        // Compressed straight into the block, the block is then trimmed to the compressed size
+        const auto bound = static_cast<size_t>(LZ4_COMPRESSBOUND(offset));
+        buffer = acquireBlock(0, bound);
+        auto* dst = buffer->data() + buffer->size() - bound;
+        const auto cmpBytes = compress(dst, bound);
+
+        // Store the block if the compression did not pay off. The block is already part of
+        // the LZ4 history, the decompression stream appends the stored block to its history too.
+        if (cmpBytes > 0 && static_cast<size_t>(cmpBytes) < offset) {
+            header = static_cast<uint32_t>(cmpBytes);
+        } else {
+            std::memcpy(dst, buffers[idx], offset);
+        }
+
+        std::memcpy(dst - sizeof(header), &header, sizeof(header));
+        buffer->resize(buffer->size() - bound + (header & ~storedFlag));
+    } else {
+        // LZ4 has not seen this block. The next block must not refer to the data before it,
+        // because the compressor would count the offsets without this block.
+        resetStream();
+    }
 
-    compressed->resize(sizeof(uint32_t) + compressBound);
-    const auto cmpBuf = compressed->data() + sizeof(uint32_t);
+    // The header followed by the data
+    if (!buffer) {
+        buffer = acquireBlock(header, offset);
+        std::memcpy(buffer->data() + buffer->size() - offset, buffers[idx], offset);
+    }
 
-    const uint32_t cmpBytes = LZ4_compress_fast_continue(lz4->lz4Stream,                  // Stream
-                                                         buffers[idx],                    // Source uncompressed data
-                                                         cmpBuf,                          // Destination compressed data
-                                                         static_cast<int>(offset),        // Source data length
-                                                         static_cast<int>(compressBound), // Destination buffer length
-                                                         1);
+    if (header & storedFlag) {
+        stored.fetch_add(1, std::memory_order_relaxed);
+    }
 
     // Reset for the next iteration
     offset = 0;
     idx = (idx + 1) % 2;
 
-    if (cmpBytes == 0) {
-        return;
+    // Send out the buffer
+    sendBuffer(std::move(buffer));
+}
+
+int MsgNet::CompressionStream::compress(char* dst, const size_t capacity) {
+    if (codec.type == Codec::Type::Lz4Hc) {
+        return LZ4_compress_HC_continue(lz4->lz4StreamHC.get(),    // Stream
+                                        buffers[idx],              // Source uncompressed data
+                                        dst,                       // Destination compressed data
+                                        static_cast<int>(offset),  // Source data length
+                                        static_cast<int>(capacity) // Destination buffer length
+        );
     }
 
-    // Resize the target buffer
-    compressed->resize(cmpBytes + sizeof(uint32_t));
+    return LZ4_compress_fast_continue(lz4->lz4Stream,             // Stream
+                                      buffers[idx],               // Source uncompressed data
+                                      dst,                        // Destination compressed data
+                                      static_cast<int>(offset),   // Source data length
+                                      static_cast<int>(capacity), // Destination buffer length
+                                      codec.acceleration);
+}
 
-    // Write the data length (needed for decompression)
-    std::memcpy(compressed->data(), &cmpBytes, sizeof(cmpBytes));
+void MsgNet::CompressionStream::resetStream() {
+    if (codec.type == Codec::Type::Lz4Hc) {
+        LZ4_resetStreamHC_fast(lz4->lz4StreamHC.get(), codec.level);
+    } else {
+        LZ4_resetStream_fast(lz4->lz4Stream);
+    }
+}
 
-    // Send out the buffer
-    sendBuffer(std::move(compressed));
+void MsgNet::CompressionStream::recycleBuffer(std::shared_ptr<std::vector<char>> buffer) {
+    pool.release(std::move(buffer));
 }
 
 struct DecompressionStream::LZ4 {
@@ -82,75 +309,367 @@ struct DecompressionStream::LZ4 {
     LZ4_streamDecode_t* lz4StreamDecode = &lz4StreamDecodeBody;
 };
 
-DecompressionStream::DecompressionStream(const size_t blockBytes) :
-    lz4{std::make_unique<LZ4>()}, idx{0}, offset{0}, readCount{0}, decBuf{nullptr, nullptr} {
-    raw.resize(blockBytes * 2);
-    decBuf[0] = raw.data();
-    decBuf[1] = raw.data() + blockBytes;
-    cmpBuf.resize(LZ4_COMPRESSBOUND(blockBytes));
+DecompressionStream::DecompressionStream(const size_t blockBytes, const size_t maxPooledObjects) :
+    lz4{std::make_unique<LZ4>()},
+    maxBlockBytes{blockBytes},
+    preambleReceived{false},
+    objects{maxPooledObjects},
+    begin{0},
+    end{0},
+    historySize{0},
+    contiguous{0},
+    parsed{0},
+    used{0},
+    objectBytes{0},
+    stagingBytes{0} {
+    cmpBuf.resize((sizeof(uint32_t) + LZ4_COMPRESSBOUND(blockBytes)) * stagingBlocks);
+    history.resize(std::min(historyBytes, blockBytes * 2));
+    historyNext.resize(history.size());
+    decBuf.resize(std::max(blockBytes, historyBytes * 4));
 }
 
 DecompressionStream::~DecompressionStream() = default;
 
 void DecompressionStream::accept(const char* src, size_t length) {
     while (length > 0) {
-        if (offset < sizeof(uint32_t)) {
-            auto readToCopy = std::min(length, sizeof(uint32_t));
-            if (offset + readToCopy > sizeof(uint32_t)) {
-                readToCopy = sizeof(uint32_t) - offset;
-            }
+        size_t size = 0;
+        auto* dst = prepare(size);
+
+        const auto toCopy = std::min(size, length);
+        std::memcpy(dst, src, toCopy);
+
+        length -= toCopy;
+        src += toCopy;
+
+        commit(toCopy);
+    }
+}
+
+char* DecompressionStream::prepare(size_t& size) {
+    size = cmpBuf.size() - end;
+    return cmpBuf.data() + end;
+}
+
+void DecompressionStream::setStagingBytes(const size_t bytes) {
+    // The incomplete block is kept, with some free space after it
+    if (bytes == 0 || bytes == cmpBuf.size() || bytes <= end - begin) {
+        return;
+    }
+    stagingBytes = bytes;
+
+    if (begin > 0) {
+        std::memmove(cmpBuf.data(), cmpBuf.data() + begin, end - begin);
+        end -= begin;
+        begin = 0;
+    }
 
-            auto* dst = reinterpret_cast<char*>(&readCount) + offset;
-            std::memcpy(dst, src, readToCopy);
+    const auto shrink = bytes < cmpBuf.size();
+    cmpBuf.resize(bytes);
+    if (shrink) {
+        cmpBuf.shrink_to_fit();
+    }
+}
 
-            length -= readToCopy;
-            offset += readToCopy;
-            src += readToCopy;
+void DecompressionStream::commit(const size_t length) {
+    end += length;
+
+    // The stream starts with the preamble
+    auto needed = preambleReceived ? sizeof(uint32_t) : preambleBytes;
+    if (!preambleReceived && end - begin >= preambleBytes) {
+        configure(cmpBuf.data() + begin);
+        begin += preambleBytes;
+        needed = sizeof(uint32_t);
+    }
+
+    // Decompress all complete blocks in place
+    while (preambleReceived && end - begin >= sizeof(uint32_t)) {
+        uint32_t header;
+        std::memcpy(&header, cmpBuf.data() + begin, sizeof(header));
+
+        const auto isStored = (header & storedFlag) != 0;
+        const auto readCount = header & ~storedFlag;
+
+        if (readCount > (isStored ? maxBlockBytes : LZ4_COMPRESSBOUND(maxBlockBytes))) {
+            throw std::runtime_error("Decompress block is too large");
         }
 
-        if (length == 0) {
+        needed = sizeof(uint32_t) + readCount;
+        if (end - begin < needed) {
             break;
         }
 
-        const auto dst = cmpBuf.data() + offset - sizeof(uint32_t);
-        const auto toRead = std::min(static_cast<size_t>(readCount), length);
+        if (isStored) {
+            store(cmpBuf.data() + begin + sizeof(uint32_t), readCount);
+        } else {
+            decompress(cmpBuf.data() + begin + sizeof(uint32_t), readCount);
+        }
+        begin += needed;
+        needed = sizeof(uint32_t);
+    }
 
-        if (toRead > LZ4_COMPRESSBOUND(raw.size() / 2)) {
-            throw std::runtime_error("Decompress block is too large");
+    if (begin == end) {
+        begin = 0;
+        end = 0;
+    } else if (begin + needed > cmpBuf.size()) {
+        // The incomplete block would not fit, move it to the front
+        std::memmove(cmpBuf.data(), cmpBuf.data() + begin, end - begin);
+        end -= begin;
+        begin = 0;
+
+        // A small staging buffer grows to fit the whole block
+        if (needed > cmpBuf.size()) {
+            cmpBuf.resize(needed);
         }
+    }
+}
 
-        std::memcpy(dst, src, toRead);
+void MsgNet::DecompressionStream::configure(const char* src) {
+    uint32_t magic;
+    uint16_t level;
+    uint32_t blockBytes;
+    std::memcpy(&magic, src, sizeof(magic));
+    std::memcpy(&level, src + 6, sizeof(level));
+    std::memcpy(&blockBytes, src + 8, sizeof(blockBytes));
+    const auto version = static_cast<uint8_t>(src[4]);
+    const auto type = static_cast<uint8_t>(src[5]);
+
+    if (magic != preambleMagic || version != preambleVersion) {
+        throw std::runtime_error("Bad stream preamble");
+    }
 
-        length -= toRead;
-        offset += toRead;
-        src += toRead;
+    if (type > static_cast<uint8_t>(Codec::Type::Lz4Hc) || blockBytes < minCodecBlockBytes ||
+        blockBytes > maxCodecBlockBytes) {
+        throw std::runtime_error("Unsupported stream codec");
+    }
 
-        if (offset == readCount + sizeof(uint32_t)) {
-            decompress();
-            offset = 0;
-        }
+    remoteCodec.type = static_cast<Codec::Type>(type);
+    remoteCodec.blockBytes = blockBytes;
+    if (remoteCodec.type == Codec::Type::Lz4Hc) {
+        remoteCodec.level = level;
+    } else {
+        remoteCodec.acceleration = level;
     }
+
+    // Nothing has been decompressed yet, the buffers can be resized freely
+    maxBlockBytes = blockBytes;
+    if (stagingBytes == 0) {
+        cmpBuf.resize(std::max(end, (sizeof(uint32_t) + LZ4_COMPRESSBOUND(blockBytes)) * stagingBlocks));
+    }
+    history.resize(std::min(historyBytes, maxBlockBytes * 2));
+    historyNext.resize(history.size());
+    decBuf.resize(std::max(maxBlockBytes, historyBytes * 4));
+
+    preambleReceived = true;
 }
 
-void MsgNet::DecompressionStream::decompress() {
-    const int decBytes = LZ4_decompress_safe_continue(lz4->lz4StreamDecode,            // Stream
-                                                      cmpBuf.data(),                   // Source compressed data
-                                                      decBuf[idx],                     // Destination decompressed data
-                                                      static_cast<int>(readCount),     // Number of compressed bytes
-                                                      static_cast<int>(raw.size() / 2) // Max size of the destination
-    );
+void MsgNet::DecompressionStream::decompress(const char* src, const uint32_t length) {
+    if (decBuf.size() - used < maxBlockBytes) {
+        reserve();
+    }
+
+    const int decBytes = LZ4_decompress_safe_continue(lz4->lz4StreamDecode,             // Stream
+                                                      src,                              // Source compressed data
+                                                      decBuf.data() + used,             // Destination decompressed data
+                                                      static_cast<int>(length),         // Number of compressed bytes
+                                                      static_cast<int>(maxBlockBytes)); // Max size of the destination
 
     if (decBytes > 0) {
-        unp.reserve_buffer(decBytes);
-        std::memcpy(unp.buffer(), decBuf[idx], decBytes);
-        unp.buffer_consumed(decBytes);
+        used += decBytes;
+        contiguous += decBytes;
+        unpack();
+    }
+}
+
+void MsgNet::DecompressionStream::store(const char* src, const uint32_t length) {
+    if (decBuf.size() - used < maxBlockBytes) {
+        reserve();
+    }
+
+    std::memcpy(decBuf.data() + used, src, length);
+    used += length;
+    contiguous += length;
+
+    // The compressor may refer to the stored data, make it a part of the LZ4 history.
+    // The history is either fully in the buffer, or it has to be merged with the saved history.
+    const auto window = std::min(historyBytes, maxBlockBytes * 2);
+    if (contiguous >= window) {
+        LZ4_setStreamDecode(lz4->lz4StreamDecode, decBuf.data() + used - window, static_cast<int>(window));
+    } else {
+        saveHistory();
+    }
+
+    unpack();
+}
+
+void MsgNet::DecompressionStream::reserve() {
+    // LZ4 needs the previously decompressed data at the place it was decompressed to.
+    // Moving the data around overwrites it, so keep a copy of the history.
+    saveHistory();
 
-        auto oh = std::make_shared<msgpack::object_handle>();
-        while (unp.next(*oh)) {
-            receiveObject(std::move(oh));
-            oh = std::make_shared<msgpack::object_handle>();
+    // Move the incomplete object to the front
+    std::memmove(decBuf.data(), decBuf.data() + parsed, used - parsed);
+    scanner.pos -= parsed;
+    used -= parsed;
+    parsed = 0;
+
+    // Objects larger than the buffer
+    if (decBuf.size() - used < maxBlockBytes) {
+        decBuf.resize(std::max(decBuf.size() * 2, used + maxBlockBytes));
+    }
+}
+
+void MsgNet::DecompressionStream::saveHistory() {
+    // The compression stream uses a double buffer, so a block never refers further back
+    // than the two previous blocks, up to the 64KB LZ4 window. The history is taken
+    // partially from the previous history and the rest from the decompressed data.
+    const auto window = std::min(historyBytes, maxBlockBytes * 2);
+    const auto fromBuffer = std::min(contiguous, window);
+    const auto fromHistory = std::min(historySize, window - fromBuffer);
+
+    std::memcpy(historyNext.data(), history.data() + historySize - fromHistory, fromHistory);
+    std::memcpy(historyNext.data() + fromHistory, decBuf.data() + used - fromBuffer, fromBuffer);
+
+    std::swap(history, historyNext);
+    historySize = fromHistory + fromBuffer;
+    contiguous = 0;
+
+    LZ4_setStreamDecode(lz4->lz4StreamDecode, history.data(), static_cast<int>(historySize));
+}
+
+void MsgNet::DecompressionStream::unpack() {
+    while (scan()) {
+        // Reuse the zone of a recycled handle, the strings and binaries are copied into it.
+        auto oh = objects.acquire();
+        if (oh->zone()) {
+            oh->zone()->clear();
+        } else {
+            oh->zone() = std::make_unique<msgpack::zone>();
         }
+
+        auto off = parsed;
+        bool referenced = false;
+        oh->set(msgpack::unpack(*oh->zone(), decBuf.data(), scanner.pos, off, referenced));
+
+        objectBytes = scanner.pos - parsed;
+        parsed = scanner.pos;
+        scanner.pending = 1;
+
+        receiveObject(std::move(oh));
     }
+}
 
-    idx = (idx + 1) % 2;
+/**
+ * Reads the header of a Msgpack value.
+ *
+ * @param src The value.
+ * @param length Number of available bytes.
+ * @param header Set to the size of the header.
+ * @param children Set to the number of nested values.
+ * @param payload Set to the number of bytes after the header.
+ * @return False if more bytes are needed.
+ */
+static bool readHeader(const char* src, const size_t length, size_t& header, uint64_t& children,
+                       uint64_t& payload) {
+    const auto type = static_cast<uint8_t>(src[0]);
+    header = 1;
+    children = 0;
+    payload = 0;
+
+    // The length that follows the type as big endian
+    const auto readLength = [&](const size_t bytes) {
+        if (length < 1 + bytes) {
+            return false;
+        }
+        for (size_t i = 0; i < bytes; i++) {
+            payload = (payload << 8) | static_cast<uint8_t>(src[1 + i]);
+        }
+        header = 1 + bytes;
+        return true;
+    };
+
+    if (type <= 0x7f || type >= 0xe0 || type == 0xc0 || type == 0xc2 || type == 0xc3) {
+        // Fixint, nil, bool
+    } else if (type <= 0x8f) {
+        children = 2 * (type & 0x0f);
+    } else if (type <= 0x9f) {
+        children = type & 0x0f;
+    } else if (type <= 0xbf) {
+        payload = type & 0x1f;
+    } else if (type == 0xc4 || type == 0xd9) {
+        return readLength(1);
+    } else if (type == 0xc5 || type == 0xda) {
+        return readLength(2);
+    } else if (type == 0xc6 || type == 0xdb) {
+        return readLength(4);
+    } else if (type >= 0xc7 && type <= 0xc9) {
+        // Ext with the type byte after the length
+        if (!readLength(type == 0xc7 ? 1 : (type == 0xc8 ? 2 : 4))) {
+            return false;
+        }
+        payload += 1;
+    } else if (type == 0xcc || type == 0xd0) {
+        payload = 1;
+    } else if (type == 0xcd || type == 0xd1) {
+        payload = 2;
+    } else if (type == 0xca || type == 0xce || type == 0xd2) {
+        payload = 4;
+    } else if (type == 0xcb || type == 0xcf || type == 0xd3) {
+        payload = 8;
+    } else if (type >= 0xd4 && type <= 0xd8) {
+        payload = 1 + (uint64_t{1} << (type - 0xd4));
+    } else if (type == 0xdc || type == 0xdd) {
+        if (!readLength(type == 0xdc ? 2 : 4)) {
+            return false;
+        }
+        children = payload;
+        payload = 0;
+    } else if (type == 0xde || type == 0xdf) {
+        if (!readLength(type == 0xde ? 2 : 4)) {
+            return false;
+        }
+        children = 2 * payload;
+        payload = 0;
+    } else {
+        throw msgpack::parse_error("parse error");
+    }
+
+    return true;
+}
+
+bool MsgNet::DecompressionStream::scan() {
+    // Walks the values without unpacking them until the whole top level object is available.
+    // The position is kept between the calls, so every byte is only scanned once.
+    while (true) {
+        if (scanner.skip > 0) {
+            const auto toSkip = std::min<uint64_t>(scanner.skip, used - scanner.pos);
+            scanner.pos += toSkip;
+            scanner.skip -= toSkip;
+            if (scanner.skip > 0) {
+                return false;
+            }
+        }
+
+        if (scanner.pending == 0) {
+            return true;
+        }
+
+        if (scanner.pos >= used) {
+            return false;
+        }
+
+        size_t header;
+        uint64_t children;
+        uint64_t payload;
+        if (!readHeader(decBuf.data() + scanner.pos, used - scanner.pos, header, children, payload)) {
+            return false;
+        }
+
+        scanner.pos += header;
+        scanner.pending = scanner.pending - 1 + children;
+        scanner.skip = payload;
+    }
+}
+
+void MsgNet::DecompressionStream::recycleObject(std::shared_ptr<msgpack::object_handle> oh) {
+    objects.release(std::move(oh));
 }
@@ -1,6 +1,10 @@
 #pragma once
 
+#include "attachment.hpp"
+#include "codec.hpp"
 #include "library.hpp"
+#include "pool.hpp"
+#include <atomic>
 #include <memory>
 #include <msgpack.hpp>
 #include <vector>
@@ -11,17 +15,27 @@ namespace MsgNet {
  * Compression stream that can be used with Msgpack.
  * It produces compressed buffers via sendBuffer().
  * You must call flush() after each message end.
+ * The first buffer starts with a preamble that describes the codec to the decompression stream.
  */
 class MSGNET_API CompressionStream {
 public:
     /**
      * @param blockBytes Maximum number of bytes per each compressed block.
+     * @param maxPooledBlocks Maximum number of compressed block buffers kept for reuse.
      */
-    explicit CompressionStream(size_t blockBytes = 1024 * 8);
+    explicit CompressionStream(size_t blockBytes = 1024 * 8, size_t maxPooledBlocks = 64);
+
+    /**
+     * @param codec The codec to compress the blocks with.
+     * @param maxPooledBlocks Maximum number of compressed block buffers kept for reuse.
+     */
+    explicit CompressionStream(const Codec& codec, size_t maxPooledBlocks = 64);
     ~CompressionStream();
 
     /**
      * Write arbitrary number of bytes into the stream.
+     * The bytes of an Attachment being packed are passed to sendReference() instead, if they are
+     * not going to be compressed anyway, see Attachment.
      *
      * @param src The source data.
      * @param length Length of the source data.
@@ -34,6 +48,52 @@ public:
      */
     void flush();
 
+    /**
+     * Returns the pool the compressed block buffers are taken from.
+     *
+     * @return The pool of block buffers.
+     */
+    const Pool<std::vector<char>>& getBufferPool() const {
+        return pool;
+    }
+
+    /**
+     * Configures when a block is stored as it is instead of being compressed.
+     * The decompression stream handles both kinds of blocks without any configuration.
+     *
+     * @param minBytes Blocks smaller than this are never compressed.
+     * @param maxEntropy Blocks with the estimated entropy (bits per byte, 0 to 8) above this are
+     * not compressed, for example images or already compressed data. Use 8 to disable the estimate.
+     */
+    void setBypass(size_t minBytes, float maxEntropy);
+
+    /**
+     * Returns the number of blocks that were sent uncompressed.
+     *
+     * @return Number of the stored blocks.
+     */
+    uint64_t getStoredBlocks() const {
+        return stored.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Returns the number of bytes of the attachments that were passed by reference.
+     *
+     * @return Number of bytes.
+     */
+    uint64_t getReferencedBytes() const {
+        return referenced.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Returns the codec the blocks are compressed with.
+     *
+     * @return The codec.
+     */
+    const Codec& getCodec() const {
+        return codec;
+    }
+
 protected:
     /**
      * The method that gets called every time some buffer needs to be sent out.
@@ -44,25 +104,66 @@ protected:
      */
     virtual void sendBuffer(std::shared_ptr<std::vector<char>> buffer) = 0;
 
+    /**
+     * The method that gets called for each stored block of an attachment. The block is made of the header
+     * followed by the bytes of the attachment, which are not copied. The default implementation copies
+     * the bytes after the header and passes the buffer to sendBuffer().
+     *
+     * @param header The buffer with the block header, the same as the ones passed to sendBuffer().
+     * @param owner The object that keeps the bytes alive, must be held until the bytes are sent.
+     * @param data Pointer to the bytes of the block.
+     * @param size Number of bytes of the block.
+     */
+    virtual void sendReference(std::shared_ptr<std::vector<char>> header, std::shared_ptr<const void> owner,
+                               const char* data, size_t size);
+
+    /**
+     * Returns the buffer produced by sendBuffer() back to the pool once it is no longer needed,
+     * for example after it has been written to the socket. Buffers that are never returned
+     * are simply freed.
+     *
+     * @param buffer The buffer to recycle.
+     */
+    void recycleBuffer(std::shared_ptr<std::vector<char>> buffer);
+
 private:
+    int compress(char* dst, size_t capacity);
+    void resetStream();
+    bool isBypassed(const char* src, size_t length) const;
+    void writeReference(const Attachment& attachment);
+    std::shared_ptr<std::vector<char>> acquireBlock(uint32_t header, size_t length);
+
     struct LZ4;
+    const Codec codec;
     std::unique_ptr<LZ4> lz4;
+    Pool<std::vector<char>> pool;
     std::vector<char> raw;
     char* buffers[2];
     size_t idx;
     size_t offset;
+    bool preambleSent;
+    size_t minBytes;
+    float maxEntropy;
+    std::atomic_uint64_t stored;
+    std::atomic_uint64_t referenced;
 };
 
 /**
- * Decompression stream that produces Msgpack object handles
+ * Decompression stream that produces Msgpack object handles.
+ * The compressed data can be either copied in via accept(), or written directly
+ * into the stream's staging buffer via prepare() and commit(). The blocks are
+ * decompressed directly into the buffer the objects are unpacked from.
+ * The object handles are taken from a pool and can be given back via recycleObject(),
+ * so their zones are reused instead of being allocated for each object.
  */
 class MSGNET_API DecompressionStream {
 public:
     /**
-     * @param blockBytes Maximum number of bytes per each compressed block.
-     * @warning The blockBytes must match the compression stream's blockBytes!
+     * @param blockBytes Initial maximum number of bytes per each compressed block.
+     * The block size announced by the compression stream's preamble takes over.
+     * @param maxPooledObjects Maximum number of object handles kept for reuse.
      */
-    explicit DecompressionStream(size_t blockBytes = 1024 * 8);
+    explicit DecompressionStream(size_t blockBytes = 1024 * 8, size_t maxPooledObjects = 64);
     ~DecompressionStream();
 
     /**
@@ -72,6 +173,60 @@ public:
      */
     void accept(const char* src, size_t length);
 
+    /**
+     * Returns the free space of the staging buffer. The compressed data can be written
+     * directly in there, for example by a socket read, followed by a call to commit().
+     * The returned space is never empty.
+     *
+     * @param size Set to the number of bytes that can be written.
+     * @return Pointer to the free space.
+     */
+    char* prepare(size_t& size);
+
+    /**
+     * Processes the bytes written into the space returned by prepare().
+     *
+     * @param length Number of bytes written.
+     */
+    void commit(size_t length);
+
+    /**
+     * Resizes the staging buffer returned by prepare(). By default the buffer holds a few compressed blocks.
+     * A smaller buffer grows on its own if a single block does not fit into it, and the buffer never
+     * shrinks below the data it holds.
+     *
+     * @param bytes The new size of the staging buffer.
+     */
+    void setStagingBytes(size_t bytes);
+
+    /**
+     * Returns the size of the staging buffer.
+     *
+     * @return Number of bytes.
+     */
+    size_t getStagingBytes() const {
+        return cmpBuf.size();
+    }
+
+    /**
+     * Returns the pool the object handles are taken from.
+     *
+     * @return The pool of object handles.
+     */
+    const Pool<msgpack::object_handle>& getObjectPool() const {
+        return objects;
+    }
+
+    /**
+     * Returns the codec announced by the compression stream on the other side.
+     * Valid only once the stream preamble has been received.
+     *
+     * @return The remote codec.
+     */
+    const Codec& getRemoteCodec() const {
+        return remoteCodec;
+    }
+
 protected:
     /**
      * Called each time there is an object in the decompressed stream.
@@ -79,17 +234,56 @@ protected:
      */
     virtual void receiveObject(std::shared_ptr<msgpack::object_handle> oh) = 0;
 
+    /**
+     * Returns the object handle produced by receiveObject() back to the pool once the object
+     * is no longer needed. Handles that are never returned are simply freed.
+     *
+     * @param oh The object handle to recycle.
+     */
+    void recycleObject(std::shared_ptr<msgpack::object_handle> oh);
+
+    /**
+     * Returns the packed size of the object currently passed to receiveObject().
+     *
+     * @return Number of decompressed bytes of the object.
+     */
+    size_t getObjectBytes() const {
+        return objectBytes;
+    }
+
 private:
-    void decompress();
+    void configure(const char* src);
+    void decompress(const char* src, uint32_t length);
+    void store(const char* src, uint32_t length);
+    void saveHistory();
+    void reserve();
+    void unpack();
+    bool scan();
 
     struct LZ4;
     std::unique_ptr<LZ4> lz4;
-    std::vector<char> raw;
-    char* decBuf[2];
+    size_t maxBlockBytes;
+    Codec remoteCodec;
+    bool preambleReceived;
+    Pool<msgpack::object_handle> objects;
     std::vector<char> cmpBuf;
-    msgpack::unpacker unp;
-    size_t idx;
-    size_t offset;
-    uint32_t readCount;
+    size_t begin;
+    size_t end;
+    std::vector<char> history;
+    std::vector<char> historyNext;
+    size_t historySize;
+    size_t contiguous;
+    std::vector<char> decBuf;
+    size_t parsed;
+    size_t used;
+    size_t objectBytes;
+    size_t stagingBytes;
+
+    // Position of the object boundary search, resumed with every decompressed block.
+    struct {
+        size_t pos{0};
+        uint64_t pending{1};
+        uint64_t skip{0};
+    } scanner;
 };
 } // namespace MsgNet
@@ -0,0 +1,125 @@
+#include "timer.hpp"
+
+using namespace MsgNet;
+
+TimerWheel::TimerWheel(asio::io_context& service, const std::chrono::milliseconds tick) :
+    timer{service}, tick{tick}, start{std::chrono::steady_clock::now()} {
+
+    if (tick.count() <= 0) {
+        throw std::runtime_error("Timer wheel tick must be positive");
+    }
+}
+
+TimerWheel::~TimerWheel() {
+    std::lock_guard<std::mutex> lock{mutex};
+    timer.cancel();
+}
+
+void TimerWheel::add(const std::chrono::milliseconds delay, Task task) {
+    // Round up, so the task is never executed early
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    const auto deadline = static_cast<uint64_t>((elapsed + delay + tick - std::chrono::nanoseconds{1}) / tick);
+    const auto now = static_cast<uint64_t>(elapsed / tick);
+
+    std::lock_guard<std::mutex> lock{mutex};
+
+    // The wheel does not advance while empty
+    if (count == 0) {
+        current = std::max(current, now);
+    }
+
+    // The current slot has already been executed
+    insert({std::max(deadline, current + 1), std::move(task)});
+    count++;
+
+    if (!armed) {
+        arm();
+    }
+}
+
+size_t TimerWheel::size() const {
+    std::lock_guard<std::mutex> lock{mutex};
+    return count;
+}
+
+void TimerWheel::insert(Entry entry) {
+    // Too far in the future, park it in the furthest slot, it will be re-inserted once reached
+    const auto maxDelta = (uint64_t{1} << (slotBits * levels)) - 1;
+    const auto deadline = std::min(entry.deadline, current + maxDelta);
+    const auto delta = deadline - current;
+
+    size_t level = 0;
+    while (level + 1 < levels && delta >= (uint64_t{1} << (slotBits * (level + 1)))) {
+        level++;
+    }
+
+    const auto slot = (deadline >> (slotBits * level)) & (slots - 1);
+    wheel[level][slot].push_back(std::move(entry));
+}
+
+void TimerWheel::advance(const uint64_t now, std::vector<Task>& due) {
+    while (current < now && count > 0) {
+        current++;
+
+        // Move the entries of the higher levels down, once the lower level wraps around
+        for (size_t level = 1; level < levels; level++) {
+            if ((current & ((uint64_t{1} << (slotBits * level)) - 1)) != 0) {
+                break;
+            }
+
+            auto& bucket = wheel[level][(current >> (slotBits * level)) & (slots - 1)];
+            auto entries = std::move(bucket);
+            bucket.clear();
+            for (auto& entry : entries) {
+                insert(std::move(entry));
+            }
+        }
+
+        auto& bucket = wheel[0][current & (slots - 1)];
+        for (size_t i = 0; i < bucket.size(); i++) {
+            if (bucket[i].deadline > current) {
+                // Parked, not yet there
+                auto entry = std::move(bucket[i]);
+                insert(std::move(entry));
+                continue;
+            }
+            due.push_back(std::move(bucket[i].task));
+            count--;
+        }
+        bucket.clear();
+    }
+
+    // Nothing left, jump to the present
+    if (count == 0) {
+        current = std::max(current, now);
+    }
+}
+
+void TimerWheel::arm() {
+    armed = true;
+    timer.expires_at(start + tick * (current + 1));
+    timer.async_wait([this](const asio::error_code ec) {
+        if (ec == asio::error::operation_aborted) {
+            return;
+        }
+
+        std::vector<Task> due;
+
+        {
+            std::lock_guard<std::mutex> lock{mutex};
+            armed = false;
+            advance(getTicks(), due);
+            if (count > 0) {
+                arm();
+            }
+        }
+
+        for (auto& task : due) {
+            task();
+        }
+    });
+}
+
+uint64_t TimerWheel::getTicks() const {
+    return static_cast<uint64_t>((std::chrono::steady_clock::now() - start) / tick);
+}
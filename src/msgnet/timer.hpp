@@ -0,0 +1,73 @@
+#pragma once
+
+#define ASIO_STANDALONE
+
+#include "function.hpp"
+#include <array>
+#include <asio.hpp>
+#include <chrono>
+#include <mutex>
+#include <vector>
+
+namespace MsgNet {
+/**
+ * A hierarchical timer wheel that runs all of its tasks from a single asio timer.
+ * Adding a task is constant time and does not create any asio timer, so it is cheap
+ * to have a deadline on every request. The tasks are executed by the thread running the io_context.
+ * The wheel has 4 levels of 64 slots, the deadlines longer than that are re-scheduled when reached.
+ */
+class MSGNET_API TimerWheel {
+public:
+    using Task = InlineFunction<void(), 32>;
+
+    /**
+     * @param service The io_context that executes the tasks.
+     * @param tick The resolution of the wheel. The tasks are executed at most one tick late.
+     */
+    explicit TimerWheel(asio::io_context& service, std::chrono::milliseconds tick = std::chrono::milliseconds{10});
+    ~TimerWheel();
+
+    TimerWheel(const TimerWheel& other) = delete;
+    TimerWheel& operator=(const TimerWheel& other) = delete;
+
+    /**
+     * Schedules the task to be executed after the delay. The task can not be cancelled,
+     * the task itself should check whether it is still needed.
+     *
+     * @param delay How long to wait before executing the task.
+     * @param task The task to execute.
+     */
+    void add(std::chrono::milliseconds delay, Task task);
+
+    /**
+     * Returns the number of scheduled tasks.
+     *
+     * @return The number of tasks.
+     */
+    size_t size() const;
+
+private:
+    static constexpr size_t levels = 4;
+    static constexpr size_t slotBits = 6;
+    static constexpr uint64_t slots = 1 << slotBits;
+
+    struct Entry {
+        uint64_t deadline{0};
+        Task task;
+    };
+
+    void insert(Entry entry);
+    void advance(uint64_t now, std::vector<Task>& due);
+    void arm();
+    uint64_t getTicks() const;
+
+    asio::steady_timer timer;
+    std::chrono::steady_clock::duration tick;
+    std::chrono::steady_clock::time_point start;
+    mutable std::mutex mutex;
+    uint64_t current{0};
+    size_t count{0};
+    bool armed{false};
+    std::array<std::array<std::vector<Entry>, slots>, levels> wheel;
+};
+} // namespace MsgNet
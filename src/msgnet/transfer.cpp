@@ -0,0 +1,50 @@
+#include "transfer.hpp"
+#include "peer.hpp"
+#include <algorithm>
+
+using namespace MsgNet;
+
+StreamWriter::StreamWriter(std::shared_ptr<Peer> peer, const uint64_t id, const size_t chunkBytes) :
+    peer{std::move(peer)}, id{id}, chunkBytes{std::max<size_t>(chunkBytes, 1)} {
+    buffer.reserve(this->chunkBytes);
+}
+
+StreamWriter::~StreamWriter() {
+    close();
+}
+
+void StreamWriter::write(const char* data, size_t size) {
+    if (closed) {
+        throw std::runtime_error("The stream has been closed");
+    }
+
+    while (size > 0) {
+        // The full chunks are sent straight from the caller's buffer
+        if (buffer.empty() && size >= chunkBytes) {
+            peer->sendChunk(id, 0, data, chunkBytes, false);
+            data += chunkBytes;
+            size -= chunkBytes;
+            continue;
+        }
+
+        const auto toCopy = std::min(size, chunkBytes - buffer.size());
+        buffer.insert(buffer.end(), data, data + toCopy);
+        data += toCopy;
+        size -= toCopy;
+
+        if (buffer.size() == chunkBytes) {
+            peer->sendChunk(id, 0, buffer.data(), buffer.size(), false);
+            buffer.clear();
+        }
+    }
+}
+
+void StreamWriter::close() {
+    if (closed) {
+        return;
+    }
+    closed = true;
+
+    peer->sendChunk(id, 0, buffer.data(), buffer.size(), true);
+    buffer.clear();
+}
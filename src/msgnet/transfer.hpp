@@ -0,0 +1,96 @@
+#pragma once
+
+#include "message.hpp"
+#include <functional>
+#include <memory>
+#include <vector>
+
+namespace MsgNet {
+class MSGNET_API Peer;
+
+/**
+ * A piece of a stream sent by a StreamWriter. Each chunk is a message of its own, so the chunks
+ * of the streams interleave with the other messages of the peer. The first chunk of a stream carries
+ * the type and the packed header of the stream, the rest carry the data.
+ *
+ * The data is packed straight from the sender's buffer, and points into the received object on
+ * the receiving side, it is not copied into a separate buffer. The size is packed with 32 bits,
+ * Options::streamChunkBytes is limited to 4 GiB.
+ */
+struct MSGNET_API StreamChunk {
+    static constexpr uint64_t hash = Detail::getMessageHash("MsgNet::StreamChunk");
+
+    uint64_t stream{0};
+    uint64_t type{0};
+    bool last{false};
+    const char* data{nullptr};
+    size_t size{0};
+
+    template <typename Packer> void msgpack_pack(Packer& packer) const {
+        packer.pack_array(4);
+        packer.pack(stream);
+        packer.pack(type);
+        packer.pack(last);
+        packer.pack_bin(static_cast<uint32_t>(size));
+        packer.pack_bin_body(data, static_cast<uint32_t>(size));
+    }
+
+    void msgpack_unpack(const msgpack::object& object) {
+        if (object.type != msgpack::type::ARRAY || object.via.array.size != 4 ||
+            object.via.array.ptr[3].type != msgpack::type::BIN) {
+            throw msgpack::type_error();
+        }
+
+        object.via.array.ptr[0].convert(stream);
+        object.via.array.ptr[1].convert(type);
+        object.via.array.ptr[2].convert(last);
+        data = object.via.array.ptr[3].via.bin.ptr;
+        size = object.via.array.ptr[3].via.bin.size;
+    }
+};
+
+/**
+ * Writes a stream of bytes to the peer in chunks of Options::streamChunkBytes, see Peer::openStream.
+ * Only the current chunk is held in memory. Once the peer has more than Options::streamWindowBytes
+ * waiting to be written to the socket, the writer waits until the socket catches up.
+ * The writer is not thread safe, use it from one thread at the time.
+ */
+class MSGNET_API StreamWriter {
+public:
+    StreamWriter(std::shared_ptr<Peer> peer, uint64_t id, size_t chunkBytes);
+    ~StreamWriter();
+
+    StreamWriter(const StreamWriter& other) = delete;
+    StreamWriter& operator=(const StreamWriter& other) = delete;
+
+    /**
+     * Appends the bytes to the stream. The full chunks are sent right away.
+     *
+     * @param data The bytes to send.
+     * @param size Number of bytes.
+     */
+    void write(const char* data, size_t size);
+
+    /**
+     * Sends the rest of the stream and marks it as finished. This is also called by the destructor.
+     * Calling this multiple times is allowed.
+     */
+    void close();
+
+    /**
+     * Returns the ID of the stream, unique per peer.
+     *
+     * @return The stream ID.
+     */
+    uint64_t getId() const {
+        return id;
+    }
+
+private:
+    std::shared_ptr<Peer> peer;
+    uint64_t id;
+    size_t chunkBytes;
+    std::vector<char> buffer;
+    bool closed{false};
+};
+} // namespace MsgNet
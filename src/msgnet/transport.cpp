@@ -0,0 +1,29 @@
+#include "transport.hpp"
+#include <sstream>
+
+using namespace MsgNet;
+
+std::string MsgNet::toString(const asio::ip::tcp::endpoint& endpoint) {
+    std::stringstream ss;
+
+    if (endpoint.address().is_v6()) {
+        ss << "[" << endpoint.address().to_string() << "]:" << endpoint.port();
+    } else {
+        ss << "" << endpoint.address().to_string() << ":" << endpoint.port();
+    }
+
+    return ss.str();
+}
+
+#ifndef _WIN32
+std::string MsgNet::toString(const LocalEndpoint& endpoint) {
+    auto path = endpoint.path();
+
+    // The abstract names start with a null character, shown as "@name"
+    if (!path.empty() && path.front() == '\0') {
+        path.front() = '@';
+    }
+
+    return path;
+}
+#endif
@@ -0,0 +1,228 @@
+#pragma once
+
+#include "function.hpp"
+#include "library.hpp"
+#include <asio.hpp>
+#include <asio/ssl.hpp>
+#include <functional>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace MsgNet {
+/**
+ * The connection a peer reads from and writes to. The peer does not care how the bytes get to the other side,
+ * only the server and the client know the concrete transport. All of the operations, except close(),
+ * are called from the strand of the peer.
+ */
+class MSGNET_API Transport {
+public:
+    using Handler = InlineFunction<void(const asio::error_code&, size_t)>;
+    using HandshakeHandler = std::function<void(const asio::error_code&)>;
+    using Strand = asio::io_context::strand;
+
+    virtual ~Transport() = default;
+
+    /**
+     * Performs the handshake of the connection, if the transport has any.
+     *
+     * @param server True on the accepting side of the connection.
+     * @param handler Called once the handshake is done.
+     */
+    virtual void handshake(bool server, HandshakeHandler handler) = 0;
+
+    /**
+     * Prepares the connection for the peer, once the handshake is done.
+     */
+    virtual void configure() = 0;
+
+    /**
+     * Reads some bytes into the buffer. The handler is executed through the strand.
+     *
+     * @param strand The strand of the peer.
+     * @param buffer Where to read the bytes into.
+     * @param handler Called with the number of bytes read.
+     */
+    virtual void asyncRead(Strand& strand, asio::mutable_buffer buffer, Handler handler) = 0;
+
+    /**
+     * Reads the bytes that are already available, without waiting for more.
+     *
+     * @param buffer Where to read the bytes into.
+     * @param ec Set to an error, including asio::error::would_block if there is nothing to read.
+     * @return The number of bytes read.
+     */
+    virtual size_t read(asio::mutable_buffer buffer, asio::error_code& ec) = 0;
+
+    /**
+     * Writes all of the buffers in a single gathered write. The handler is executed through the strand.
+     *
+     * @param strand The strand of the peer.
+     * @param buffers The bytes to write, must stay alive until the handler is called.
+     * @param handler Called with the number of bytes written.
+     */
+    virtual void asyncWrite(Strand& strand, const std::vector<asio::const_buffer>& buffers, Handler handler) = 0;
+
+    /**
+     * Returns true if read() may run while an asyncWrite() is in flight. A TLS stream shares its state
+     * between the two directions, a read may have to write a record of its own.
+     *
+     * @return True if the directions are independent.
+     */
+    virtual bool isFullDuplex() const = 0;
+
+    /**
+     * Closes the connection. The operations in flight complete with an error.
+     */
+    virtual void close() = 0;
+
+    /**
+     * Returns true if the connection is open.
+     *
+     * @return True if open.
+     */
+    virtual bool isOpen() const = 0;
+
+    /**
+     * Returns the address of the other side.
+     *
+     * @return Address with port in string format. The IPv6 will be formatted as "[address]:port"
+     * A Unix domain socket is formatted as its path, or as "@name" for an abstract name.
+     */
+    virtual std::string getAddress() const = 0;
+};
+
+namespace Detail {
+template <typename T> struct IsTlsStream : std::false_type {};
+
+template <typename T> struct IsTlsStream<asio::ssl::stream<T>> : std::true_type {};
+} // namespace Detail
+
+MSGNET_API std::string toString(const asio::ip::tcp::endpoint& endpoint);
+
+#ifndef _WIN32
+/**
+ * The endpoint of a Unix domain socket, either a filesystem path or an abstract socket name
+ * starting with a null character.
+ */
+using LocalEndpoint = asio::local::stream_protocol::endpoint;
+
+MSGNET_API std::string toString(const LocalEndpoint& endpoint);
+#endif
+
+/**
+ * A transport over an asio stream, either a plain socket or a TLS stream on top of one.
+ *
+ * @tparam Stream The type of the asio stream.
+ */
+template <typename Stream> class StreamTransport : public Transport {
+public:
+    static constexpr bool isTls = Detail::IsTlsStream<Stream>::value;
+
+    using Socket = typename Stream::lowest_layer_type;
+
+    static constexpr bool isTcp = std::is_same_v<typename Socket::protocol_type, asio::ip::tcp>;
+
+    /**
+     * @param args The arguments of the stream, the io service and the TLS context, if any.
+     */
+    template <typename... Args> explicit StreamTransport(Args&&... args) : stream{std::forward<Args>(args)...} {
+    }
+
+    /**
+     * Returns the underlying stream.
+     *
+     * @return The stream.
+     */
+    Stream& getStream() {
+        return stream;
+    }
+
+    /**
+     * Returns the lowest layer of the stream, the socket to connect or to accept into.
+     *
+     * @return The socket.
+     */
+    Socket& getSocket() {
+        return stream.lowest_layer();
+    }
+
+    void handshake(const bool server, HandshakeHandler handler) override {
+        if constexpr (isTls) {
+            stream.async_handshake(server ? asio::ssl::stream_base::server : asio::ssl::stream_base::client,
+                                   std::move(handler));
+        } else {
+            // Nothing to negotiate, the handler is still never called from within this function
+            asio::post(stream.get_executor(), [handler = std::move(handler)]() { handler(asio::error_code{}); });
+        }
+    }
+
+    void configure() override {
+        asio::error_code ec;
+        if constexpr (isTcp) {
+            getSocket().set_option(asio::ip::tcp::no_delay{true}, ec);
+        }
+
+        // The asynchronous operations are not affected, the reads that drain the socket must not block
+        getSocket().non_blocking(true, ec);
+    }
+
+    void asyncRead(Strand& strand, const asio::mutable_buffer buffer, Handler handler) override {
+        stream.async_read_some(buffer, asio::bind_executor(strand, std::move(handler)));
+    }
+
+    size_t read(const asio::mutable_buffer buffer, asio::error_code& ec) override {
+        return stream.read_some(buffer, ec);
+    }
+
+    void asyncWrite(Strand& strand, const std::vector<asio::const_buffer>& buffers, Handler handler) override {
+        asio::async_write(stream, buffers, asio::bind_executor(strand, std::move(handler)));
+    }
+
+    bool isFullDuplex() const override {
+        return !isTls;
+    }
+
+    void close() override {
+        asio::error_code ec;
+        getSocket().close(ec);
+    }
+
+    bool isOpen() const override {
+        return stream.lowest_layer().is_open();
+    }
+
+    std::string getAddress() const override {
+        asio::error_code ec;
+        const auto endpoint = stream.lowest_layer().remote_endpoint(ec);
+        if constexpr (!isTcp) {
+            // The connecting side of a Unix domain socket is usually unnamed, both sides show the server's name
+            if (!ec && endpoint.path().empty()) {
+                return toString(stream.lowest_layer().local_endpoint(ec));
+            }
+        }
+        return ec ? std::string{} : toString(endpoint);
+    }
+
+private:
+    Stream stream;
+};
+
+/**
+ * TLS 1.3 over TCP, the default transport.
+ */
+using TlsTransport = StreamTransport<asio::ssl::stream<asio::ip::tcp::socket>>;
+
+/**
+ * Plain TCP without encryption, see Options::tls.
+ */
+using TcpTransport = StreamTransport<asio::ip::tcp::socket>;
+
+#ifndef _WIN32
+/**
+ * Unix domain socket between the processes of the same host, always without TLS.
+ */
+using UnixTransport = StreamTransport<asio::local::stream_protocol::socket>;
+#endif
+} // namespace MsgNet
@@ -0,0 +1,710 @@
+#include <algorithm>
+#include <catch.hpp>
+#include <chrono>
+#include <ctime>
+#include <iostream>
+#include <msgnet/client.hpp>
+#include <msgnet/server.hpp>
+#include <random>
+
+using namespace MsgNet;
+
+// Benchmarks are hidden from the default test run, use "MsgNet_tests [benchmark]" to run them.
+
+struct MessageTick {
+    uint64_t seq{0};
+    std::string payload;
+
+    MESSAGE_DEFINE(MessageTick, seq, payload);
+};
+
+class BenchmarkServer : public Server {
+public:
+    BenchmarkServer(unsigned int port, const Pkey& pkey, const Dh& ec, const Cert& cert,
+                    const Options& options = {}) :
+        Server{port, pkey, ec, cert, options} {
+    }
+
+    explicit BenchmarkServer(unsigned int port, const Options& options = {}) : Server{port, options} {
+    }
+
+#ifndef _WIN32
+    explicit BenchmarkServer(const LocalEndpoint& endpoint, const Options& options = {}) :
+        Server{endpoint, options} {
+    }
+#endif
+
+    std::shared_ptr<Peer> waitForPeer() {
+        auto future = promise.get_future();
+        if (future.wait_for(std::chrono::milliseconds(1000)) != std::future_status::ready) {
+            throw std::runtime_error("Timeout waiting for the peer");
+        }
+        return future.get();
+    }
+
+protected:
+    void onAcceptSuccess(std::shared_ptr<Peer> peer) override {
+        promise.set_value(std::move(peer));
+    }
+
+private:
+    std::promise<std::shared_ptr<Peer>> promise;
+};
+
+TEST_CASE("Benchmark gathered writes over loopback", "[.][benchmark]") {
+    Pkey pkey{};
+    Cert cert{pkey};
+    Dh ec{};
+
+    // Large enough to hold all blocks of a gathered write
+    Options options{};
+    options.maxPooledBlocks = 4096;
+
+    BenchmarkServer server{8009, pkey, ec, cert, options};
+    server.start();
+
+    const size_t total = 200000;
+    std::atomic_size_t received{0};
+    std::promise<void> done;
+
+    Client client{};
+    client.addHandler([&](const std::shared_ptr<Peer>& peer, MessageTick msg) -> void {
+        if (received.fetch_add(1) + 1 == total) {
+            done.set_value();
+        }
+    });
+    client.start();
+    client.connect("localhost", 8009);
+
+    auto peer = server.waitForPeer();
+    auto future = done.get_future();
+
+    MessageTick tick{};
+    tick.payload = "ping";
+
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < total; i++) {
+        tick.seq = i;
+        peer->send(tick);
+    }
+
+    REQUIRE(future.wait_for(std::chrono::seconds(60)) == std::future_status::ready);
+    const auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    const auto stats = peer->getStats();
+    std::cout << "Messages: " << total << " in " << elapsed << " s (" << static_cast<size_t>(total / elapsed)
+              << " msg/s)" << std::endl;
+    std::cout << "Compressed blocks: " << stats.blocksQueued << ", socket writes: " << stats.writes
+              << ", blocks per write: " << static_cast<double>(stats.blocksQueued) / stats.writes
+              << ", bytes: " << stats.bytesWritten << std::endl;
+    std::cout << "Block buffers from pool: " << stats.poolHits << ", allocated: " << stats.poolMisses << std::endl;
+}
+
+TEST_CASE("Benchmark batched requests", "[.][benchmark]") {
+    Pkey pkey{};
+    Cert cert{pkey};
+    Dh ec{};
+
+    BenchmarkServer server{8009, pkey, ec, cert};
+    server.addHandler([](const std::shared_ptr<Peer>& peer, MessageTick msg) -> MessageTick { return msg; });
+    server.start();
+
+    Client client{};
+    client.start();
+    client.connect("localhost", 8009);
+    server.waitForPeer();
+
+    const size_t rounds = 200;
+
+    for (const size_t count : {50, 500}) {
+        std::vector<MessageTick> ticks(count);
+        for (size_t i = 0; i < count; i++) {
+            ticks[i].seq = i;
+            ticks[i].payload = "ping";
+        }
+
+        // Time spent by the requesting thread to issue the requests, and the whole round trip
+        std::chrono::steady_clock::duration singleIssue{0};
+        auto start = std::chrono::steady_clock::now();
+        for (size_t round = 0; round < rounds; round++) {
+            std::atomic_size_t received{0};
+            std::promise<void> done;
+            const auto issue = std::chrono::steady_clock::now();
+            for (const auto& tick : ticks) {
+                client.send(tick, [&](MessageTick res) {
+                    if (received.fetch_add(1) + 1 == count) {
+                        done.set_value();
+                    }
+                });
+            }
+            singleIssue += std::chrono::steady_clock::now() - issue;
+            REQUIRE(done.get_future().wait_for(std::chrono::seconds(10)) == std::future_status::ready);
+        }
+        const auto singleElapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        std::chrono::steady_clock::duration batchIssue{0};
+        start = std::chrono::steady_clock::now();
+        for (size_t round = 0; round < rounds; round++) {
+            std::promise<void> done;
+            const auto issue = std::chrono::steady_clock::now();
+            client.sendBatch(ticks, [&](std::vector<MessageTick> res) { done.set_value(); });
+            batchIssue += std::chrono::steady_clock::now() - issue;
+            REQUIRE(done.get_future().wait_for(std::chrono::seconds(10)) == std::future_status::ready);
+        }
+        const auto batchElapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        const auto toUs = [&](const std::chrono::steady_clock::duration d) {
+            return std::chrono::duration<double, std::micro>(d).count() / rounds;
+        };
+        std::cout << count << " requests, individual sends: " << singleElapsed * 1.0e6 / rounds
+                  << " us per round trip, " << toUs(singleIssue) << " us to issue" << std::endl;
+        std::cout << count << " requests, batch: " << batchElapsed * 1.0e6 / rounds << " us per round trip, "
+                  << toUs(batchIssue) << " us to issue" << std::endl;
+    }
+}
+
+TEST_CASE("Benchmark reactor scaling", "[.][benchmark]") {
+    Pkey pkey{};
+    Cert cert{pkey};
+    Dh ec{};
+
+    const size_t clientCount = 8;
+    const size_t perClient = 20000;
+
+    std::cout << "Hardware threads: " << std::thread::hardware_concurrency() << std::endl;
+
+    for (const size_t reactors : {1, 2, 4}) {
+        Options options{};
+        options.reactors = reactors;
+
+        Server server{8009, pkey, ec, cert, options};
+        server.addHandler([](const std::shared_ptr<Peer>& peer, MessageTick msg) -> MessageTick { return msg; });
+        server.start();
+
+        std::vector<std::unique_ptr<Client>> clients;
+        for (size_t i = 0; i < clientCount; i++) {
+            clients.push_back(std::make_unique<Client>());
+            clients.back()->start();
+            clients.back()->connect("localhost", 8009);
+        }
+
+        MessageTick tick{};
+        tick.payload = "ping";
+
+        std::atomic_size_t received{0};
+        std::promise<void> done;
+
+        const auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < perClient; i++) {
+            for (auto& client : clients) {
+                client->send(tick, [&](MessageTick res) {
+                    if (received.fetch_add(1) + 1 == clientCount * perClient) {
+                        done.set_value();
+                    }
+                });
+            }
+        }
+
+        REQUIRE(done.get_future().wait_for(std::chrono::seconds(60)) == std::future_status::ready);
+        const auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        std::cout << reactors << " reactors, " << clientCount << " clients: "
+                  << static_cast<size_t>(clientCount * perClient / elapsed) << " requests/s" << std::endl;
+    }
+}
+
+struct MessageSnapshot {
+    std::vector<uint64_t> values;
+
+    MESSAGE_DEFINE(MessageSnapshot, values);
+};
+
+TEST_CASE("Benchmark broadcast", "[.][benchmark]") {
+    Pkey pkey{};
+    Cert cert{pkey};
+    Dh ec{};
+
+    Server server{8009, pkey, ec, cert};
+    server.start();
+
+    MessageSnapshot snapshot{};
+    for (uint64_t i = 0; i < 1024; i++) {
+        snapshot.values.push_back(i * 0x9e3779b97f4a7c15ULL);
+    }
+
+    const size_t rounds = 50;
+    std::vector<std::unique_ptr<Client>> clients;
+
+    for (const size_t count : {10, 50, 200}) {
+        while (clients.size() < count) {
+            clients.push_back(std::make_unique<Client>());
+            clients.back()->addHandler([](const std::shared_ptr<Peer>& peer, MessageSnapshot msg) -> void {});
+            clients.back()->start();
+            clients.back()->connect("localhost", 8009);
+        }
+        while (server.getPeerCount() < count) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+
+        // Packed again for each peer
+        auto start = std::chrono::steady_clock::now();
+        for (size_t round = 0; round < rounds; round++) {
+            for (const auto& peer : server.getConnectedPeers()) {
+                peer->send(snapshot);
+            }
+        }
+        const auto sendElapsed = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start);
+
+        // Packed once
+        start = std::chrono::steady_clock::now();
+        for (size_t round = 0; round < rounds; round++) {
+            server.broadcast(snapshot);
+        }
+        const auto broadcastElapsed =
+            std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start);
+
+        std::cout << count << " peers, send to each: " << sendElapsed.count() / rounds
+                  << " us per message, broadcast: " << broadcastElapsed.count() / rounds << " us per message"
+                  << std::endl;
+    }
+}
+
+TEST_CASE("Benchmark packed messages", "[.][benchmark]") {
+    Pkey pkey{};
+    Cert cert{pkey};
+    Dh ec{};
+
+    BenchmarkServer server{8009, pkey, ec, cert};
+    server.start();
+
+    Client client{};
+    client.addHandler([](const std::shared_ptr<Peer>& peer, MessageSnapshot msg) -> void {});
+    client.start();
+    client.connect("localhost", 8009);
+
+    auto peer = server.waitForPeer();
+
+    MessageSnapshot snapshot{};
+    for (uint64_t i = 0; i < 1024; i++) {
+        snapshot.values.push_back(i * 0x9e3779b97f4a7c15ULL);
+    }
+
+    const size_t total = 2000;
+
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < total; i++) {
+        peer->send(snapshot);
+    }
+    const auto sendElapsed = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start);
+
+    start = std::chrono::steady_clock::now();
+    const PackedMessage<MessageSnapshot> packed{snapshot};
+    for (size_t i = 0; i < total; i++) {
+        peer->send(packed);
+    }
+    const auto packedElapsed = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start);
+
+    std::cout << "Message of " << packed.size() << " bytes, send: " << sendElapsed.count() / total
+              << " us per message, packed once: " << packedElapsed.count() / total << " us per message" << std::endl;
+}
+
+TEST_CASE("Benchmark bulk transfer", "[.][benchmark]") {
+    Pkey pkey{};
+    Cert cert{pkey};
+    Dh ec{};
+
+    // Random bytes are sent uncompressed, this measures the receive path
+    std::mt19937_64 rng{42};
+    MessageTick tick{};
+    tick.payload.resize(1024 * 64);
+    for (auto& c : tick.payload) {
+        c = static_cast<char>(rng());
+    }
+
+    const size_t total = 1024;
+
+    const auto run = [&](const char* name, const size_t minBuffer, const size_t maxBuffer) {
+        Options options{};
+        options.receiveBufferMin = minBuffer;
+        options.receiveBufferMax = maxBuffer;
+
+        std::atomic_size_t received{0};
+        std::promise<void> done;
+
+        BenchmarkServer server{8009, pkey, ec, cert, options};
+        server.addInlineHandler([&](const std::shared_ptr<Peer>& peer, MessageTick msg) -> void {
+            if (++received == total) {
+                done.set_value();
+            }
+        });
+        server.start();
+
+        Client client{};
+        client.start();
+        client.connect("localhost", 8009);
+
+        auto peer = server.waitForPeer();
+
+        const auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < total; i++) {
+            tick.seq = i;
+            client.send(tick);
+        }
+
+        REQUIRE(done.get_future().wait_for(std::chrono::seconds(60)) == std::future_status::ready);
+        const auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start);
+
+        const auto stats = peer->getStats();
+        const auto megabytes = static_cast<double>(stats.bytesRead) / (1024.0 * 1024.0);
+        std::cout << name << ": " << megabytes / elapsed.count() << " MB/s, " << stats.reads << " reads ("
+                  << stats.bytesRead / std::max<uint64_t>(stats.reads, 1) << " bytes per read), buffer "
+                  << stats.receiveBufferBytes << " bytes" << std::endl;
+    };
+
+    run("Fixed 1KB buffer", 1024, 1024);
+    run("Adaptive 16KB to 1MB buffer", 1024 * 16, 1024 * 1024);
+}
+
+TEST_CASE("Benchmark handlers on the executor", "[.][benchmark]") {
+    Pkey pkey{};
+    Cert cert{pkey};
+    Dh ec{};
+
+    const size_t clientCount = 4;
+    const size_t perClient = 200;
+
+    for (const size_t threads : {0, 4}) {
+        Server server{8009, pkey, ec, cert};
+        auto executor = threads > 0 ? std::make_shared<Executor>(threads) : nullptr;
+        server.setExecutor(executor);
+
+        // A handler that waits for something else, a database for example
+        server.addHandler([](const std::shared_ptr<Peer>& peer, MessageTick msg) -> MessageTick {
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+            return msg;
+        });
+        server.start();
+
+        std::vector<std::unique_ptr<Client>> clients;
+        for (size_t i = 0; i < clientCount; i++) {
+            clients.push_back(std::make_unique<Client>());
+            clients.back()->start();
+            clients.back()->connect("localhost", 8009);
+        }
+
+        MessageTick tick{};
+        tick.payload = "ping";
+
+        std::atomic_size_t received{0};
+        std::promise<void> done;
+
+        const auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < perClient; i++) {
+            for (auto& client : clients) {
+                client->send(tick, [&](MessageTick res) {
+                    if (received.fetch_add(1) + 1 == clientCount * perClient) {
+                        done.set_value();
+                    }
+                });
+            }
+        }
+
+        REQUIRE(done.get_future().wait_for(std::chrono::seconds(60)) == std::future_status::ready);
+        const auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        if (executor) {
+            executor->stop();
+        }
+
+        std::cout << (threads > 0 ? "Executor with " + std::to_string(threads) + " threads" : "I/O thread") << ": "
+                  << static_cast<size_t>(clientCount * perClient / elapsed) << " requests/s" << std::endl;
+    }
+}
+
+TEST_CASE("Benchmark inline dispatch latency", "[.][benchmark]") {
+    Pkey pkey{};
+    Cert cert{pkey};
+    Dh ec{};
+
+    const size_t total = 20000;
+
+    for (const bool inlined : {false, true}) {
+        Options options{};
+        options.inlineDispatch = inlined;
+
+        BenchmarkServer server{8009, pkey, ec, cert, options};
+        server.addHandler([](const std::shared_ptr<Peer>& peer, MessageTick msg) -> MessageTick { return msg; });
+        server.start();
+
+        Client client{options};
+        client.start();
+        client.connect("localhost", 8009);
+        server.waitForPeer();
+
+        MessageTick tick{};
+        tick.payload = "ping";
+
+        // One request at the time, the round trip of a trivial RPC
+        std::vector<double> latencies;
+        latencies.reserve(total);
+        for (size_t i = 0; i < total; i++) {
+            std::promise<void> done;
+            const auto start = std::chrono::steady_clock::now();
+            client.send(tick, [&](MessageTick res) { done.set_value(); });
+            done.get_future().wait();
+            latencies.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start)
+                                    .count());
+        }
+
+        std::sort(latencies.begin(), latencies.end());
+
+        // A burst of one way messages, the cost of the dispatch itself on the server
+        const size_t burst = 200000;
+        std::atomic_size_t received{0};
+        std::promise<void> done;
+        server.addHandler([&](const std::shared_ptr<Peer>& peer, MessageSnapshot msg) -> void {
+            if (received.fetch_add(1) + 1 == burst) {
+                done.set_value();
+            }
+        });
+
+        const MessageSnapshot snapshot{};
+        const auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < burst; i++) {
+            client.send(snapshot);
+        }
+        REQUIRE(done.get_future().wait_for(std::chrono::seconds(60)) == std::future_status::ready);
+        const auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        std::cout << (inlined ? "Inline dispatch" : "Posted dispatch") << ", p50: " << latencies[total / 2]
+                  << " us, p99: " << latencies[total * 99 / 100] << " us, burst: "
+                  << static_cast<size_t>(burst / elapsed) << " msg/s" << std::endl;
+    }
+}
+
+TEST_CASE("Benchmark TLS and plain TCP", "[.][benchmark]") {
+    Pkey pkey{};
+    Cert cert{pkey};
+    Dh ec{};
+
+    // Random bytes are sent uncompressed, this measures the cost of the transport
+    std::mt19937_64 rng{42};
+    MessageTick tick{};
+    tick.payload.resize(1024 * 64);
+    for (auto& c : tick.payload) {
+        c = static_cast<char>(rng());
+    }
+
+    const size_t total = 2048;
+    const size_t connections = 200;
+
+    for (const bool tls : {true, false}) {
+        Options options{};
+        options.tls = tls;
+
+        // Connection setup, including the handshake
+        double setup = 0.0;
+        {
+            Server server = tls ? Server{8009, pkey, ec, cert, options} : Server{8009, options};
+            server.start();
+
+            for (size_t i = 0; i < connections; i++) {
+                Client client{options};
+                client.start();
+
+                const auto start = std::chrono::steady_clock::now();
+                client.connect("localhost", 8009);
+                setup += std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+            }
+        }
+
+        std::atomic_size_t received{0};
+        std::promise<void> done;
+
+        auto server = tls ? std::make_unique<BenchmarkServer>(8009, pkey, ec, cert, options)
+                          : std::make_unique<BenchmarkServer>(8009, options);
+        server->addInlineHandler([&](const std::shared_ptr<Peer>& peer, MessageTick msg) -> void {
+            if (++received == total) {
+                done.set_value();
+            }
+        });
+        server->start();
+
+        Client client{options};
+        client.start();
+        client.connect("localhost", 8009);
+        auto peer = server->waitForPeer();
+
+        // Both sides run in this process, the CPU time covers the encryption and the decryption
+        const auto cpu = std::clock();
+        const auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < total; i++) {
+            tick.seq = i;
+            client.send(tick);
+        }
+
+        REQUIRE(done.get_future().wait_for(std::chrono::seconds(60)) == std::future_status::ready);
+        const auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        const auto seconds = static_cast<double>(std::clock() - cpu) / CLOCKS_PER_SEC;
+
+        const auto megabytes = static_cast<double>(peer->getStats().bytesRead) / (1024.0 * 1024.0);
+        std::cout << (tls ? "TLS" : "Plain TCP") << ", connect: " << setup / connections
+                  << " us, throughput: " << megabytes / elapsed << " MB/s, CPU: " << seconds * 1000.0 / megabytes
+                  << " ms per MB" << std::endl;
+    }
+}
+
+#ifndef _WIN32
+TEST_CASE("Benchmark Unix domain sockets", "[.][benchmark]") {
+    // Random bytes are sent uncompressed, this measures the cost of the transport
+    std::mt19937_64 rng{42};
+    MessageTick bulk{};
+    bulk.payload.resize(1024 * 64);
+    for (auto& c : bulk.payload) {
+        c = static_cast<char>(rng());
+    }
+
+    const size_t roundTrips = 20000;
+    const size_t total = 2048;
+
+    for (const bool local : {false, true}) {
+        Options options{};
+        options.tls = false;
+        options.inlineDispatch = true;
+
+        const LocalEndpoint endpoint{std::string{'\0'} + "msgnet_benchmark"};
+
+        std::atomic_size_t received{0};
+        std::promise<void> done;
+
+        auto server = local ? std::make_unique<BenchmarkServer>(endpoint, options)
+                            : std::make_unique<BenchmarkServer>(8009, options);
+        server->addHandler([](const std::shared_ptr<Peer>& peer, MessageSnapshot msg) -> MessageSnapshot {
+            return msg;
+        });
+        server->addHandler([&](const std::shared_ptr<Peer>& peer, MessageTick msg) -> void {
+            if (++received == total) {
+                done.set_value();
+            }
+        });
+        server->start();
+
+        Client client{options};
+        client.start();
+        if (local) {
+            client.connectLocal(endpoint);
+        } else {
+            client.connect("localhost", 8009);
+        }
+        auto peer = server->waitForPeer();
+
+        const MessageSnapshot ping{};
+
+        // One request at the time, the round trip of a trivial RPC
+        std::vector<double> latencies;
+        latencies.reserve(roundTrips);
+        for (size_t i = 0; i < roundTrips; i++) {
+            std::promise<void> response;
+            const auto start = std::chrono::steady_clock::now();
+            client.send(ping, [&](MessageSnapshot res) { response.set_value(); });
+            response.get_future().wait();
+            latencies.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start)
+                                    .count());
+        }
+
+        std::sort(latencies.begin(), latencies.end());
+
+        const auto before = peer->getStats().bytesRead;
+        const auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < total; i++) {
+            bulk.seq = i;
+            client.send(bulk);
+        }
+
+        REQUIRE(done.get_future().wait_for(std::chrono::seconds(60)) == std::future_status::ready);
+        const auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        const auto megabytes = static_cast<double>(peer->getStats().bytesRead - before) / (1024.0 * 1024.0);
+
+        std::cout << (local ? "Unix domain socket" : "TCP loopback") << ", p50: " << latencies[roundTrips / 2]
+                  << " us, p99: " << latencies[roundTrips * 99 / 100] << " us, throughput: " << megabytes / elapsed
+                  << " MB/s" << std::endl;
+    }
+}
+#endif
+
+#ifdef __linux__
+TEST_CASE("Benchmark shared memory round trips", "[.][benchmark]") {
+    // Random bytes are sent uncompressed, this measures the cost of the transport
+    std::mt19937_64 rng{42};
+    MessageTick bulk{};
+    bulk.payload.resize(1024 * 64);
+    for (auto& c : bulk.payload) {
+        c = static_cast<char>(rng());
+    }
+
+    const size_t roundTrips = 20000;
+    const size_t total = 2048;
+    const LocalEndpoint endpoint{std::string{'\0'} + "msgnet_benchmark_shm"};
+
+    const auto run = [&](const char* name, const bool shm, const std::chrono::microseconds spin) {
+        Options options{};
+        options.inlineDispatch = true;
+        options.sharedMemory = shm;
+        options.sharedMemorySpin = spin;
+
+        std::atomic_size_t received{0};
+        std::promise<void> done;
+
+        BenchmarkServer server{endpoint, options};
+        server.addHandler([](const std::shared_ptr<Peer>& peer, MessageSnapshot msg) -> MessageSnapshot {
+            return msg;
+        });
+        server.addHandler([&](const std::shared_ptr<Peer>& peer, MessageTick msg) -> void {
+            if (++received == total) {
+                done.set_value();
+            }
+        });
+        server.start();
+
+        Client client{options};
+        client.start();
+        client.connectLocal(endpoint);
+        auto peer = server.waitForPeer();
+
+        const MessageSnapshot ping{};
+
+        // One request at the time, the round trip of a trivial RPC
+        std::vector<double> latencies;
+        latencies.reserve(roundTrips);
+        for (size_t i = 0; i < roundTrips; i++) {
+            std::promise<void> response;
+            const auto start = std::chrono::steady_clock::now();
+            client.send(ping, [&](MessageSnapshot res) { response.set_value(); });
+            response.get_future().wait();
+            latencies.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start)
+                                    .count());
+        }
+
+        std::sort(latencies.begin(), latencies.end());
+
+        const auto before = peer->getStats().bytesRead;
+        const auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < total; i++) {
+            bulk.seq = i;
+            client.send(bulk);
+        }
+
+        REQUIRE(done.get_future().wait_for(std::chrono::seconds(60)) == std::future_status::ready);
+        const auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        const auto megabytes = static_cast<double>(peer->getStats().bytesRead - before) / (1024.0 * 1024.0);
+
+        std::cout << name << ", p50: " << latencies[roundTrips / 2] << " us, p99: " << latencies[roundTrips * 99 / 100]
+                  << " us, throughput: " << megabytes / elapsed << " MB/s, reads: " << peer->getStats().reads
+                  << std::endl;
+    };
+
+    run("Unix domain socket", false, std::chrono::microseconds{0});
+    run("Shared memory", true, std::chrono::microseconds{0});
+    run("Shared memory, 50 us spin", true, std::chrono::microseconds{50});
+}
+#endif
@@ -0,0 +1,207 @@
+#include <catch.hpp>
+
+// The coroutine support needs C++20, configure with -DMSGNET_CXX20=ON to build these tests
+#if defined(__cpp_impl_coroutine)
+
+#include <future>
+#include <msgnet/client.hpp>
+#include <msgnet/coroutine.hpp>
+#include <msgnet/server.hpp>
+
+using namespace MsgNet;
+
+struct MessageSquareRequest {
+    uint64_t value{0};
+
+    MESSAGE_DEFINE(MessageSquareRequest, value);
+};
+
+struct MessageSquareResponse {
+    uint64_t value{0};
+
+    MESSAGE_DEFINE(MessageSquareResponse, value);
+};
+
+struct MessageOffsetRequest {
+    uint64_t value{0};
+
+    MESSAGE_DEFINE(MessageOffsetRequest, value);
+};
+
+struct MessageThrowing {
+    uint64_t value{0};
+
+    MESSAGE_DEFINE(MessageThrowing, value);
+};
+
+struct MessageIgnored {
+    uint64_t value{0};
+
+    MESSAGE_DEFINE(MessageIgnored, value);
+};
+
+class CoroutineServer : public Server {
+public:
+    CoroutineServer(unsigned int port, const Pkey& pkey, const Dh& ec, const Cert& cert) :
+        Server{port, pkey, ec, cert} {
+
+        // Asks the client for an offset before responding
+        addHandler([](const PeerPtr& peer, MessageSquareRequest req) -> Task<MessageSquareResponse> {
+            MessageOffsetRequest offset{};
+            offset.value = req.value;
+            const auto res = co_await peer->request<MessageSquareResponse>(offset);
+
+            MessageSquareResponse square{};
+            square.value = req.value * req.value + res.value;
+            co_return square;
+        });
+
+        addHandler([](const PeerPtr& peer, MessageIgnored req) -> Task<void> { co_return; });
+
+        addHandler([](const PeerPtr& peer, MessageThrowing req) -> Task<MessageSquareResponse> {
+            throw std::runtime_error("Coroutine handler failed");
+            co_return MessageSquareResponse{};
+        });
+
+        start();
+    }
+
+    ~CoroutineServer() {
+        stop();
+    }
+};
+
+class CoroutineClient : public Client {
+public:
+    CoroutineClient(const std::string& address, unsigned int port) {
+        addHandler([](const PeerPtr& peer, MessageOffsetRequest req) -> Task<MessageSquareResponse> {
+            MessageSquareResponse res{};
+            res.value = 1000;
+            co_return res;
+        });
+
+        start();
+        connect(address, port);
+    }
+
+    ~CoroutineClient() {
+        stop();
+    }
+};
+
+TEST_CASE("Chain requests with coroutines") {
+    Pkey pkey{};
+    Cert cert{pkey};
+    Dh ec{};
+
+    CoroutineServer server{8009, pkey, ec, cert};
+    CoroutineClient client{"localhost", 8009};
+
+    std::promise<std::vector<uint64_t>> promise;
+
+    // The closure must outlive the coroutine, it holds the captures
+    auto chain = [&]() -> Task<void> {
+        std::vector<uint64_t> values;
+        for (uint64_t i = 1; i <= 3; i++) {
+            MessageSquareRequest req{};
+            req.value = i;
+            const auto res = co_await client.request<MessageSquareResponse>(req);
+            values.push_back(res.value);
+        }
+        promise.set_value(std::move(values));
+    };
+    auto task = chain();
+
+    auto future = promise.get_future();
+    REQUIRE(future.wait_for(std::chrono::milliseconds(1000)) == std::future_status::ready);
+    REQUIRE(future.get() == std::vector<uint64_t>{1001, 1004, 1009});
+}
+
+TEST_CASE("Await a request with a temporary or a packed message") {
+    Pkey pkey{};
+    Cert cert{pkey};
+    Dh ec{};
+
+    CoroutineServer server{8009, pkey, ec, cert};
+    CoroutineClient client{"localhost", 8009};
+
+    std::promise<std::vector<uint64_t>> promise;
+
+    // The message is packed before the coroutine suspends, it does not have to outlive the co_await
+    auto requests = [&]() -> Task<void> {
+        std::vector<uint64_t> values;
+        values.push_back((co_await client.request<MessageSquareResponse>(MessageSquareRequest{2})).value);
+
+        const PackedMessage<MessageSquareRequest> packed{MessageSquareRequest{3}};
+        values.push_back((co_await client.request<MessageSquareResponse>(packed)).value);
+        promise.set_value(std::move(values));
+    };
+    auto task = requests();
+
+    auto future = promise.get_future();
+    REQUIRE(future.wait_for(std::chrono::milliseconds(1000)) == std::future_status::ready);
+    REQUIRE(future.get() == std::vector<uint64_t>{1004, 1009});
+}
+
+TEST_CASE("Coroutine request times out") {
+    Pkey pkey{};
+    Cert cert{pkey};
+    Dh ec{};
+
+    CoroutineServer server{8009, pkey, ec, cert};
+    CoroutineClient client{"localhost", 8009};
+
+    std::promise<std::error_code> promise;
+
+    // The server handler of this message has no response
+    auto timeout = [&]() -> Task<void> {
+        try {
+            MessageIgnored req{};
+            co_await client.request<MessageSquareResponse>(req, std::chrono::milliseconds(50));
+            promise.set_value({});
+        } catch (std::system_error& e) {
+            promise.set_value(e.code());
+        }
+    };
+    auto task = timeout();
+
+    auto future = promise.get_future();
+    REQUIRE(future.wait_for(std::chrono::milliseconds(1000)) == std::future_status::ready);
+    REQUIRE(future.get() == Error::RequestTimeout);
+}
+
+TEST_CASE("Exception of a coroutine handler goes to the error handler") {
+    Pkey pkey{};
+    Cert cert{pkey};
+    Dh ec{};
+
+    CoroutineServer server{8009, pkey, ec, cert};
+
+    std::promise<std::string> promise;
+    server.setPeerExceptionCallback([&](const std::shared_ptr<Peer>& peer, std::exception_ptr& eptr) {
+        try {
+            std::rethrow_exception(eptr);
+        } catch (std::exception& e) {
+            promise.set_value(e.what());
+        }
+    });
+
+    CoroutineClient client{"localhost", 8009};
+    client.send(MessageThrowing{});
+
+    auto future = promise.get_future();
+    REQUIRE(future.wait_for(std::chrono::milliseconds(1000)) == std::future_status::ready);
+    REQUIRE(future.get() == "Coroutine handler failed");
+}
+
+TEST_CASE("Await a task from another task") {
+    auto inner = []() -> Task<int> { co_return 21; };
+    auto outer = [&]() -> Task<int> { co_return co_await inner() * 2; };
+
+    int result{0};
+    auto awaiting = [&]() -> Task<void> { result = co_await outer(); };
+    auto task = awaiting();
+    REQUIRE(result == 42);
+}
+
+#endif
@@ -2,7 +2,9 @@
 #include <msgnet/dh.hpp>
 #include <msgnet/pkey.hpp>
 #include <msgnet/cert.hpp>
+#include <msgnet/message.hpp>
 #include <cstring>
+#include <openssl/sha.h>
 
 using namespace MsgNet;
 
@@ -49,3 +51,22 @@ TEST_CASE("Generate random certificate and then load it back") {
 
     REQUIRE(Cert{pem}.pem() == pem);
 }
+
+TEST_CASE("Message hash matches the first bytes of SHA-256") {
+    // Covers the padding of one, two, and three blocks
+    const auto length = GENERATE(range(0, 150));
+    std::string name;
+    for (auto i = 0; i < length; i++) {
+        name.push_back(static_cast<char>('A' + i % 26));
+    }
+
+    unsigned char digest[SHA256_DIGEST_LENGTH];
+    SHA256(reinterpret_cast<const unsigned char*>(name.data()), name.size(), digest);
+
+    uint64_t expected{0};
+    for (auto i = 0; i < 8; i++) {
+        expected |= uint64_t{digest[i]} << (i * 8);
+    }
+
+    REQUIRE(Detail::getMessageHash(name) == expected);
+}
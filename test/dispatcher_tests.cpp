@@ -0,0 +1,144 @@
+#include <catch.hpp>
+#include <chrono>
+#include <iostream>
+#include <msgnet/dispatcher.hpp>
+#include <random>
+
+using namespace MsgNet;
+
+template <size_t N> struct MessageNumbered {
+    uint64_t value{0};
+
+    static inline const uint64_t hash = Detail::getMessageHash("MessageNumbered" + std::to_string(N));
+    MSGPACK_DEFINE_ARRAY(value);
+};
+
+class TestDispatcher : public ErrorHandler, public Dispatcher {
+public:
+    TestDispatcher() : Dispatcher{static_cast<ErrorHandler&>(*this)} {
+    }
+
+    void postDispatch(std::function<void()> fn) override {
+        fn();
+    }
+
+    void onError(const std::shared_ptr<Peer>& peer, std::error_code ec) override {
+        (void)peer;
+        errors.push_back(ec);
+    }
+
+    template <size_t... Ns> void addCounters(std::vector<uint64_t>& counters, std::index_sequence<Ns...>) {
+        counters.resize(sizeof...(Ns));
+        (addHandler([&counters](const PeerPtr& peer, MessageNumbered<Ns> msg) -> void {
+             (void)peer;
+             counters[Ns] += msg.value;
+         }),
+         ...);
+    }
+
+    std::vector<std::error_code> errors;
+};
+
+template <size_t... Ns> static std::vector<uint64_t> getHashes(std::index_sequence<Ns...>) {
+    return {MessageNumbered<Ns>::hash...};
+}
+
+static msgpack::object_handle packValue(const uint64_t value) {
+    msgpack::sbuffer sbuf;
+    msgpack::pack(sbuf, MessageNumbered<0>{value});
+    return msgpack::unpack(sbuf.data(), sbuf.size());
+}
+
+TEST_CASE("Sealed dispatcher routes every message to its handler") {
+    using Types = std::make_index_sequence<64>;
+
+    const auto sealed = GENERATE(false, true);
+
+    TestDispatcher dispatcher{};
+    std::vector<uint64_t> counters;
+    dispatcher.addCounters(counters, Types{});
+
+    if (sealed) {
+        dispatcher.seal();
+    }
+    REQUIRE(dispatcher.isSealed() == sealed);
+
+    const auto oh = packValue(1);
+    const auto hashes = getHashes(Types{});
+    for (size_t i = 0; i < hashes.size(); i++) {
+        for (size_t n = 0; n <= i; n++) {
+            dispatcher.dispatch(nullptr, hashes[i], 0, oh.get());
+        }
+    }
+
+    for (size_t i = 0; i < counters.size(); i++) {
+        REQUIRE(counters[i] == i + 1);
+    }
+    REQUIRE(dispatcher.errors.empty());
+
+    // Unknown message
+    dispatcher.dispatch(nullptr, Detail::getMessageHash("MessageUnknown"), 0, oh.get());
+    dispatcher.dispatch(nullptr, 0, 0, oh.get());
+    REQUIRE(dispatcher.errors.size() == 2);
+    REQUIRE(dispatcher.errors.front() == Error::UnexpectedRequest);
+}
+
+TEST_CASE("Sealed dispatcher rejects new handlers") {
+    TestDispatcher dispatcher{};
+    dispatcher.seal();
+    dispatcher.seal();
+
+    REQUIRE_THROWS(dispatcher.addHandler([](const std::shared_ptr<Peer>& peer, MessageNumbered<0> msg) -> void {
+        (void)peer;
+        (void)msg;
+    }));
+
+    // Nothing is registered
+    const auto oh = packValue(1);
+    dispatcher.dispatch(nullptr, MessageNumbered<0>::hash, 0, oh.get());
+    REQUIRE(dispatcher.errors.size() == 1);
+}
+
+TEST_CASE("Benchmark sealed dispatch", "[.][benchmark]") {
+    using Types = std::make_index_sequence<150>;
+
+    TestDispatcher map{};
+    TestDispatcher sealed{};
+    std::vector<uint64_t> mapCounters;
+    std::vector<uint64_t> sealedCounters;
+    map.addCounters(mapCounters, Types{});
+    sealed.addCounters(sealedCounters, Types{});
+    sealed.seal();
+
+    // Random order of messages, so the branch predictor does not learn the lookups
+    const auto hashes = getHashes(Types{});
+    std::mt19937_64 rng{42};
+    std::uniform_int_distribution<size_t> dist{0, hashes.size() - 1};
+    std::vector<uint64_t> ids(1 << 20);
+    for (auto& id : ids) {
+        id = hashes[dist(rng)];
+    }
+
+    const auto oh = packValue(1);
+    const auto measure = [&](TestDispatcher& dispatcher) {
+        const auto start = std::chrono::steady_clock::now();
+        for (auto round = 0; round < 8; round++) {
+            for (const auto id : ids) {
+                dispatcher.dispatch(nullptr, id, 0, oh.get());
+            }
+        }
+        const auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        return elapsed * 1.0e9 / (ids.size() * 8);
+    };
+
+    const auto mapNs = measure(map);
+    const auto sealedNs = measure(sealed);
+
+    REQUIRE(mapCounters == sealedCounters);
+    REQUIRE(map.errors.empty());
+    REQUIRE(sealed.errors.empty());
+
+    std::cout << "Dispatch over " << hashes.size() << " message types" << std::endl;
+    std::cout << "unordered_map: " << mapNs << " ns/message" << std::endl;
+    std::cout << "Sealed table: " << sealedNs << " ns/message" << std::endl;
+}
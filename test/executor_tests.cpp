@@ -0,0 +1,123 @@
+#include <catch.hpp>
+#include <future>
+#include <msgnet/executor.hpp>
+#include <set>
+#include <thread>
+
+using namespace MsgNet;
+
+TEST_CASE("Executor keeps the order of the tasks per key") {
+    const size_t keys = 64;
+    const size_t perKey = 1000;
+
+    std::vector<std::vector<size_t>> results(keys);
+    std::atomic_size_t remaining{keys * perKey};
+    std::promise<void> done;
+
+    Executor executor{4, 16};
+    REQUIRE(executor.getThreadCount() == 4);
+
+    // Multiple keys share a lane, each key is only ever executed by one thread at the time
+    for (size_t i = 0; i < perKey; i++) {
+        for (size_t key = 0; key < keys; key++) {
+            executor.post(key, [&, key, i]() {
+                results[key].push_back(i);
+                if (remaining.fetch_sub(1) == 1) {
+                    done.set_value();
+                }
+            });
+        }
+    }
+
+    REQUIRE(done.get_future().wait_for(std::chrono::seconds(10)) == std::future_status::ready);
+
+    for (const auto& result : results) {
+        REQUIRE(result.size() == perKey);
+        for (size_t i = 0; i < perKey; i++) {
+            REQUIRE(result[i] == i);
+        }
+    }
+}
+
+TEST_CASE("Executor runs the different keys in parallel") {
+    Executor executor{4};
+
+    std::mutex mutex;
+    std::set<std::thread::id> threads;
+    std::atomic_size_t remaining{4};
+    std::promise<void> done;
+
+    // Each task waits for the others, so all of them must run at the same time
+    for (uint64_t key = 0; key < 4; key++) {
+        executor.post(key, [&]() {
+            {
+                std::lock_guard<std::mutex> lock{mutex};
+                threads.insert(std::this_thread::get_id());
+            }
+            if (remaining.fetch_sub(1) == 1) {
+                done.set_value();
+            }
+            while (remaining.load() > 0) {
+                std::this_thread::yield();
+            }
+        });
+    }
+
+    REQUIRE(done.get_future().wait_for(std::chrono::seconds(10)) == std::future_status::ready);
+
+    std::lock_guard<std::mutex> lock{mutex};
+    REQUIRE(threads.size() == 4);
+}
+
+TEST_CASE("Executor tasks posted by the tasks themselves") {
+    Executor executor{2};
+
+    std::atomic_size_t count{0};
+    std::promise<void> done;
+
+    std::function<void(size_t)> next = [&](const size_t depth) {
+        count++;
+        if (depth == 1000) {
+            done.set_value();
+            return;
+        }
+        executor.post(depth % 7, [&, depth]() { next(depth + 1); });
+    };
+    executor.post(0, [&]() { next(0); });
+
+    REQUIRE(done.get_future().wait_for(std::chrono::seconds(10)) == std::future_status::ready);
+    REQUIRE(count.load() == 1001);
+
+    executor.stop();
+    executor.stop();
+}
+
+TEST_CASE("Executor drops the tasks once stopped") {
+    Executor executor{1};
+
+    auto token = std::make_shared<int>(0);
+    std::promise<void> started;
+    std::atomic_bool release{false};
+
+    executor.post(0, [&]() {
+        started.set_value();
+        while (!release.load()) {
+            std::this_thread::yield();
+        }
+    });
+    started.get_future().wait();
+
+    // Waits behind the running task, the worker stops before getting to it
+    executor.post(0, [token]() {});
+    REQUIRE(token.use_count() == 2);
+
+    std::thread stopper{[&]() { executor.stop(); }};
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    release = true;
+    stopper.join();
+    REQUIRE(token.use_count() == 1);
+
+    // Nothing would ever run it
+    executor.post(0, [token]() {});
+    REQUIRE(token.use_count() == 1);
+}
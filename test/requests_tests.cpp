@@ -0,0 +1,197 @@
+#include <atomic>
+#include <catch.hpp>
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <msgnet/requests.hpp>
+#include <thread>
+#include <unordered_map>
+
+using namespace MsgNet;
+
+static msgpack::object_handle packValue(const uint64_t value) {
+    msgpack::sbuffer sbuf;
+    msgpack::pack(sbuf, value);
+    return msgpack::unpack(sbuf.data(), sbuf.size());
+}
+
+TEST_CASE("Inline function stores small functors inline") {
+    using Function = InlineFunction<int(int)>;
+
+    auto shared = std::make_shared<int>(10);
+    auto small = [shared](const int value) { return *shared + value; };
+    struct {
+        char data[128];
+    } large{};
+    large.data[0] = 20;
+    auto big = [large](const int value) { return large.data[0] + value; };
+
+    static_assert(Function::isInline<decltype(small)>());
+    static_assert(!Function::isInline<decltype(big)>());
+
+    Function a{small};
+    Function b{big};
+    REQUIRE(a(1) == 11);
+    REQUIRE(b(1) == 21);
+    REQUIRE(shared.use_count() == 3);
+
+    // Move between the inline and the heap storage
+    Function c{std::move(a)};
+    REQUIRE(!a);
+    REQUIRE(c(2) == 12);
+    c = std::move(b);
+    REQUIRE(!b);
+    REQUIRE(c(2) == 22);
+    REQUIRE(shared.use_count() == 2);
+
+    c.reset();
+    REQUIRE(!c);
+}
+
+TEST_CASE("Request table matches responses with the requests") {
+    RequestTable table{};
+    const auto oh = packValue(42);
+
+    uint64_t received{0};
+    const auto first = table.add([&](const msgpack::object& object) { received += object.as<uint64_t>(); });
+    const auto second = table.add([&](const msgpack::object& object) { received += object.as<uint64_t>() * 2; });
+    REQUIRE(first != 0);
+    REQUIRE(first != second);
+    REQUIRE(table.size() == 2);
+
+    RequestTable::Callback callback;
+    REQUIRE(table.take(second, callback));
+    callback(oh.get());
+    REQUIRE(received == 84);
+
+    // Duplicate response
+    REQUIRE(!table.take(second, callback));
+
+    // The slot is reused by the next request, with a different generation
+    const auto third = table.add([&](const msgpack::object& object) { received += object.as<uint64_t>() * 3; });
+    REQUIRE(third != second);
+    REQUIRE((third & 0xffffffffULL) == (second & 0xffffffffULL));
+    REQUIRE(!table.take(second, callback));
+
+    REQUIRE(table.take(third, callback));
+    callback(oh.get());
+    REQUIRE(table.take(first, callback));
+    callback(oh.get());
+    REQUIRE(received == 84 + 126 + 42);
+    REQUIRE(table.size() == 0);
+
+    // Unknown IDs
+    REQUIRE(!table.take(0, callback));
+    REQUIRE(!table.take(0xffffffffffffffffULL, callback));
+}
+
+TEST_CASE("Request table from multiple threads") {
+    RequestTable table{};
+    const auto oh = packValue(1);
+
+    std::atomic_uint64_t received{0};
+    std::vector<std::thread> threads;
+    for (auto t = 0; t < 8; t++) {
+        threads.emplace_back([&]() {
+            std::vector<uint64_t> ids;
+            for (auto i = 0; i < 1000; i++) {
+                ids.push_back(table.add([&](const msgpack::object& object) { received += object.as<uint64_t>(); }));
+            }
+            for (const auto id : ids) {
+                RequestTable::Callback callback;
+                if (table.take(id, callback)) {
+                    callback(oh.get());
+                }
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    REQUIRE(received == 8000);
+    REQUIRE(table.size() == 0);
+}
+
+// Replica of the previous pending requests storage, for the benchmark only.
+class LegacyRequestTable {
+public:
+    using Callback = std::function<void(const msgpack::object& object)>;
+
+    uint64_t add(Callback callback) {
+        const auto reqId = nextId.fetch_add(1ULL);
+        std::lock_guard<std::mutex> lock{mutex};
+        map[reqId] = std::move(callback);
+        return reqId;
+    }
+
+    bool take(const uint64_t reqId, Callback& callback) {
+        std::lock_guard<std::mutex> lock{mutex};
+        auto it = map.find(reqId);
+        if (it == map.end()) {
+            return false;
+        }
+        std::swap(it->second, callback);
+        map.erase(it);
+        return true;
+    }
+
+private:
+    std::atomic_uint64_t nextId{0};
+    std::mutex mutex;
+    std::unordered_map<uint64_t, Callback> map;
+};
+
+template <typename Table> static double benchmarkRequests(const size_t numThreads, const size_t perThread) {
+    Table table{};
+    const auto oh = packValue(1);
+
+    std::atomic_bool go{false};
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < numThreads; t++) {
+        threads.emplace_back([&]() {
+            while (!go.load()) {
+                std::this_thread::yield();
+            }
+
+            // Keep a window of requests in flight, as a client waiting for responses would
+            uint64_t sum{0};
+            uint64_t window[16]{};
+            for (size_t i = 0; i < perThread; i += 16) {
+                for (auto& id : window) {
+                    id = table.add([&sum](const msgpack::object& object) { sum += object.via.u64; });
+                }
+                for (const auto id : window) {
+                    typename Table::Callback callback;
+                    if (table.take(id, callback)) {
+                        callback(oh.get());
+                    }
+                }
+            }
+            if (sum == 0) {
+                throw std::runtime_error("No responses");
+            }
+        });
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    go.store(true);
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    const auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    return static_cast<double>(numThreads * perThread) / elapsed / 1.0e6;
+}
+
+TEST_CASE("Benchmark pending requests under contention", "[.][benchmark]") {
+    const size_t perThread = 1 << 18;
+
+    std::cout << "Threads, mutex + unordered_map, sharded slot table (million requests/s)" << std::endl;
+    for (const size_t numThreads : {1, 2, 4, 8, 16, 32}) {
+        const auto legacy = benchmarkRequests<LegacyRequestTable>(numThreads, perThread);
+        const auto sharded = benchmarkRequests<RequestTable>(numThreads, perThread);
+        std::cout << numThreads << ", " << legacy << ", " << sharded << std::endl;
+    }
+}
@@ -1,8 +1,28 @@
+#include <array>
 #include <catch.hpp>
 #include <cstring>
+#include <deque>
+#include <fstream>
 #include <iostream>
+#include <map>
+#include <numeric>
+#include <random>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#endif
 #include <msgnet/client.hpp>
 #include <msgnet/server.hpp>
+#ifdef __linux__
+#include <msgnet/shm.hpp>
+#endif
 
 using namespace MsgNet;
 
@@ -87,9 +107,32 @@ TEST_CASE("Message hash sanity check") {
     REQUIRE(MessageBar::hash == 0xcb4327037bc501e8);
 }
 
+TEST_CASE("Message hash is a compile time constant") {
+    static_assert(MessageBar::hash == 0xcb4327037bc501e8);
+    static_assert(hasUniqueMessageHashes<MessageFoo, MessageBar, MessageBaz>());
+    static_assert(!hasUniqueMessageHashes<MessageFoo, MessageBar, MessageFoo>());
+
+    switch (MessageBaz::hash) {
+    case MessageFoo::hash:
+    case MessageBar::hash: {
+        FAIL("Wrong message");
+        break;
+    }
+    case MessageBaz::hash: {
+        SUCCEED();
+        break;
+    }
+    default: {
+        FAIL("Unknown message");
+        break;
+    }
+    }
+}
+
 class SimpleServer : public Server {
 public:
-    SimpleServer(unsigned int port, const Pkey& pkey, const Dh& ec, const Cert& cert) : Server{port, pkey, ec, cert} {
+    SimpleServer(unsigned int port, const Pkey& pkey, const Dh& ec, const Cert& cert, const Options& options = {}) :
+        Server{port, pkey, ec, cert, options} {
         addHandler(this, &SimpleServer::handleFoo);
         addHandler([this](const std::shared_ptr<Peer>& peer, MessageBar req) {
             return this->handleBar(peer, std::move(req));
@@ -145,7 +188,7 @@ private:
 
 class SimpleClient : public Client {
 public:
-    SimpleClient(const std::string& address, unsigned int port) {
+    SimpleClient(const std::string& address, unsigned int port, const Options& options = {}) : Client{options} {
         start();
         connect(address, port);
     }
@@ -179,6 +222,19 @@ TEST_CASE("Connect and disconnect from the server") {
     REQUIRE(client.isConnected() == false);
 }
 
+TEST_CASE("Stopping the server is not reported as an error") {
+    Options options{};
+    options.tls = false;
+
+    std::vector<std::error_code> errors;
+    Server server{8009, options};
+    server.setErrorCallback([&](std::error_code ec) { errors.push_back(ec); });
+    server.start();
+    server.stop();
+
+    REQUIRE(errors.empty());
+}
+
 TEST_CASE("Send message to the server and get response") {
     Pkey pkey{};
     Cert cert{pkey};
@@ -219,6 +275,458 @@ TEST_CASE("Send message to the server and get response") {
     REQUIRE(baz.count == 42 * 42);
 }
 
+TEST_CASE("Server with multiple reactors") {
+    Pkey pkey{};
+    Cert cert{pkey};
+    Dh ec{};
+
+    Options options{};
+    options.reactors = 4;
+
+    SimpleServer server{8009, pkey, ec, cert, options};
+    REQUIRE(server.getReactorCount() == 4);
+
+    std::vector<std::unique_ptr<SimpleClient>> clients;
+    for (size_t i = 0; i < 8; i++) {
+        clients.push_back(std::make_unique<SimpleClient>("localhost", 8009));
+    }
+
+    std::vector<std::future<MessageBaz>> futures;
+    std::vector<std::promise<MessageBaz>> promises(clients.size());
+    for (size_t i = 0; i < clients.size(); i++) {
+        futures.push_back(promises[i].get_future());
+
+        MessageBar bar{};
+        bar.count = i;
+        clients[i]->send(bar, [&promises, i](MessageBaz res) { promises[i].set_value(res); });
+    }
+
+    for (size_t i = 0; i < futures.size(); i++) {
+        REQUIRE(futures[i].wait_for(std::chrono::milliseconds(1000)) == std::future_status::ready);
+        REQUIRE(futures[i].get().count == i * i);
+    }
+
+    REQUIRE(server.getPeers().size() == clients.size());
+}
+
+TEST_CASE("Broadcast a message to the connected peers") {
+    Pkey pkey{};
+    Cert cert{pkey};
+    Dh ec{};
+
+    SimpleServer server{8009, pkey, ec, cert};
+
+    std::atomic_size_t received[3] = {};
+    std::vector<std::unique_ptr<Client>> clients;
+    for (size_t i = 0; i < 3; i++) {
+        clients.push_back(std::make_unique<Client>());
+        clients.back()->addHandler([&received, i](const std::shared_ptr<Peer>& peer, MessageFoo msg) -> void {
+            if (msg.msg == "Hello everyone!") {
+                received[i]++;
+            }
+        });
+        clients.back()->start();
+        clients.back()->connect("localhost", 8009);
+    }
+
+    // Wait for server to accept the peers
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    REQUIRE(server.getPeerCount() == 3);
+    REQUIRE(server.getConnectedPeers().size() == 3);
+
+    MessageFoo foo{};
+    foo.msg = "Hello everyone!";
+    REQUIRE(server.broadcast(foo) == 3);
+
+    // Everyone except the first peer
+    const auto first = server.getPeers().front();
+    REQUIRE(server.broadcast(foo, [&](const std::shared_ptr<Peer>& peer) { return peer != first; }) == 2);
+
+    // Wait for the clients to receive the messages
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    REQUIRE(received[0] + received[1] + received[2] == 5);
+
+    clients.pop_back();
+
+    // Wait for server to handle the disconnect
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    REQUIRE(server.getPeerCount() == 2);
+    REQUIRE(server.broadcast(foo) == 2);
+}
+
+TEST_CASE("Send a packed message multiple times") {
+    Pkey pkey{};
+    Cert cert{pkey};
+    Dh ec{};
+
+    SimpleServer server{8009, pkey, ec, cert};
+    SimpleClient client{"localhost", 8009};
+
+    MessageFoo foo{};
+    foo.msg = "Packed only once";
+    const PackedMessage<MessageFoo> packedFoo{foo};
+    static_assert(PackedMessage<MessageFoo>::hash == MessageFoo::hash);
+
+    client.send(packedFoo);
+    client.send(packedFoo);
+
+    MessageBar bar{};
+    bar.count = 7;
+    const PackedMessage<MessageBar> packedBar{bar};
+
+    std::promise<MessageBaz> promise;
+    auto future = promise.get_future();
+
+    client.send(packedBar, [&](MessageBaz res) { promise.set_value(res); });
+
+    REQUIRE(future.wait_for(std::chrono::milliseconds(1000)) == std::future_status::ready);
+    REQUIRE(future.get().count == 7 * 7);
+
+    auto foos = server.getFoos();
+    REQUIRE(foos.size() == 2);
+    REQUIRE(std::get<1>(foos[0]).msg == foo.msg);
+    REQUIRE(std::get<1>(foos[1]).msg == foo.msg);
+
+    // The server can broadcast a packed message as well
+    REQUIRE(server.broadcast(packedFoo) == 1);
+}
+
+TEST_CASE("Handlers executed by the executor in order per peer") {
+    Pkey pkey{};
+    Cert cert{pkey};
+    Dh ec{};
+
+    auto executor = std::make_shared<Executor>(4);
+
+    std::mutex mutex;
+    std::map<Peer*, std::vector<size_t>> received;
+    std::atomic_int active[2] = {};
+    std::atomic_bool overlap{false};
+
+    Server server{8009, pkey, ec, cert};
+    server.setExecutor(executor);
+    server.addHandler([&](const std::shared_ptr<Peer>& peer, MessageFoo msg) -> void {
+        std::lock_guard<std::mutex> lock{mutex};
+        received[peer.get()].push_back(std::stoul(msg.msg));
+    });
+    server.addHandler(
+        [&](const std::shared_ptr<Peer>& peer, MessageBar msg) -> MessageBaz {
+            // The messages with the same key are never handled at the same time, whichever peer sent them
+            auto& counter = active[msg.count % 2];
+            if (counter.fetch_add(1) != 0) {
+                overlap.store(true);
+            }
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+            counter.fetch_sub(1);
+            return MessageBaz{msg.count, true};
+        },
+        [](const MessageBar& msg) -> uint64_t { return msg.count % 2; });
+    server.start();
+
+    std::vector<std::unique_ptr<SimpleClient>> clients;
+    for (size_t i = 0; i < 3; i++) {
+        clients.push_back(std::make_unique<SimpleClient>("localhost", 8009));
+    }
+
+    const size_t total = 500;
+    std::atomic_size_t responses{0};
+    std::promise<void> done;
+
+    for (size_t i = 0; i < total; i++) {
+        for (auto& client : clients) {
+            MessageFoo foo{};
+            foo.msg = std::to_string(i);
+            client->send(foo);
+        }
+
+        MessageBar bar{};
+        bar.count = i;
+        clients[i % clients.size()]->send(bar, [&](MessageBaz res) {
+            if (responses.fetch_add(1) + 1 == total) {
+                done.set_value();
+            }
+        });
+    }
+
+    REQUIRE(done.get_future().wait_for(std::chrono::seconds(5)) == std::future_status::ready);
+
+    // Wait for the remaining messages
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    // Must be stopped before the server
+    executor->stop();
+
+    REQUIRE(received.size() == clients.size());
+    for (const auto& pair : received) {
+        REQUIRE(pair.second.size() == total);
+        for (size_t i = 0; i < total; i++) {
+            REQUIRE(pair.second[i] == i);
+        }
+    }
+
+    REQUIRE(overlap.load() == false);
+}
+
+TEST_CASE("Request with a deadline") {
+    Pkey pkey{};
+    Cert cert{pkey};
+    Dh ec{};
+
+    SimpleServer server{8009, pkey, ec, cert};
+    SimpleClient client{"localhost", 8009};
+
+    // The server responds to MessageBar only, MessageFoo never gets a response
+    MessageBar bar{};
+    bar.count = 7;
+
+    std::promise<MessageBaz> response;
+    client.send(
+        bar, [&](MessageBaz res) { response.set_value(res); }, std::chrono::milliseconds(1000),
+        [&](std::error_code ec) { FAIL("Unexpected error " << ec.message()); });
+
+    auto future = response.get_future();
+    REQUIRE(future.wait_for(std::chrono::milliseconds(1000)) == std::future_status::ready);
+    REQUIRE(future.get().count == 7 * 7);
+
+    MessageFoo foo{};
+    foo.msg = "Nobody responds to this";
+
+    std::promise<std::error_code> timeout;
+    const auto start = std::chrono::steady_clock::now();
+    client.send(
+        foo, [&](MessageBaz res) { FAIL("Unexpected response"); }, std::chrono::milliseconds(50),
+        [&](std::error_code ec) { timeout.set_value(ec); });
+
+    auto timeoutFuture = timeout.get_future();
+    REQUIRE(timeoutFuture.wait_for(std::chrono::milliseconds(1000)) == std::future_status::ready);
+    REQUIRE(timeoutFuture.get() == Error::RequestTimeout);
+    REQUIRE(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(50));
+
+    // Closing the client aborts the pending requests
+    std::promise<std::error_code> aborted;
+    client.send(
+        foo, [&](MessageBaz res) { FAIL("Unexpected response"); }, std::chrono::milliseconds(10000),
+        [&](std::error_code ec) { aborted.set_value(ec); });
+
+    client.stop();
+
+    auto abortedFuture = aborted.get_future();
+    REQUIRE(abortedFuture.wait_for(std::chrono::milliseconds(1000)) == std::future_status::ready);
+    REQUIRE(abortedFuture.get() == Error::RequestAborted);
+}
+
+TEST_CASE("Exception of an aborted request callback goes to the error handler") {
+    Pkey pkey{};
+    Cert cert{pkey};
+    Dh ec{};
+
+    SimpleServer server{8009, pkey, ec, cert};
+    SimpleClient client{"localhost", 8009};
+
+    std::string what;
+    std::shared_ptr<Peer> reported;
+    client.setPeerExceptionCallback([&](const std::shared_ptr<Peer>& peer, std::exception_ptr& eptr) {
+        reported = peer;
+        try {
+            std::rethrow_exception(eptr);
+        } catch (std::exception& e) {
+            what = e.what();
+        }
+    });
+
+    // Nobody responds to MessageFoo, the request is still pending once the client stops
+    MessageFoo foo{};
+    foo.msg = "Nobody responds to this";
+    client.send(
+        foo, [&](MessageBaz res) { FAIL("Unexpected response"); }, std::chrono::milliseconds(10000),
+        [&](std::error_code ec) { throw std::runtime_error(ec.message()); });
+
+    client.stop();
+
+    REQUIRE(what == make_error_code(Error::RequestAborted).message());
+    REQUIRE(reported != nullptr);
+}
+
+TEST_CASE("Request with the default deadline") {
+    Pkey pkey{};
+    Cert cert{pkey};
+    Dh ec{};
+
+    Options options{};
+    options.requestTimeout = std::chrono::milliseconds(50);
+
+    SimpleServer server{8009, pkey, ec, cert};
+    SimpleClient client{"localhost", 8009, options};
+
+    std::promise<std::error_code> timeout;
+    client.setPeerErrorCallback(
+        [&](const std::shared_ptr<Peer>& peer, std::error_code ec) { timeout.set_value(ec); });
+
+    MessageFoo foo{};
+    client.send(foo, [&](MessageBaz res) { FAIL("Unexpected response"); });
+
+    auto future = timeout.get_future();
+    REQUIRE(future.wait_for(std::chrono::milliseconds(1000)) == std::future_status::ready);
+    REQUIRE(future.get() == Error::RequestTimeout);
+}
+
+TEST_CASE("Batch of requests with a single completion") {
+    Pkey pkey{};
+    Cert cert{pkey};
+    Dh ec{};
+
+    SimpleServer server{8009, pkey, ec, cert};
+    SimpleClient client{"localhost", 8009};
+
+    std::vector<MessageBar> bars(100);
+    for (size_t i = 0; i < bars.size(); i++) {
+        bars[i].count = i;
+    }
+
+    std::promise<std::vector<MessageBaz>> promise;
+    client.sendBatch(bars, [&](std::vector<MessageBaz> res) { promise.set_value(std::move(res)); });
+
+    auto future = promise.get_future();
+    REQUIRE(future.wait_for(std::chrono::milliseconds(1000)) == std::future_status::ready);
+    const auto responses = future.get();
+    REQUIRE(responses.size() == bars.size());
+    for (size_t i = 0; i < responses.size(); i++) {
+        REQUIRE(responses[i].count == i * i);
+    }
+    REQUIRE(server.getBars().size() == bars.size());
+
+    // Per item callback
+    std::vector<size_t> counts(bars.size());
+    std::promise<void> done;
+    client.sendBatch(
+        bars, [&](size_t index, MessageBaz res) { counts[index] = res.count; }, [&]() { done.set_value(); });
+
+    REQUIRE(done.get_future().wait_for(std::chrono::milliseconds(1000)) == std::future_status::ready);
+    for (size_t i = 0; i < counts.size(); i++) {
+        REQUIRE(counts[i] == i * i);
+    }
+
+    // Empty batch completes right away, but not from within the call
+    std::promise<bool> empty;
+    client.sendBatch(std::vector<MessageBar>{}, [&](std::vector<MessageBaz> res) { empty.set_value(res.empty()); });
+    auto emptyFuture = empty.get_future();
+    REQUIRE(emptyFuture.wait_for(std::chrono::milliseconds(1000)) == std::future_status::ready);
+    REQUIRE(emptyFuture.get());
+}
+
+TEST_CASE("Batch of requests with a deadline") {
+    Pkey pkey{};
+    Cert cert{pkey};
+    Dh ec{};
+
+    SimpleServer server{8009, pkey, ec, cert};
+    SimpleClient client{"localhost", 8009};
+
+    // Nobody responds to these
+    std::vector<MessageFoo> foos(10);
+
+    std::atomic_int errors{0};
+    std::promise<std::error_code> promise;
+    client.sendBatch(
+        foos, [&](std::vector<MessageBaz> res) { FAIL("Unexpected response"); }, std::chrono::milliseconds(50),
+        [&](std::error_code ec) {
+            if (errors.fetch_add(1) == 0) {
+                promise.set_value(ec);
+            }
+        });
+
+    auto future = promise.get_future();
+    REQUIRE(future.wait_for(std::chrono::milliseconds(1000)) == std::future_status::ready);
+    REQUIRE(future.get() == Error::RequestTimeout);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    REQUIRE(errors == 1);
+}
+
+TEST_CASE("Failed batch is reported once without the error callback") {
+    Pkey pkey{};
+    Cert cert{pkey};
+    Dh ec{};
+
+    Options options{};
+    options.requestTimeout = std::chrono::milliseconds(50);
+
+    SimpleServer server{8009, pkey, ec, cert};
+    SimpleClient client{"localhost", 8009, options};
+
+    std::mutex mutex;
+    std::vector<std::error_code> errors;
+    client.setPeerErrorCallback([&](const std::shared_ptr<Peer>& peer, std::error_code ec) {
+        std::lock_guard<std::mutex> lock{mutex};
+        errors.push_back(ec);
+    });
+
+    std::atomic_int done{0};
+
+    // Nobody responds to these
+    client.sendBatch(std::vector<MessageFoo>(10), [&](std::vector<MessageBaz> res) { done++; });
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+    {
+        std::lock_guard<std::mutex> lock{mutex};
+        REQUIRE(errors == std::vector<std::error_code>{make_error_code(Error::RequestTimeout)});
+        errors.clear();
+    }
+
+    // The responses do not convert to the expected type
+    client.sendBatch(
+        std::vector<MessageBar>(10), [&](size_t index, MessageFoo res) {}, [&]() { done++; });
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+    {
+        std::lock_guard<std::mutex> lock{mutex};
+        REQUIRE(errors == std::vector<std::error_code>{make_error_code(Error::UnpackError)});
+    }
+    REQUIRE(done == 0);
+}
+
+TEST_CASE("Server and client with different codecs") {
+    Pkey pkey{};
+    Cert cert{pkey};
+    Dh ec{};
+
+    Options serverOptions{};
+    serverOptions.codec.type = Codec::Type::Lz4Hc;
+    serverOptions.codec.blockBytes = 1024 * 32;
+
+    Options clientOptions{};
+    clientOptions.codec.type = Codec::Type::None;
+    clientOptions.codec.blockBytes = 1024 * 4;
+
+    SimpleServer server{8009, pkey, ec, cert, serverOptions};
+    SimpleClient client{"localhost", 8009, clientOptions};
+
+    MessageFoo foo{};
+    foo.msg = std::string(1024 * 20, 'x');
+    client.send(foo);
+
+    MessageBar bar{};
+    bar.count = 42;
+
+    std::promise<MessageBaz> promise;
+    auto future = promise.get_future();
+
+    client.send(bar, [&](MessageBaz res) { promise.set_value(res); });
+
+    REQUIRE(future.wait_for(std::chrono::milliseconds(1000)) == std::future_status::ready);
+    REQUIRE(future.get().count == 42 * 42);
+
+    auto foos = server.getFoos();
+    REQUIRE(foos.size() == 1);
+    REQUIRE(std::get<1>(foos.front()).msg == foo.msg);
+
+    // Each side learned the codec of the other side from the stream preamble
+    auto peers = server.getPeers();
+    REQUIRE(peers.size() == 1);
+    REQUIRE(peers.front()->getRemoteCodec().type == Codec::Type::None);
+    REQUIRE(peers.front()->getRemoteCodec().blockBytes == 1024 * 4);
+}
+
 TEST_CASE("Dispatch with override func") {
     class SimplePollingServer : public SimpleServer {
     public:
@@ -305,18 +813,347 @@ TEST_CASE("Dispatch with override func") {
     REQUIRE(baz.count == 42 * 42);
 }
 
-TEST_CASE("Custom certificate validation function") {
+TEST_CASE("Inline handlers bypass the postDispatch") {
+    class NeverDispatchingServer : public Server {
+    public:
+        NeverDispatchingServer(unsigned int port, const Pkey& pkey, const Dh& ec, const Cert& cert) :
+            Server(port, pkey, ec, cert) {
+        }
+
+        std::atomic_size_t posted{0};
+
+    private:
+        void postDispatch(std::function<void()> fn) override {
+            posted++;
+        }
+    };
+
+    class NeverDispatchingClient : public Client {
+    public:
+        explicit NeverDispatchingClient(const Options& options) : Client(options) {
+        }
+
+        std::atomic_size_t posted{0};
+
+    private:
+        void postDispatch(std::function<void()> fn) override {
+            posted++;
+        }
+    };
+
     Pkey pkey{};
     Cert cert{pkey};
     Dh ec{};
 
-    Server server{8009, pkey, ec, cert};
+    NeverDispatchingServer server{8009, pkey, ec, cert};
+    server.addInlineHandler([](const std::shared_ptr<Peer>& peer, MessageBar req) -> MessageBaz {
+        return MessageBaz{req.count * req.count, true};
+    });
+    server.addHandler([](const std::shared_ptr<Peer>& peer, MessageFoo req) -> void {});
     server.start();
 
-    Client client{};
+    // The response callbacks are executed inline as well
+    Options options{};
+    options.inlineDispatch = true;
 
-    auto promise = std::make_shared<std::promise<Cert>>();
-    auto future = promise->get_future();
+    NeverDispatchingClient client{options};
+    client.start();
+    client.connect("localhost", 8009);
+
+    MessageBar bar{};
+    bar.count = 42;
+
+    std::promise<MessageBaz> promise;
+    auto future = promise.get_future();
+
+    client.send(bar, [&](MessageBaz res) { promise.set_value(res); });
+
+    REQUIRE(future.wait_for(std::chrono::milliseconds(1000)) == std::future_status::ready);
+    REQUIRE(future.get().count == 42 * 42);
+
+    // Only the handler that is not inline goes through the postDispatch
+    client.send(MessageFoo{"Not inline"});
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    REQUIRE(server.posted.load() == 1);
+    REQUIRE(client.posted.load() == 0);
+}
+
+TEST_CASE("Inline handlers do not overtake the queued messages") {
+    class DeferringServer : public Server {
+    public:
+        DeferringServer(unsigned int port, const Pkey& pkey, const Dh& ec, const Cert& cert) :
+            Server(port, pkey, ec, cert) {
+        }
+
+        void runDeferred() {
+            std::vector<std::function<void()>> work;
+            {
+                std::lock_guard<std::mutex> lock{mutex};
+                std::swap(work, deferred);
+            }
+            for (auto& fn : work) {
+                fn();
+            }
+        }
+
+        size_t getDeferredCount() {
+            std::lock_guard<std::mutex> lock{mutex};
+            return deferred.size();
+        }
+
+    private:
+        void postDispatch(std::function<void()> fn) override {
+            std::lock_guard<std::mutex> lock{mutex};
+            deferred.push_back(std::move(fn));
+        }
+
+        std::mutex mutex;
+        std::vector<std::function<void()>> deferred;
+    };
+
+    Pkey pkey{};
+    Cert cert{pkey};
+    Dh ec{};
+
+    std::mutex mutex;
+    std::vector<std::string> order;
+
+    DeferringServer server{8009, pkey, ec, cert};
+    server.addInlineHandler([&](const std::shared_ptr<Peer>& peer, MessageBar req) {
+        std::lock_guard<std::mutex> lock{mutex};
+        order.push_back("inline " + std::to_string(req.count));
+    });
+    server.addHandler([&](const std::shared_ptr<Peer>& peer, MessageFoo req) {
+        std::lock_guard<std::mutex> lock{mutex};
+        order.push_back(req.msg);
+    });
+    server.start();
+
+    SimpleClient client{"localhost", 8009};
+    client.send(MessageBar{1});
+    client.send(MessageFoo{"queued"});
+    client.send(MessageBar{2});
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    // The second inline message waits behind the queued one
+    {
+        std::lock_guard<std::mutex> lock{mutex};
+        REQUIRE(order == std::vector<std::string>{"inline 1"});
+    }
+    REQUIRE(server.getDeferredCount() == 2);
+
+    server.runDeferred();
+    std::lock_guard<std::mutex> lock{mutex};
+    REQUIRE(order == std::vector<std::string>{"inline 1", "queued", "inline 2"});
+}
+
+TEST_CASE("Send backpressure with high and low watermarks") {
+    Pkey pkey{};
+    Cert cert{pkey};
+    Dh ec{};
+
+    Options serverOptions{};
+    serverOptions.sendHighWatermark = 256 * 1024;
+    serverOptions.sendPolicy = SendPolicy::Drop;
+
+    Server server{8009, pkey, ec, cert, serverOptions};
+    server.start();
+
+    // The client stops reading while its I/O thread is held by the inline handler
+    Options clientOptions{};
+    clientOptions.inlineDispatch = true;
+
+    std::atomic_bool hold{true};
+    Client client{clientOptions};
+    client.addInlineHandler([&](const std::shared_ptr<Peer>& peer, MessageFoo req) -> void {
+        while (hold.load()) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    });
+    client.start();
+    client.connect("localhost", 8009);
+
+    // Wait for server to accept the peer
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    REQUIRE(server.getPeerCount() == 1);
+    const auto peer = server.getConnectedPeers().front();
+
+    std::atomic_size_t congested{0};
+    std::atomic_size_t writable{0};
+    peer->setBackpressureCallback([&](const std::shared_ptr<Peer>& p) { congested++; });
+    peer->setWritableCallback([&](const std::shared_ptr<Peer>& p) { writable++; });
+
+    // Incompressible messages, so the socket buffers fill up quickly
+    std::mt19937_64 rng{42};
+    MessageFoo foo{};
+    foo.msg.resize(64 * 1024);
+    for (auto& c : foo.msg) {
+        c = static_cast<char>(rng());
+    }
+
+    // The kernel grows the socket buffers for a while, keep sending until they are full
+    const auto fill = [&]() {
+        for (auto i = 0; i < 100 && peer->isWritable(); i++) {
+            while (peer->trySend(foo)) {
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        }
+    };
+
+    fill();
+    REQUIRE(peer->isWritable() == false);
+    REQUIRE(peer->getStats().bytesPending > serverOptions.sendHighWatermark);
+    REQUIRE(congested.load() >= 1);
+
+    // The request above the high watermark is dropped
+    std::promise<std::error_code> dropped;
+    peer->send(
+        MessageBar{}, [](MessageBaz res) {}, std::chrono::milliseconds(1000),
+        [&](const std::error_code ec) { dropped.set_value(ec); });
+
+    auto future = dropped.get_future();
+    REQUIRE(future.wait_for(std::chrono::milliseconds(1000)) == std::future_status::ready);
+    REQUIRE(future.get() == make_error_code(Error::SendQueueFull));
+
+    // The responses are queued over the limit, the other side waits for them. The client does not know
+    // this request, it must not close the connection over it.
+    client.setPeerErrorCallback([](const std::shared_ptr<Peer>& p, std::error_code ec) {});
+    const auto pending = peer->getStats().bytesPending;
+    peer->send(MessageBaz{7, true}, 12345, true);
+    REQUIRE(peer->getStats().bytesPending > pending);
+
+    // The blocked sender continues once the client reads again
+    peer->setSendPolicy(SendPolicy::Block);
+    std::atomic_bool sent{false};
+    std::thread sender{[&]() {
+        peer->send(foo);
+        sent = true;
+    }};
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    REQUIRE(sent.load() == false);
+
+    hold = false;
+    sender.join();
+
+    REQUIRE(sent.load() == true);
+    REQUIRE(writable.load() >= 1);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    REQUIRE(peer->isWritable() == true);
+    REQUIRE(peer->getStats().bytesPending == 0);
+
+    // Disconnect the peer that does not keep up
+    hold = true;
+    fill();
+    REQUIRE(peer->isWritable() == false);
+
+    peer->setSendPolicy(SendPolicy::Disconnect);
+    peer->send(foo);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    REQUIRE(server.getPeerCount() == 0);
+
+    hold = false;
+}
+
+// The handlers run only when the test asks for them
+class QueueingServer : public Server {
+public:
+    QueueingServer(unsigned int port, const Pkey& pkey, const Dh& ec, const Cert& cert, const Options& options) :
+        Server(port, pkey, ec, cert, options) {
+    }
+
+    bool runOne() {
+        std::function<void()> fn;
+        {
+            std::lock_guard<std::mutex> lock{mutex};
+            if (queue.empty()) {
+                return false;
+            }
+            fn = std::move(queue.front());
+            queue.pop_front();
+            peak = std::max(peak, queue.size());
+        }
+        fn();
+        return true;
+    }
+
+    std::mutex mutex;
+    std::deque<std::function<void()>> queue;
+    size_t peak{0};
+
+private:
+    void postDispatch(std::function<void()> fn) override {
+        std::lock_guard<std::mutex> lock{mutex};
+        queue.push_back(std::move(fn));
+    }
+};
+
+TEST_CASE("Reads are paused while the handlers are behind") {
+    Pkey pkey{};
+    Cert cert{pkey};
+    Dh ec{};
+
+    Options options{};
+    options.maxUndispatchedMessages = 64;
+    options.maxUndispatchedBytes = 1024 * 256;
+
+    QueueingServer server{8009, pkey, ec, cert, options};
+
+    std::vector<size_t> received;
+    server.addHandler([&](const std::shared_ptr<Peer>& peer, MessageBar req) { received.push_back(req.count); });
+    server.start();
+
+    Client client{};
+    client.start();
+    client.connect("localhost", 8009);
+
+    // Much more than the socket buffers can hold
+    static constexpr size_t total = 200000;
+    std::thread sender{[&]() {
+        for (size_t i = 0; i < total; i++) {
+            client.send(MessageBar{i});
+        }
+    }};
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+
+    const auto peer = server.getConnectedPeers().front();
+    const auto stats = peer->getStats();
+    REQUIRE(stats.readPauses >= 1);
+    REQUIRE(stats.messagesUndispatched < total / 4);
+
+    // Nothing is lost once the handlers catch up
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(30);
+    while (received.size() < total && std::chrono::steady_clock::now() < deadline) {
+        if (!server.runOne()) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+
+    sender.join();
+
+    std::vector<size_t> expected(total);
+    std::iota(expected.begin(), expected.end(), 0);
+    REQUIRE(received == expected);
+    REQUIRE(server.peak < total / 4);
+    REQUIRE(peer->getStats().messagesUndispatched == 0);
+}
+
+TEST_CASE("Custom certificate validation function") {
+    Pkey pkey{};
+    Cert cert{pkey};
+    Dh ec{};
+
+    Server server{8009, pkey, ec, cert};
+    server.start();
+
+    Client client{};
+
+    auto promise = std::make_shared<std::promise<Cert>>();
+    auto future = promise->get_future();
 
     std::atomic_bool verified{false};
 
@@ -343,3 +1180,886 @@ TEST_CASE("Custom certificate validation function") {
 
     REQUIRE(received.getSubjectName() == "/C=EU/O=msgnet/CN=msgnet");
 }
+
+struct MessageUpload {
+    std::string name;
+    uint64_t size;
+
+    MESSAGE_DEFINE(MessageUpload, name, size);
+};
+
+TEST_CASE("Stream a large payload in chunks") {
+    Pkey pkey{};
+    Cert cert{pkey};
+    Dh ec{};
+
+    Options options{};
+    options.streamChunkBytes = 1024 * 16;
+    options.streamWindowBytes = 1024 * 64;
+
+    std::vector<char> payload(1024 * 1024 * 4);
+    std::mt19937_64 rng{42};
+    for (auto& c : payload) {
+        c = static_cast<char>(rng());
+    }
+
+    Server server{8009, pkey, ec, cert};
+
+    std::vector<char> received;
+    size_t chunks{0};
+    size_t largest{0};
+    size_t chunksBeforeFoo{0};
+    std::promise<MessageUpload> done;
+
+    server.addStreamHandler([&](const std::shared_ptr<Peer>& peer, MessageUpload header) -> Peer::ChunkHandler {
+        received.reserve(header.size);
+        return [&, header](const char* data, const size_t size, const bool last) {
+            received.insert(received.end(), data, data + size);
+            largest = std::max(largest, size);
+            chunks++;
+            if (last) {
+                done.set_value(header);
+            }
+        };
+    });
+    server.addHandler([&](const std::shared_ptr<Peer>& peer, MessageFoo req) { chunksBeforeFoo = chunks; });
+    server.start();
+
+    Client client{options};
+    client.start();
+    client.connect("localhost", 8009);
+
+    auto writer = client.openStream(MessageUpload{"payload.bin", payload.size()});
+    for (size_t offset = 0; offset < payload.size(); offset += 10000) {
+        writer->write(payload.data() + offset, std::min<size_t>(10000, payload.size() - offset));
+
+        // Sent in the middle of the stream
+        if (offset == 100 * 10000) {
+            client.send(MessageFoo{"In between"});
+        }
+    }
+    writer->close();
+
+    auto future = done.get_future();
+    REQUIRE(future.wait_for(std::chrono::seconds(10)) == std::future_status::ready);
+
+    const auto header = future.get();
+    REQUIRE(header.name == "payload.bin");
+    REQUIRE(header.size == payload.size());
+    REQUIRE(received == payload);
+    REQUIRE(largest == options.streamChunkBytes);
+    REQUIRE(chunksBeforeFoo > 0);
+    REQUIRE(chunksBeforeFoo < chunks);
+}
+
+TEST_CASE("Stream a payload pulled from the producer") {
+    Pkey pkey{};
+    Cert cert{pkey};
+    Dh ec{};
+
+    Options options{};
+    options.streamChunkBytes = 1024 * 8;
+    options.streamWindowBytes = 1024 * 32;
+
+    Server server{8009, pkey, ec, cert, options};
+    server.start();
+
+    static constexpr size_t total = 1024 * 1024 * 2;
+
+    uint64_t sum{0};
+    size_t length{0};
+    std::promise<void> done;
+
+    Client client{};
+    client.addStreamHandler([&](const std::shared_ptr<Peer>& peer, MessageUpload header) -> Peer::ChunkHandler {
+        return [&](const char* data, const size_t size, const bool last) {
+            for (size_t i = 0; i < size; i++) {
+                sum += static_cast<uint8_t>(data[i]);
+            }
+            length += size;
+            if (last) {
+                done.set_value();
+            }
+        };
+    });
+    client.start();
+    client.connect("localhost", 8009);
+
+    // Wait for server to accept the peer
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    REQUIRE(server.getPeerCount() == 1);
+
+    // Bytes 0 to 255 repeated, produced in pieces smaller than a chunk
+    size_t produced{0};
+    server.getConnectedPeers().front()->sendStream(MessageUpload{"counter", total}, [&](char* buffer, const size_t size) {
+        const auto count = std::min<size_t>(std::min<size_t>(size, 5000), total - produced);
+        for (size_t i = 0; i < count; i++) {
+            buffer[i] = static_cast<char>((produced + i) & 0xff);
+        }
+        produced += count;
+        return count;
+    });
+
+    REQUIRE(done.get_future().wait_for(std::chrono::seconds(10)) == std::future_status::ready);
+    REQUIRE(length == total);
+    REQUIRE(sum == total / 256 * (255 * 256 / 2));
+}
+
+TEST_CASE("Exception of a chunk handler ends the stream") {
+    Pkey pkey{};
+    Cert cert{pkey};
+    Dh ec{};
+
+    Options options{};
+    options.streamChunkBytes = 1024;
+
+    Server server{8009, pkey, ec, cert};
+
+    std::vector<size_t> sizes;
+    std::vector<bool> lasts;
+    std::promise<std::string> reported;
+    server.setPeerExceptionCallback([&](const std::shared_ptr<Peer>& peer, std::exception_ptr& eptr) {
+        try {
+            std::rethrow_exception(eptr);
+        } catch (std::exception& e) {
+            reported.set_value(e.what());
+        }
+    });
+    server.addStreamHandler([&](const std::shared_ptr<Peer>& peer, MessageUpload header) -> Peer::ChunkHandler {
+        return [&](const char* data, const size_t size, const bool last) {
+            sizes.push_back(size);
+            lasts.push_back(last);
+            if (sizes.size() == 2) {
+                throw std::runtime_error("Disk is full");
+            }
+        };
+    });
+    std::promise<void> foo;
+    server.addHandler([&](const std::shared_ptr<Peer>& peer, MessageFoo req) { foo.set_value(); });
+    server.start();
+
+    Client client{options};
+    client.start();
+    client.connect("localhost", 8009);
+
+    std::vector<char> payload(1024 * 8, 'x');
+    auto writer = client.openStream(MessageUpload{"payload.bin", payload.size()});
+    writer->write(payload.data(), payload.size());
+    writer->close();
+
+    // The chunks are handled in order, the rest of the stream is behind this message
+    client.send(MessageFoo{"After the stream"});
+
+    auto future = reported.get_future();
+    REQUIRE(future.wait_for(std::chrono::seconds(5)) == std::future_status::ready);
+    REQUIRE(future.get() == "Disk is full");
+    REQUIRE(foo.get_future().wait_for(std::chrono::seconds(5)) == std::future_status::ready);
+
+    // The handler is told about the end of the stream, and gets nothing after that
+    REQUIRE(sizes == std::vector<size_t>{1024, 1024, 0});
+    REQUIRE(lasts == std::vector<bool>{false, false, true});
+}
+
+TEST_CASE("Received chunks are bounded by the stream window") {
+    Pkey pkey{};
+    Cert cert{pkey};
+    Dh ec{};
+
+    // No maxUndispatched limits
+    Options options{};
+    options.streamChunkBytes = 1024 * 16;
+    options.streamWindowBytes = 1024 * 64;
+
+    QueueingServer server{8009, pkey, ec, cert, options};
+
+    size_t length{0};
+    bool finished{false};
+    server.addStreamHandler([&](const std::shared_ptr<Peer>& peer, MessageUpload header) -> Peer::ChunkHandler {
+        return [&](const char* data, const size_t size, const bool last) {
+            length += size;
+            finished = last;
+        };
+    });
+    server.start();
+
+    Client client{options};
+    client.start();
+    client.connect("localhost", 8009);
+
+    // Random bytes, the packed size of the chunks is about the size of the data
+    static constexpr size_t total = 1024 * 1024 * 16;
+    std::vector<char> payload(1024 * 64);
+    std::mt19937_64 rng{42};
+    for (auto& c : payload) {
+        c = static_cast<char>(rng());
+    }
+
+    std::thread sender{[&]() {
+        auto writer = client.openStream(MessageUpload{"payload.bin", total});
+        for (size_t offset = 0; offset < total; offset += payload.size()) {
+            writer->write(payload.data(), payload.size());
+        }
+        writer->close();
+    }};
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+
+    const auto peer = server.getConnectedPeers().front();
+    const auto stats = peer->getStats();
+    REQUIRE(stats.readPauses >= 1);
+    REQUIRE(stats.bytesUndispatched < total / 4);
+
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(30);
+    while (!finished && std::chrono::steady_clock::now() < deadline) {
+        if (!server.runOne()) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+
+    sender.join();
+
+    REQUIRE(finished);
+    REQUIRE(length == total);
+    REQUIRE(peer->getStats().bytesUndispatched == 0);
+}
+
+struct MessageAttachment {
+    std::string name;
+    Attachment data;
+
+    MESSAGE_DEFINE(MessageAttachment, name, data);
+};
+
+TEST_CASE("Plain TCP server and client without TLS") {
+    Options options{};
+    options.tls = false;
+
+    Server server{8009, options};
+    server.addHandler([](const std::shared_ptr<Peer>& peer, MessageBar req) -> MessageBaz {
+        return {req.count * req.count, true};
+    });
+    server.start();
+
+    Client client{options};
+    client.start();
+    client.connect("localhost", 8009);
+    REQUIRE(client.isConnected());
+
+    std::promise<MessageBaz> promise;
+    auto future = promise.get_future();
+
+    client.send(MessageBar{42}, [&](MessageBaz res) { promise.set_value(res); });
+
+    REQUIRE(future.wait_for(std::chrono::milliseconds(1000)) == std::future_status::ready);
+    REQUIRE(future.get().count == 42 * 42);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    REQUIRE(server.getPeerCount() == 1);
+}
+
+TEST_CASE("Server survives a peer with a bad stream preamble") {
+    Options options{};
+    options.tls = false;
+
+    Server server{8009, options};
+    server.addHandler([](const std::shared_ptr<Peer>& peer, MessageBar req) -> MessageBaz {
+        return {req.count * req.count, true};
+    });
+
+    std::promise<std::string> reported;
+    server.setPeerExceptionCallback([&](const std::shared_ptr<Peer>& peer, std::exception_ptr& eptr) {
+        try {
+            std::rethrow_exception(eptr);
+        } catch (std::exception& e) {
+            reported.set_value(e.what());
+        }
+    });
+    server.start();
+
+    // Not a msgnet client at all
+    asio::io_context service;
+    asio::ip::tcp::socket socket{service};
+    socket.connect(asio::ip::tcp::endpoint{asio::ip::address_v4::loopback(), 8009});
+    const std::vector<char> garbage(64, 'x');
+    asio::write(socket, asio::buffer(garbage));
+
+    auto future = reported.get_future();
+    REQUIRE(future.wait_for(std::chrono::seconds(5)) == std::future_status::ready);
+    REQUIRE(future.get() == "Bad stream preamble");
+
+    // Only that peer is closed
+    std::array<char, 16> buffer{};
+    asio::error_code ec;
+    socket.read_some(asio::buffer(buffer), ec);
+    REQUIRE((ec == asio::error::eof || ec == asio::error::connection_reset));
+
+    Client client{options};
+    client.start();
+    client.connect("localhost", 8009);
+
+    std::promise<MessageBaz> promise;
+    client.send(MessageBar{7}, [&](MessageBaz res) { promise.set_value(res); });
+
+    auto response = promise.get_future();
+    REQUIRE(response.wait_for(std::chrono::seconds(1)) == std::future_status::ready);
+    REQUIRE(response.get().count == 49);
+}
+
+TEST_CASE("Server survives a peer with a malformed frame") {
+    Options options{};
+    options.tls = false;
+
+    Server server{8009, options};
+    server.addHandler([](const std::shared_ptr<Peer>& peer, MessageBar req) -> MessageBaz {
+        return {req.count * req.count, true};
+    });
+
+    std::mutex mutex;
+    std::vector<std::error_code> errors;
+    std::vector<std::string> exceptions;
+    server.setPeerErrorCallback([&](const std::shared_ptr<Peer>& peer, std::error_code ec) {
+        std::lock_guard<std::mutex> lock{mutex};
+        errors.push_back(ec);
+    });
+    server.setPeerExceptionCallback([&](const std::shared_ptr<Peer>& peer, std::exception_ptr& eptr) {
+        std::lock_guard<std::mutex> lock{mutex};
+        try {
+            std::rethrow_exception(eptr);
+        } catch (std::exception& e) {
+            exceptions.push_back(e.what());
+        }
+    });
+    server.start();
+
+    // A valid preamble: magic, version, no compression, acceleration, block size
+    std::vector<char> preamble(12);
+    const uint32_t magic = 0x54454e4dU;
+    const uint16_t acceleration = 1;
+    const uint32_t blockBytes = 1024 * 8;
+    std::memcpy(preamble.data(), &magic, sizeof(magic));
+    preamble[4] = 1;
+    preamble[5] = 0;
+    std::memcpy(preamble.data() + 6, &acceleration, sizeof(acceleration));
+    std::memcpy(preamble.data() + 8, &blockBytes, sizeof(blockBytes));
+
+    const auto send = [&](const uint32_t header, const std::vector<char>& body) {
+        asio::io_context service;
+        asio::ip::tcp::socket socket{service};
+        socket.connect(asio::ip::tcp::endpoint{asio::ip::address_v4::loopback(), 8009});
+
+        auto frame = preamble;
+        frame.resize(frame.size() + sizeof(header));
+        std::memcpy(frame.data() + preamble.size(), &header, sizeof(header));
+        frame.insert(frame.end(), body.begin(), body.end());
+        asio::write(socket, asio::buffer(frame));
+
+        // The server closes the peer
+        std::array<char, 16> buffer{};
+        asio::error_code ec;
+        socket.read_some(asio::buffer(buffer), ec);
+        return ec;
+    };
+
+    SECTION("Bytes that are not Msgpack") {
+        // A stored block with a byte that no Msgpack type starts with
+        const auto ec = send(0x80000000U | 1, {static_cast<char>(0xc1)});
+        REQUIRE((ec == asio::error::eof || ec == asio::error::connection_reset));
+
+        std::lock_guard<std::mutex> lock{mutex};
+        REQUIRE(errors.size() == 1);
+        REQUIRE(errors.front() == make_error_code(Error::UnpackError));
+    }
+
+    SECTION("Block above the announced size") {
+        const auto ec = send(0x80000000U | (blockBytes + 1), {});
+        REQUIRE((ec == asio::error::eof || ec == asio::error::connection_reset));
+
+        std::lock_guard<std::mutex> lock{mutex};
+        REQUIRE(exceptions == std::vector<std::string>{"Decompress block is too large"});
+    }
+
+    Client client{options};
+    client.start();
+    client.connect("localhost", 8009);
+
+    std::promise<MessageBaz> promise;
+    client.send(MessageBar{7}, [&](MessageBaz res) { promise.set_value(res); });
+
+    auto response = promise.get_future();
+    REQUIRE(response.wait_for(std::chrono::seconds(1)) == std::future_status::ready);
+    REQUIRE(response.get().count == 49);
+}
+
+#ifndef _WIN32
+TEST_CASE("Unix domain socket server and client") {
+    const std::string path = "/tmp/msgnet_test_" + std::to_string(::getpid()) + ".sock";
+    const std::string abstract = std::string{'\0'} + "msgnet_test_" + std::to_string(::getpid());
+
+    for (const auto& name : {path, abstract}) {
+        Options options{};
+        options.reactors = 2;
+
+        Server server{LocalEndpoint{name}, options};
+        server.addHandler([](const std::shared_ptr<Peer>& peer, MessageBar req) -> MessageBaz {
+            return {req.count * req.count, true};
+        });
+        server.start();
+
+        Client client{};
+        client.start();
+        client.connectLocal(LocalEndpoint{name});
+        REQUIRE(client.isConnected());
+
+        std::promise<MessageBaz> promise;
+        auto future = promise.get_future();
+
+        client.send(MessageBar{42}, [&](MessageBaz res) { promise.set_value(res); });
+
+        REQUIRE(future.wait_for(std::chrono::milliseconds(1000)) == std::future_status::ready);
+        REQUIRE(future.get().count == 42 * 42);
+
+        const auto expected = name == path ? path : "@" + name.substr(1);
+        REQUIRE(client.getAddress() == expected);
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        REQUIRE(server.getPeerCount() == 1);
+        REQUIRE(server.getConnectedPeers().front()->getAddress() == expected);
+
+        client.stop();
+        server.stop();
+    }
+
+    // The socket file is removed once the server stops
+    REQUIRE(::access(path.c_str(), F_OK) != 0);
+}
+
+TEST_CASE("Unix domain socket server removes only a stale socket file") {
+    const std::string path = "/tmp/msgnet_stale_" + std::to_string(::getpid()) + ".sock";
+
+    SECTION("Another kind of file is left alone") {
+        {
+            std::ofstream file{path};
+            file << "data";
+        }
+        REQUIRE_THROWS_WITH(Server(LocalEndpoint{path}), "The path of the socket is taken by another file");
+        REQUIRE(::access(path.c_str(), F_OK) == 0);
+        ::unlink(path.c_str());
+    }
+
+    SECTION("A live socket is left alone") {
+        Server server{LocalEndpoint{path}};
+        server.start();
+
+        REQUIRE_THROWS_WITH(Server(LocalEndpoint{path}), "The socket is in use by another process");
+
+        Client client{};
+        client.start();
+        client.connectLocal(LocalEndpoint{path});
+        REQUIRE(client.isConnected());
+
+        client.stop();
+        server.stop();
+    }
+
+    SECTION("A socket nobody listens on is replaced") {
+        {
+            asio::io_service service;
+            asio::local::stream_protocol::acceptor acceptor{service, LocalEndpoint{path}};
+        }
+        REQUIRE(::access(path.c_str(), F_OK) == 0);
+
+        Server server{LocalEndpoint{path}};
+        server.start();
+
+        Client client{};
+        client.start();
+        client.connectLocal(LocalEndpoint{path});
+        REQUIRE(client.isConnected());
+
+        client.stop();
+        server.stop();
+    }
+
+    REQUIRE(::access(path.c_str(), F_OK) != 0);
+}
+#endif
+
+#ifdef __linux__
+TEST_CASE("Shared memory transport") {
+    const LocalEndpoint endpoint{std::string{'\0'} + "msgnet_shm_" + std::to_string(::getpid())};
+
+    // The smallest rings, the messages do not fit and wrap around
+    Options options{};
+    options.sharedMemory = true;
+    options.sharedMemoryBytes = 4096;
+
+    std::mt19937_64 rng{1234};
+    std::vector<std::string> expected(100);
+    for (auto& msg : expected) {
+        msg.resize(1024 * 20);
+        for (auto& c : msg) {
+            c = static_cast<char>(rng());
+        }
+    }
+
+    std::mutex mutex;
+    std::vector<std::string> received;
+
+    Server server{endpoint, options};
+    server.addHandler([](const std::shared_ptr<Peer>& peer, MessageBar req) -> MessageBaz {
+        return {req.count * req.count, true};
+    });
+    server.addHandler([&](const std::shared_ptr<Peer>& peer, MessageFoo msg) {
+        std::lock_guard<std::mutex> lock{mutex};
+        received.push_back(std::move(msg.msg));
+    });
+    server.start();
+
+    Client client{options};
+    client.start();
+    client.connectLocal(endpoint);
+    REQUIRE(client.isConnected());
+    REQUIRE(client.getAddress() == "shm:@" + endpoint.path().substr(1));
+
+    std::promise<MessageBaz> promise;
+    auto future = promise.get_future();
+
+    client.send(MessageBar{42}, [&](MessageBaz res) { promise.set_value(res); });
+
+    REQUIRE(future.wait_for(std::chrono::milliseconds(1000)) == std::future_status::ready);
+    REQUIRE(future.get().count == 42 * 42);
+
+    for (const auto& msg : expected) {
+        client.send(MessageFoo{msg});
+    }
+
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (std::chrono::steady_clock::now() < deadline) {
+        {
+            std::lock_guard<std::mutex> lock{mutex};
+            if (received.size() == expected.size()) {
+                break;
+            }
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    {
+        std::lock_guard<std::mutex> lock{mutex};
+        REQUIRE(received == expected);
+    }
+
+    // The server finds out about the other side going away through the socket
+    REQUIRE(server.getPeerCount() == 1);
+    client.stop();
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    REQUIRE(server.getPeerCount() == 0);
+}
+
+// Plays the connecting side of the shared memory transport, with the same layout of the region
+class FakeShmClient {
+public:
+    struct Ring {
+        alignas(64) std::atomic<uint64_t> head;
+        alignas(64) std::atomic<uint64_t> tail;
+        alignas(64) std::atomic<uint32_t> readerWaiting;
+        std::atomic<uint32_t> writerWaiting;
+    };
+
+    struct Region {
+        uint64_t magic;
+        uint64_t capacity;
+        Ring rings[2];
+    };
+
+    FakeShmClient(const size_t capacity, const bool sealed) :
+        regionBytes{(sizeof(Region) + 63) / 64 * 64 + capacity * 2} {
+        fds[0] = memfd_create("msgnet_test", MFD_CLOEXEC | (sealed ? MFD_ALLOW_SEALING : 0));
+        REQUIRE(ftruncate(fds[0], static_cast<off_t>(regionBytes)) == 0);
+        if (sealed) {
+            REQUIRE(fcntl(fds[0], F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) == 0);
+        }
+        for (size_t i = 1; i < 5; i++) {
+            fds[i] = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        }
+
+        address = mmap(nullptr, regionBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fds[0], 0);
+        REQUIRE(address != MAP_FAILED);
+        region = new (address) Region{};
+        region->magic = 0x6d73676e65747368ULL;
+        region->capacity = capacity;
+    }
+
+    ~FakeShmClient() {
+        munmap(address, regionBytes);
+        for (const auto fd : fds) {
+            ::close(fd);
+        }
+    }
+
+    void send(asio::local::stream_protocol::socket& socket, const size_t count = 5) {
+        char byte = 0;
+        iovec iov{&byte, 1};
+        alignas(cmsghdr) char control[CMSG_SPACE(sizeof(fds))];
+        msghdr msg{};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = CMSG_SPACE(sizeof(int) * count);
+        auto* cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int) * count);
+        std::memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * count);
+        REQUIRE(sendmsg(socket.native_handle(), &msg, MSG_NOSIGNAL) == 1);
+    }
+
+    Region* region{nullptr};
+
+private:
+    size_t regionBytes;
+    int fds[5];
+    void* address{nullptr};
+};
+
+TEST_CASE("Shared memory transport rejects corrupted ring positions") {
+    constexpr size_t capacity = 4096;
+
+    asio::io_service service;
+    Transport::Strand strand{service};
+    auto transport = std::make_shared<ShmTransport>(service, capacity, std::chrono::microseconds{0});
+    asio::local::stream_protocol::socket other{service};
+    asio::local::connect_pair(transport->getSocket(), other);
+
+    FakeShmClient client{capacity, true};
+    client.send(other);
+    auto* region = client.region;
+
+    asio::error_code result = asio::error::would_block;
+    transport->handshake(true, [&](const asio::error_code& ec) { result = ec; });
+    service.run();
+    REQUIRE(!result);
+    REQUIRE(transport->isOpen());
+
+    const asio::error_code protocolError{EPROTO, asio::error::get_system_category()};
+    std::array<char, 64> buffer{};
+
+    SECTION("Head ahead of the tail by more than the ring") {
+        region->rings[0].head.store(capacity + 1);
+
+        asio::error_code ec;
+        REQUIRE(transport->read(asio::buffer(buffer), ec) == 0);
+        REQUIRE(ec == protocolError);
+        REQUIRE(!transport->isOpen());
+    }
+
+    SECTION("Head moved back behind the tail") {
+        region->rings[0].head.store(16);
+
+        asio::error_code ec;
+        REQUIRE(transport->read(asio::buffer(buffer), ec) == 16);
+        REQUIRE(!ec);
+
+        region->rings[0].head.store(8);
+        REQUIRE(transport->read(asio::buffer(buffer), ec) == 0);
+        REQUIRE(ec == protocolError);
+        REQUIRE(!transport->isOpen());
+    }
+
+    SECTION("Tail ahead of the head") {
+        region->rings[1].tail.store(1);
+
+        size_t written = 1;
+        transport->asyncWrite(strand, {asio::buffer(buffer)}, [&](const asio::error_code& ec, const size_t length) {
+            result = ec;
+            written = length;
+        });
+        service.restart();
+        service.run();
+        REQUIRE(result == protocolError);
+        REQUIRE(written == 0);
+        REQUIRE(!transport->isOpen());
+    }
+}
+
+TEST_CASE("Shared memory handshake rejects a region that can shrink") {
+    constexpr size_t capacity = 4096;
+
+    asio::io_service service;
+    auto transport = std::make_shared<ShmTransport>(service, capacity, std::chrono::microseconds{0});
+    asio::local::stream_protocol::socket other{service};
+    asio::local::connect_pair(transport->getSocket(), other);
+
+    // Without the seals the other side could truncate the region under the mapping
+    FakeShmClient client{capacity, false};
+    client.send(other);
+
+    asio::error_code result = asio::error::would_block;
+    transport->handshake(true, [&](const asio::error_code& ec) { result = ec; });
+    service.run();
+    REQUIRE(result == asio::error::invalid_argument);
+}
+
+TEST_CASE("Shared memory handshake closes the descriptors it rejects") {
+    const auto countDescriptors = []() {
+        size_t count = 0;
+        auto* dir = ::opendir("/proc/self/fd");
+        while (::readdir(dir)) {
+            count++;
+        }
+        ::closedir(dir);
+        return count;
+    };
+
+    constexpr size_t capacity = 4096;
+
+    asio::io_service service;
+    auto transport = std::make_shared<ShmTransport>(service, capacity, std::chrono::microseconds{0});
+    asio::local::stream_protocol::socket other{service};
+    asio::local::connect_pair(transport->getSocket(), other);
+
+    // Fewer descriptors than the handshake needs
+    FakeShmClient client{capacity, true};
+    client.send(other, 3);
+
+    const auto before = countDescriptors();
+
+    asio::error_code result = asio::error::would_block;
+    transport->handshake(true, [&](const asio::error_code& ec) { result = ec; });
+    service.run();
+    REQUIRE(result == asio::error::invalid_argument);
+    REQUIRE(countDescriptors() == before);
+}
+#endif
+
+TEST_CASE("Send attachments by reference") {
+    Pkey pkey{};
+    Cert cert{pkey};
+    Dh ec{};
+
+    Options options{};
+    options.codec.type = Codec::Type::None;
+
+    Server server{8009, pkey, ec, cert, options};
+    server.start();
+
+    std::vector<char> expected(1024 * 256);
+    for (size_t i = 0; i < expected.size(); i++) {
+        expected[i] = static_cast<char>(i * 31);
+    }
+
+    std::atomic_size_t matched{0};
+    std::atomic_size_t received{0};
+
+    Client client{};
+    client.addHandler([&](const std::shared_ptr<Peer>& peer, MessageAttachment msg) {
+        // A view into the received message
+        const auto offset = msg.name == "mapped" ? 1000 : 0;
+        if (std::memcmp(msg.data.data(), expected.data() + offset, msg.data.size()) == 0) {
+            matched++;
+        }
+        received++;
+    });
+    client.start();
+    client.connect("localhost", 8009);
+
+    // Wait for server to accept the peer
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    REQUIRE(server.getPeerCount() == 1);
+    const auto peer = server.getConnectedPeers().front();
+
+    auto buffer = std::make_shared<std::vector<char>>(expected);
+    peer->send(MessageAttachment{"buffer", Attachment{buffer}});
+    size_t referenced = buffer->size();
+
+#ifndef _WIN32
+    // A range of a file, mapped into the memory
+    char path[] = "/tmp/msgnet_attachment_XXXXXX";
+    const auto fd = mkstemp(path);
+    REQUIRE(fd >= 0);
+    REQUIRE(::write(fd, expected.data(), expected.size()) == static_cast<ssize_t>(expected.size()));
+
+    peer->send(MessageAttachment{"mapped", Attachment::map(fd, 1000, expected.size() - 2000)});
+    referenced += expected.size() - 2000;
+
+    ::close(fd);
+    ::unlink(path);
+#else
+    received++;
+    matched++;
+#endif
+
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (received.load() < 2 && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    REQUIRE(received.load() == 2);
+    REQUIRE(matched.load() == 2);
+    REQUIRE(peer->getStats().bytesReferenced == referenced);
+}
+
+TEST_CASE("Burst of messages is delivered in order with gathered writes") {
+    class BurstServer : public Server {
+    public:
+        BurstServer(unsigned int port, const Pkey& pkey, const Dh& ec, const Cert& cert) :
+            Server{port, pkey, ec, cert} {
+            start();
+        }
+
+        void onAcceptSuccess(std::shared_ptr<Peer> peer) override {
+            promise.set_value(std::move(peer));
+        }
+
+        std::promise<std::shared_ptr<Peer>> promise;
+    };
+
+    Pkey pkey{};
+    Cert cert{pkey};
+    Dh ec{};
+
+    BurstServer server{8009, pkey, ec, cert};
+    auto future = server.promise.get_future();
+
+    std::mutex mutex;
+    std::vector<size_t> received;
+
+    Client client{};
+    client.addHandler([&](const std::shared_ptr<Peer>& peer, MessageBar msg) -> void {
+        std::lock_guard<std::mutex> lock{mutex};
+        received.push_back(msg.count);
+    });
+    client.start();
+    client.connect("localhost", 8009);
+
+    REQUIRE(future.wait_for(std::chrono::milliseconds(1000)) == std::future_status::ready);
+    auto peer = future.get();
+
+    const size_t total = 10000;
+    for (size_t i = 0; i < total; i++) {
+        MessageBar bar{};
+        bar.count = i;
+        peer->send(bar);
+    }
+
+    for (auto i = 0; i < 100; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        std::lock_guard<std::mutex> lock{mutex};
+        if (received.size() == total) {
+            break;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock{mutex};
+    std::vector<size_t> expected(total);
+    std::iota(expected.begin(), expected.end(), 0);
+    REQUIRE(received == expected);
+
+    const auto stats = peer->getStats();
+    REQUIRE(stats.blocksQueued == total);
+    REQUIRE(stats.writes > 0);
+    REQUIRE(stats.writes <= stats.blocksQueued);
+    REQUIRE(stats.bytesWritten > 0);
+    REQUIRE(stats.poolHits + stats.poolMisses == total);
+    REQUIRE(stats.poolHits > 0);
+}
@@ -1,15 +1,105 @@
+#include <atomic>
 #include <catch.hpp>
+#include <chrono>
+#include <cstdlib>
 #include <cstring>
 #include <iostream>
 #include <lz4.h>
 #include <lz4frame.h>
 #include <msgnet/stream.hpp>
 #include <msgpack.hpp>
+#include <new>
 
 using namespace MsgNet;
 
 static const size_t maxMessageSize = 1024 * 16;
 
+namespace {
+// Counts the allocations made by this thread while the counter is alive. The operators below replace the global
+// ones of the whole test executable, they behave the same as the default ones and count nothing outside of a counter.
+class AllocationCounter {
+public:
+    AllocationCounter() : previous{current} {
+        current = this;
+    }
+
+    ~AllocationCounter() {
+        current = previous;
+    }
+
+    AllocationCounter(const AllocationCounter& other) = delete;
+    AllocationCounter& operator=(const AllocationCounter& other) = delete;
+
+    size_t getCount() const {
+        return count;
+    }
+
+    static void record() {
+        if (current) {
+            current->count++;
+        }
+    }
+
+private:
+    static thread_local AllocationCounter* current;
+    AllocationCounter* previous;
+    size_t count{0};
+};
+
+thread_local AllocationCounter* AllocationCounter::current = nullptr;
+
+void* allocate(const size_t size) {
+    AllocationCounter::record();
+    if (auto* ptr = std::malloc(size == 0 ? 1 : size)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+} // namespace
+
+// Every form that allocates with malloc() is replaced, so that each of them is freed by a matching form
+void* operator new(const size_t size) {
+    return allocate(size);
+}
+
+void* operator new[](const size_t size) {
+    return allocate(size);
+}
+
+void* operator new(const size_t size, const std::nothrow_t&) noexcept {
+    AllocationCounter::record();
+    return std::malloc(size == 0 ? 1 : size);
+}
+
+void* operator new[](const size_t size, const std::nothrow_t&) noexcept {
+    AllocationCounter::record();
+    return std::malloc(size == 0 ? 1 : size);
+}
+
+void operator delete(void* ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+    std::free(ptr);
+}
+
+void operator delete[](void* ptr, size_t) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, const std::nothrow_t&) noexcept {
+    std::free(ptr);
+}
+
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept {
+    std::free(ptr);
+}
+
 class TestCompressionStream : public CompressionStream {
 public:
     explicit TestCompressionStream() : CompressionStream{maxMessageSize} {
@@ -152,3 +242,589 @@ TEST_CASE("Compress and decompress random chunks") {
 
     std::cout << "Original: " << maxTotal << " bytes, compressed: " << totalCompressed << " bytes" << std::endl;
 }
+
+TEST_CASE("Decompress through a resized staging buffer") {
+    TestCompressionStream compress{};
+    TestDecompressionStream decompress{};
+
+    std::mt19937_64 rng{9725674ULL};
+    std::uniform_int_distribution<uint64_t> dist{};
+
+    std::vector<std::vector<uint64_t>> originals;
+    for (size_t i = 0; i < 64; i++) {
+        originals.emplace_back(i * 64);
+        for (auto& value : originals.back()) {
+            value = dist(rng);
+        }
+        msgpack::pack(compress, originals.back());
+    }
+    compress.flush();
+
+    std::vector<char> bytes;
+    for (const auto& b : compress.buffers) {
+        bytes.insert(bytes.end(), b->begin(), b->end());
+    }
+
+    // Much smaller than a block, the buffer grows on its own, and is resized between the reads
+    decompress.setStagingBytes(256);
+
+    size_t offset = 0;
+    for (size_t i = 0; offset < bytes.size(); i++) {
+        size_t size = 0;
+        auto* data = decompress.prepare(size);
+        REQUIRE(size > 0);
+
+        const auto length = std::min(size, bytes.size() - offset);
+        std::memcpy(data, bytes.data() + offset, length);
+        decompress.commit(length);
+        offset += length;
+
+        decompress.setStagingBytes(i % 2 == 0 ? 1024 * 64 : 512);
+    }
+
+    REQUIRE(decompress.objects.size() == originals.size());
+    for (size_t i = 0; i < originals.size(); i++) {
+        std::vector<uint64_t> data;
+        decompress.objects[i]->get().convert(data);
+
+        REQUIRE(data == originals[i]);
+    }
+}
+
+struct MessageBlob {
+    uint64_t id;
+    Attachment blob;
+
+    MSGPACK_DEFINE_ARRAY(id, blob);
+};
+
+TEST_CASE("Incompressible attachments skip the compression buffers") {
+    TestCompressionStream compress{};
+    TestDecompressionStream decompress{};
+
+    std::mt19937_64 rng{9725674ULL};
+    auto random = std::make_shared<std::vector<char>>(1024 * 100);
+    for (auto& c : *random) {
+        c = static_cast<char>(rng());
+    }
+    auto zeros = std::make_shared<std::vector<char>>(1024 * 100, 0);
+
+    msgpack::pack(compress, MessageBlob{1, Attachment{random}});
+    compress.flush();
+    REQUIRE(compress.getReferencedBytes() == random->size());
+
+    // Compressible bytes are compressed as usual
+    msgpack::pack(compress, MessageBlob{2, Attachment{zeros}});
+    compress.flush();
+    REQUIRE(compress.getReferencedBytes() == random->size());
+
+    for (const auto& b : compress.buffers) {
+        decompress.accept(b->data(), b->size());
+    }
+    REQUIRE(decompress.objects.size() == 2);
+
+    MessageBlob first{};
+    decompress.objects[0]->get().convert(first);
+    REQUIRE(first.id == 1);
+    REQUIRE(first.blob.toVector() == *random);
+
+    // The other side does not need to know about the attachment
+    std::vector<char> second;
+    decompress.objects[1]->get().via.array.ptr[1].convert(second);
+    REQUIRE(second == *zeros);
+}
+
+TEST_CASE("Compressed block buffers are recycled") {
+    class RecyclingCompressionStream : public CompressionStream {
+    public:
+        RecyclingCompressionStream() : CompressionStream{maxMessageSize, 2} {
+        }
+
+        void sendBuffer(std::shared_ptr<std::vector<char>> buffer) override {
+            sent.push_back(buffer->data());
+            recycleBuffer(std::move(buffer));
+        }
+
+        std::vector<const char*> sent;
+    };
+
+    RecyclingCompressionStream compress{};
+
+    for (auto i = 0; i < 100; i++) {
+        msgpack::pack(compress, std::string{"Hello World!"});
+        compress.flush();
+    }
+
+    REQUIRE(compress.sent.size() == 100);
+    REQUIRE(compress.getBufferPool().getMisses() == 1);
+    REQUIRE(compress.getBufferPool().getHits() == 99);
+
+    // The same memory is reused for every block
+    for (const auto* ptr : compress.sent) {
+        REQUIRE(ptr == compress.sent.front());
+    }
+
+    // Buffers still referenced elsewhere are never handed out again
+    TestCompressionStream holding{};
+    for (auto i = 0; i < 10; i++) {
+        msgpack::pack(holding, i);
+        holding.flush();
+    }
+    REQUIRE(holding.getBufferPool().getHits() == 0);
+    REQUIRE(holding.getBufferPool().getMisses() == 10);
+}
+
+TEST_CASE("Received objects do not allocate in steady state") {
+    class RecyclingDecompressionStream : public DecompressionStream {
+    public:
+        RecyclingDecompressionStream() : DecompressionStream{maxMessageSize} {
+        }
+
+        void receiveObject(std::shared_ptr<msgpack::object_handle> oh) override {
+            const auto& o = oh->get();
+            if (o.type == msgpack::type::ARRAY && o.via.array.size == 2) {
+                sum += o.via.array.ptr[0].as<uint64_t>();
+                length += o.via.array.ptr[1].via.str.size;
+            }
+            count++;
+            recycleObject(std::move(oh));
+        }
+
+        size_t count{0};
+        uint64_t sum{0};
+        size_t length{0};
+    };
+
+    TestCompressionStream compress{};
+
+    const size_t total = 5000;
+    for (size_t i = 0; i < total; i++) {
+        msgpack::packer<CompressionStream> packer{compress};
+        packer.pack_array(2);
+        packer.pack(static_cast<uint64_t>(i));
+        packer.pack(std::string(i % 200, 'x'));
+        compress.flush();
+    }
+
+    RecyclingDecompressionStream decompress{};
+
+    // Warm up the buffers and the pools
+    const size_t warmup = 100;
+    for (size_t i = 0; i < warmup; i++) {
+        const auto& b = compress.buffers[i];
+        decompress.accept(b->data(), b->size());
+    }
+
+    size_t allocations = 0;
+    {
+        const AllocationCounter counter{};
+        for (size_t i = warmup; i < compress.buffers.size(); i++) {
+            const auto& b = compress.buffers[i];
+            decompress.accept(b->data(), b->size());
+        }
+        allocations = counter.getCount();
+    }
+
+    REQUIRE(decompress.count == total);
+    REQUIRE(decompress.sum == total * (total - 1) / 2);
+    REQUIRE(allocations == 0);
+    REQUIRE(decompress.getObjectPool().getMisses() == 1);
+}
+
+// The receive path before the zero-copy decompression, kept for the benchmark below.
+// Socket reads into a receive buffer, copies into the block buffer, decompresses into
+// a double buffer, and copies into the unpacker.
+class LegacyDecompressionStream {
+public:
+    LegacyDecompressionStream() : idx{0}, offset{0}, readCount{0} {
+        LZ4_setStreamDecode(&lz4StreamDecode, nullptr, 0);
+        raw.resize(maxMessageSize * 2);
+        cmpBuf.resize(LZ4_COMPRESSBOUND(maxMessageSize));
+    }
+
+    void accept(const char* src, size_t length) {
+        while (length > 0) {
+            if (offset < sizeof(uint32_t)) {
+                const auto toCopy = std::min(length, sizeof(uint32_t) - offset);
+                std::memcpy(reinterpret_cast<char*>(&readCount) + offset, src, toCopy);
+                length -= toCopy;
+                offset += toCopy;
+                src += toCopy;
+            }
+
+            if (length == 0) {
+                break;
+            }
+
+            const auto toRead = std::min(static_cast<size_t>(readCount + sizeof(uint32_t) - offset), length);
+            std::memcpy(cmpBuf.data() + offset - sizeof(uint32_t), src, toRead);
+            length -= toRead;
+            offset += toRead;
+            src += toRead;
+
+            if (offset == readCount + sizeof(uint32_t)) {
+                auto* dst = raw.data() + idx * maxMessageSize;
+                const int decBytes = LZ4_decompress_safe_continue(&lz4StreamDecode, cmpBuf.data(), dst,
+                                                                  static_cast<int>(readCount),
+                                                                  static_cast<int>(maxMessageSize));
+                if (decBytes > 0) {
+                    unp.reserve_buffer(decBytes);
+                    std::memcpy(unp.buffer(), dst, decBytes);
+                    unp.buffer_consumed(decBytes);
+
+                    auto oh = std::make_shared<msgpack::object_handle>();
+                    while (unp.next(*oh)) {
+                        count++;
+                        oh = std::make_shared<msgpack::object_handle>();
+                    }
+                }
+
+                idx = (idx + 1) % 2;
+                offset = 0;
+            }
+        }
+    }
+
+    size_t count{0};
+
+private:
+    LZ4_streamDecode_t lz4StreamDecode{};
+    std::vector<char> raw;
+    std::vector<char> cmpBuf;
+    msgpack::unpacker unp;
+    size_t idx;
+    size_t offset;
+    uint32_t readCount;
+};
+
+TEST_CASE("Benchmark decompression into the unpacker", "[.][benchmark]") {
+    class CountingDecompressionStream : public DecompressionStream {
+    public:
+        CountingDecompressionStream() : DecompressionStream{maxMessageSize} {
+        }
+
+        void receiveObject(std::shared_ptr<msgpack::object_handle> oh) override {
+            count++;
+        }
+
+        size_t count{0};
+    };
+
+    TestCompressionStream compress{};
+
+    // Compressible messages of mixed sizes
+    std::mt19937_64 rng{9725674ULL};
+    std::uniform_int_distribution<size_t> distLength{16, 1024 * 4};
+    std::uniform_int_distribution<int> distWord{0, 15};
+
+    size_t total = 0;
+    size_t messages = 0;
+    std::string text;
+    while (total < 1024 * 1024 * 256) {
+        text.resize(distLength(rng));
+        for (auto& c : text) {
+            c = static_cast<char>('a' + distWord(rng));
+        }
+
+        msgpack::pack(compress, text);
+        compress.flush();
+
+        total += text.size();
+        messages++;
+    }
+
+    // Concatenate the blocks into a single stream, the socket reads slice it up
+    std::vector<char> stream;
+    for (const auto& b : compress.buffers) {
+        stream.insert(stream.end(), b->begin(), b->end());
+    }
+
+    const size_t readSize = 1024 * 32;
+
+    LegacyDecompressionStream legacy{};
+    std::vector<char> receiveBuffer(readSize);
+
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < stream.size(); i += readSize) {
+        const auto length = std::min(readSize, stream.size() - i);
+        std::memcpy(receiveBuffer.data(), stream.data() + i, length); // The socket read
+        legacy.accept(receiveBuffer.data(), length);
+    }
+    const auto legacyElapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    CountingDecompressionStream decompress{};
+
+    start = std::chrono::steady_clock::now();
+    size_t i = 0;
+    while (i < stream.size()) {
+        size_t size = 0;
+        auto* dst = decompress.prepare(size);
+        const auto length = std::min(size, stream.size() - i);
+        std::memcpy(dst, stream.data() + i, length); // The socket read
+        decompress.commit(length);
+        i += length;
+    }
+    const auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    REQUIRE(legacy.count == messages);
+    REQUIRE(decompress.count == messages);
+
+    const auto mb = static_cast<double>(total) / (1024 * 1024);
+    std::cout << "Decompressed " << mb << " MB in " << messages << " messages" << std::endl;
+    std::cout << "Copy into unpacker: " << mb / legacyElapsed << " MB/s" << std::endl;
+    std::cout << "Decompress into unpacker: " << mb / elapsed << " MB/s" << std::endl;
+}
+
+TEST_CASE("Small and incompressible blocks are stored uncompressed") {
+    // Without the entropy estimate the random blocks are compressed first, then stored
+    // because they did not get any smaller. They stay a part of the LZ4 history.
+    const auto maxEntropy = GENERATE(7.2f, 8.0f);
+
+    TestCompressionStream compress{};
+    TestDecompressionStream decompress{};
+    compress.setBypass(64, maxEntropy);
+
+    std::mt19937_64 rng{9725674ULL};
+    std::uniform_int_distribution<int> dist{0, 255};
+
+    std::vector<std::vector<char>> originals;
+    for (auto i = 0; i < 300; i++) {
+        originals.emplace_back();
+        auto& data = originals.back();
+
+        switch (i % 3) {
+            case 0: {
+                // Tiny message, below the threshold
+                data.resize(8, static_cast<char>(i));
+                break;
+            }
+            case 1: {
+                // Random data, high entropy
+                data.resize(1024 * 6);
+                for (auto& c : data) {
+                    c = static_cast<char>(dist(rng));
+                }
+                break;
+            }
+            default: {
+                // Repeated text that refers back to the previous blocks
+                const std::string text = "Hello World! This is a compressible message. ";
+                while (data.size() < 1024 * 6) {
+                    data.insert(data.end(), text.begin(), text.end());
+                }
+                data[i % data.size()] = static_cast<char>(i);
+                break;
+            }
+        }
+
+        msgpack::pack(compress, data);
+        compress.flush();
+    }
+
+    REQUIRE(compress.buffers.size() == originals.size());
+    REQUIRE(compress.getStoredBlocks() == 200);
+
+    // The stored blocks carry the flag in the header, the first buffer starts with the stream preamble
+    const size_t preambleBytes = 12;
+    uint32_t header;
+    std::memcpy(&header, compress.buffers[0]->data() + preambleBytes, sizeof(header));
+    REQUIRE((header & 0x80000000U) != 0);
+    REQUIRE(compress.buffers[0]->size() == preambleBytes + sizeof(header) + 10);
+
+    std::memcpy(&header, compress.buffers[2]->data(), sizeof(header));
+    REQUIRE((header & 0x80000000U) == 0);
+    REQUIRE(compress.buffers[2]->size() < 1024);
+
+    for (const auto& b : compress.buffers) {
+        decompress.accept(b->data(), b->size());
+    }
+
+    REQUIRE(decompress.objects.size() == originals.size());
+    for (size_t i = 0; i < originals.size(); i++) {
+        std::vector<char> data;
+        decompress.objects[i]->get().convert(data);
+        REQUIRE(data == originals[i]);
+    }
+}
+
+TEST_CASE("Compress and decompress with each codec") {
+    const auto type = GENERATE(Codec::Type::None, Codec::Type::Lz4, Codec::Type::Lz4Hc);
+    const auto blockBytes = GENERATE(as<size_t>{}, 1024 * 4, 1024 * 64);
+
+    class CodecCompressionStream : public CompressionStream {
+    public:
+        explicit CodecCompressionStream(const Codec& codec) : CompressionStream{codec} {
+        }
+
+        void sendBuffer(std::shared_ptr<std::vector<char>> buffer) override {
+            buffers.push_back(std::move(buffer));
+        }
+
+        std::vector<std::shared_ptr<std::vector<char>>> buffers;
+    };
+
+    Codec codec{};
+    codec.type = type;
+    codec.acceleration = 4;
+    codec.level = 6;
+    codec.blockBytes = blockBytes;
+
+    CodecCompressionStream compress{codec};
+
+    // The receiving side is configured by the preamble
+    TestDecompressionStream decompress{};
+
+    std::vector<std::string> originals;
+    for (auto i = 0; i < 500; i++) {
+        originals.push_back(std::string(static_cast<size_t>(i * 37 % 3000), 'a' + i % 26) + std::to_string(i));
+        msgpack::pack(compress, originals.back());
+        compress.flush();
+    }
+
+    size_t total = 0;
+    for (const auto& b : compress.buffers) {
+        total += b->size();
+        decompress.accept(b->data(), b->size());
+    }
+
+    REQUIRE(decompress.getRemoteCodec().type == type);
+    REQUIRE(decompress.getRemoteCodec().blockBytes == blockBytes);
+    REQUIRE(decompress.objects.size() == originals.size());
+    for (size_t i = 0; i < originals.size(); i++) {
+        REQUIRE(decompress.objects[i]->get().as<std::string>() == originals[i]);
+    }
+
+    if (type == Codec::Type::None) {
+        REQUIRE(compress.getStoredBlocks() == compress.buffers.size());
+    } else {
+        REQUIRE(compress.getStoredBlocks() < compress.buffers.size());
+    }
+}
+
+TEST_CASE("Reject a stream without the preamble") {
+    TestDecompressionStream decompress{};
+
+    const std::vector<char> garbage(64, 'x');
+    REQUIRE_THROWS_WITH(decompress.accept(garbage.data(), garbage.size()), "Bad stream preamble");
+}
+
+TEST_CASE("Reject a codec out of range") {
+    class CodecCompressionStream : public CompressionStream {
+    public:
+        explicit CodecCompressionStream(const Codec& codec) : CompressionStream{codec} {
+        }
+
+        void sendBuffer(std::shared_ptr<std::vector<char>> buffer) override {
+        }
+    };
+
+    Codec codec{};
+    codec.blockBytes = 512;
+    REQUIRE_THROWS_WITH(CodecCompressionStream{codec}, "Codec block size is out of range");
+
+    codec = Codec{};
+    codec.acceleration = -1;
+    REQUIRE_THROWS_WITH(CodecCompressionStream{codec}, "Codec acceleration is out of range");
+
+    codec = Codec{};
+    codec.type = Codec::Type::Lz4Hc;
+    codec.level = 13;
+    REQUIRE_THROWS_WITH(CodecCompressionStream{codec}, "Codec level is out of range");
+
+    // Only the setting of the codec type is checked
+    codec.type = Codec::Type::Lz4;
+    REQUIRE_NOTHROW(CodecCompressionStream{codec});
+}
+
+TEST_CASE("Benchmark codecs", "[.][benchmark]") {
+    struct Mode {
+        std::string name;
+        Codec codec;
+    };
+
+    std::vector<Mode> modes;
+    modes.push_back({"none", Codec{Codec::Type::None, 1, 9, 1024 * 8}});
+    modes.push_back({"lz4 acceleration 1", Codec{Codec::Type::Lz4, 1, 9, 1024 * 8}});
+    modes.push_back({"lz4 acceleration 8", Codec{Codec::Type::Lz4, 8, 9, 1024 * 8}});
+    modes.push_back({"lz4 64KB blocks", Codec{Codec::Type::Lz4, 1, 9, 1024 * 64}});
+    modes.push_back({"lz4hc level 4", Codec{Codec::Type::Lz4Hc, 1, 4, 1024 * 8}});
+    modes.push_back({"lz4hc level 9", Codec{Codec::Type::Lz4Hc, 1, 9, 1024 * 8}});
+    modes.push_back({"lz4hc level 12", Codec{Codec::Type::Lz4Hc, 1, 12, 1024 * 8}});
+
+    // Structured messages with some repetition, similar to the real traffic
+    std::mt19937_64 rng{9725674ULL};
+    std::uniform_int_distribution<int> distWord{0, 63};
+    std::uniform_int_distribution<uint64_t> distValue{0, 1000000};
+    std::vector<std::string> words;
+    for (auto i = 0; i < 64; i++) {
+        words.push_back("word" + std::to_string(i * 7919));
+    }
+
+    std::vector<std::vector<char>> messages;
+    size_t total = 0;
+    while (total < 1024 * 1024 * 64) {
+        msgpack::sbuffer sbuf;
+        msgpack::packer<msgpack::sbuffer> packer{sbuf};
+        packer.pack_array(3);
+        packer.pack(distValue(rng));
+        std::string text;
+        for (auto i = 0; i < 32; i++) {
+            text += words[distWord(rng)] + " ";
+        }
+        packer.pack(text);
+        packer.pack(std::vector<uint64_t>{distValue(rng), distValue(rng), distValue(rng)});
+
+        messages.emplace_back(sbuf.data(), sbuf.data() + sbuf.size());
+        total += sbuf.size();
+    }
+
+    for (const auto& mode : modes) {
+        class CodecCompressionStream : public CompressionStream {
+        public:
+            explicit CodecCompressionStream(const Codec& codec) : CompressionStream{codec, 1024 * 1024} {
+            }
+
+            void sendBuffer(std::shared_ptr<std::vector<char>> buffer) override {
+                bytes += buffer->size();
+                buffers.push_back(std::move(buffer));
+            }
+
+            std::vector<std::shared_ptr<std::vector<char>>> buffers;
+            size_t bytes{0};
+        };
+
+        class CountingDecompressionStream : public DecompressionStream {
+        public:
+            void receiveObject(std::shared_ptr<msgpack::object_handle> oh) override {
+                count++;
+                recycleObject(std::move(oh));
+            }
+
+            size_t count{0};
+        };
+
+        CodecCompressionStream compress{mode.codec};
+
+        auto start = std::chrono::steady_clock::now();
+        for (const auto& message : messages) {
+            compress.write(message.data(), message.size());
+            compress.flush();
+        }
+        const auto compressElapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        CountingDecompressionStream decompress{};
+
+        start = std::chrono::steady_clock::now();
+        for (const auto& b : compress.buffers) {
+            decompress.accept(b->data(), b->size());
+        }
+        const auto decompressElapsed =
+            std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        REQUIRE(decompress.count == messages.size());
+
+        const auto mb = static_cast<double>(total) / (1024 * 1024);
+        std::cout << mode.name << ": ratio " << static_cast<double>(total) / compress.bytes << ", compress "
+                  << mb / compressElapsed << " MB/s, decompress " << mb / decompressElapsed << " MB/s" << std::endl;
+    }
+}
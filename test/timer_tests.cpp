@@ -0,0 +1,82 @@
+#include <catch.hpp>
+#include <future>
+#include <msgnet/timer.hpp>
+#include <random>
+#include <thread>
+
+using namespace MsgNet;
+
+TEST_CASE("Timer wheel executes the tasks in order of their deadlines") {
+    asio::io_context service;
+    auto work = asio::make_work_guard(service);
+    std::thread thread{[&]() { service.run(); }};
+
+    std::mutex mutex;
+    std::vector<int> order;
+    std::promise<void> done;
+
+    {
+        TimerWheel timers{service, std::chrono::milliseconds(1)};
+
+        // Covers the first two levels of the wheel
+        const auto start = std::chrono::steady_clock::now();
+        for (const auto delay : {300, 5, 70, 1, 130}) {
+            timers.add(std::chrono::milliseconds(delay), [&, delay, start]() {
+                REQUIRE(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(delay));
+                std::lock_guard<std::mutex> lock{mutex};
+                order.push_back(delay);
+                if (order.size() == 5) {
+                    done.set_value();
+                }
+            });
+        }
+        REQUIRE(timers.size() == 5);
+
+        REQUIRE(done.get_future().wait_for(std::chrono::milliseconds(2000)) == std::future_status::ready);
+        REQUIRE(timers.size() == 0);
+    }
+
+    work.reset();
+    thread.join();
+
+    REQUIRE(order == std::vector<int>{1, 5, 70, 130, 300});
+}
+
+TEST_CASE("Timer wheel with many tasks") {
+    asio::io_context service;
+    auto work = asio::make_work_guard(service);
+    std::thread thread{[&]() { service.run(); }};
+
+    const size_t total = 10000;
+    std::atomic_size_t executed{0};
+    std::atomic_size_t early{0};
+    std::promise<void> done;
+
+    {
+        TimerWheel timers{service, std::chrono::milliseconds(1)};
+
+        std::mt19937 rng{42};
+        std::uniform_int_distribution<int> dist{0, 200};
+
+        const auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < total; i++) {
+            const auto delay = std::chrono::milliseconds(dist(rng));
+            timers.add(delay, [&, delay, start]() {
+                if (std::chrono::steady_clock::now() - start < delay) {
+                    early++;
+                }
+                if (executed.fetch_add(1) + 1 == total) {
+                    done.set_value();
+                }
+            });
+        }
+
+        REQUIRE(done.get_future().wait_for(std::chrono::milliseconds(2000)) == std::future_status::ready);
+    }
+
+    work.reset();
+    thread.join();
+
+    REQUIRE(executed == total);
+    REQUIRE(early == 0);
+}